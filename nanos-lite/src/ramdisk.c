@@ -1,14 +1,16 @@
 #include "common.h"
 
-extern uint8_t ramdisk_start;
-extern uint8_t ramdisk_end;
-#define RAMDISK_SIZE ((&ramdisk_end) - (&ramdisk_start))
-
 /* The kernel is monolithic, therefore we do not need to
  * translate the address `buf' from the user process to
  * a physical one, which is necessary for a microkernel.
  */
 
+#ifndef HAS_DISK
+
+extern uint8_t ramdisk_start;
+extern uint8_t ramdisk_end;
+#define RAMDISK_SIZE ((&ramdisk_end) - (&ramdisk_start))
+
 /* read `len' bytes starting from `offset' of ramdisk into `buf' */
 void ramdisk_read(void *buf, off_t offset, size_t len) {
   assert(offset + len <= RAMDISK_SIZE);
@@ -29,3 +31,96 @@ void init_ramdisk() {
 size_t get_ramdisk_size() {
   return RAMDISK_SIZE;
 }
+
+#else
+
+/* The file system image is on the disk device instead of being linked
+ * into the kernel. Whole sectors are transferred by the device directly
+ * into `buf', and only the partial sectors at both ends of a request go
+ * through `sector_buf'.
+ */
+
+#define SECTOR_SIZE _DISK_SECTOR_SIZE
+#define DISK_SIZE ((size_t)_disk_nr_sector() * SECTOR_SIZE)
+
+static uint8_t sector_buf[SECTOR_SIZE];
+
+static inline void disk_read(void *buf, uint32_t sector, uint32_t nr_sector) {
+  int ret = _disk_read(buf, sector, nr_sector);
+  assert(ret == 0);
+}
+
+static inline void disk_write(const void *buf, uint32_t sector, uint32_t nr_sector) {
+  int ret = _disk_write(buf, sector, nr_sector);
+  assert(ret == 0);
+}
+
+/* read `len' bytes starting from `offset' of ramdisk into `buf' */
+void ramdisk_read(void *buf, off_t offset, size_t len) {
+  assert(offset + len <= DISK_SIZE);
+  uint32_t sector = offset / SECTOR_SIZE;
+  size_t skip = offset % SECTOR_SIZE;
+
+  if (skip != 0 && len > 0) {
+    size_t n = (len < SECTOR_SIZE - skip ? len : SECTOR_SIZE - skip);
+    disk_read(sector_buf, sector, 1);
+    memcpy(buf, sector_buf + skip, n);
+    buf += n;
+    len -= n;
+    sector ++;
+  }
+
+  uint32_t nr_sector = len / SECTOR_SIZE;
+  if (nr_sector > 0) {
+    disk_read(buf, sector, nr_sector);
+    buf += nr_sector * SECTOR_SIZE;
+    len -= nr_sector * SECTOR_SIZE;
+    sector += nr_sector;
+  }
+
+  if (len > 0) {
+    disk_read(sector_buf, sector, 1);
+    memcpy(buf, sector_buf, len);
+  }
+}
+
+/* write `len' bytes starting from `buf' into the `offset' of ramdisk */
+void ramdisk_write(const void *buf, off_t offset, size_t len) {
+  assert(offset + len <= DISK_SIZE);
+  uint32_t sector = offset / SECTOR_SIZE;
+  size_t skip = offset % SECTOR_SIZE;
+
+  if (skip != 0 && len > 0) {
+    size_t n = (len < SECTOR_SIZE - skip ? len : SECTOR_SIZE - skip);
+    disk_read(sector_buf, sector, 1);
+    memcpy(sector_buf + skip, buf, n);
+    disk_write(sector_buf, sector, 1);
+    buf += n;
+    len -= n;
+    sector ++;
+  }
+
+  uint32_t nr_sector = len / SECTOR_SIZE;
+  if (nr_sector > 0) {
+    disk_write(buf, sector, nr_sector);
+    buf += nr_sector * SECTOR_SIZE;
+    len -= nr_sector * SECTOR_SIZE;
+    sector += nr_sector;
+  }
+
+  if (len > 0) {
+    disk_read(sector_buf, sector, 1);
+    memcpy(sector_buf, buf, len);
+    disk_write(sector_buf, sector, 1);
+  }
+}
+
+void init_ramdisk() {
+  Log("disk info: %d sectors, size = %d bytes", _disk_nr_sector(), DISK_SIZE);
+}
+
+size_t get_ramdisk_size() {
+  return DISK_SIZE;
+}
+
+#endif
@@ -1,7 +1,11 @@
 #ifndef __COMMON_H__
 #define __COMMON_H__
 
+/* Build with -DNO_DEBUG to leave out the instruction trace, as the
+ * library does. */
+#ifndef NO_DEBUG
 #define DEBUG
+#endif
 //#define DIFF_TEST
 
 /* You will define this macro in PA2 */
@@ -11,6 +15,7 @@
 #include "macro.h"
 
 #include <stdint.h>
+#include <inttypes.h>
 #include <assert.h>
 #include <string.h>
 
@@ -0,0 +1,69 @@
+#ifndef __CONTEXT_H__
+#define __CONTEXT_H__
+
+#include "common.h"
+#include "cpu/reg.h"
+#include "device/port-io.h"
+#include "device/mmio.h"
+
+/* A guest machine: its CPU, memory and I/O spaces, and how far it has run.
+ * Several guests can live in one process. The code executing a guest works
+ * on the context in `nemu_ctx', which is per thread; a context must only be
+ * run by one thread at a time.
+ */
+typedef struct NEMUContext {
+  CPU_state cpu;
+  int state;
+  uint32_t halt_ret;
+
+  /* number of guest instructions executed */
+  uint64_t nr_guest_instr;
+  /* number of guest memory accesses, instruction fetches included */
+  uint64_t nr_mem_read, nr_mem_write;
+  /* where the execution last stopped, see cpu_exec() */
+  bool stopped;
+  vaddr_t stop_eip;
+  uint64_t stop_instr;
+
+  /* The processors of a multi-processor guest are contexts sharing the
+   * memory and the I/O spaces, see src/device/mpe.c. */
+  uint8_t *pmem;
+  PIO_space *pio;
+  MMIO_space *mmio;
+
+  /* the number of this processor, 0 for the one started by the monitor */
+  int cpu_id;
+  /* interrupts posted to this processor, see include/cpu/intr.h */
+  uint32_t intr_pending;
+  /* The IDT of this processor decoded, valid while `idt_gen' is the global
+   * one, see src/cpu/intr.c. */
+  uint64_t idt_gen;
+  struct {
+    vaddr_t target;
+    uint16_t cs;
+    bool trap;      /* a trap gate, which leaves IF as it is */
+    bool present;
+  } idt[256];
+
+  /* set while the guest is fuzzed in process, see src/fuzz.c */
+  struct FuzzState *fuzz;
+} NEMUContext;
+
+extern __thread NEMUContext *nemu_ctx;
+
+/* Switch the current thread to `ctx', and return the context it was on. */
+static inline NEMUContext *nemu_switch_ctx(NEMUContext *ctx) {
+  NEMUContext *prev = nemu_ctx;
+  nemu_ctx = ctx;
+  return prev;
+}
+
+/* The state of the guest being executed */
+#define cpu (nemu_ctx->cpu)
+#define nemu_state (nemu_ctx->state)
+#define nr_guest_instr (nemu_ctx->nr_guest_instr)
+#define nr_mem_read (nemu_ctx->nr_mem_read)
+#define nr_mem_write (nemu_ctx->nr_mem_write)
+#define pmem (nemu_ctx->pmem)
+
+#endif
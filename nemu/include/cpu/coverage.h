@@ -0,0 +1,45 @@
+#ifndef __CPU_COVERAGE_H__
+#define __CPU_COVERAGE_H__
+
+#include "common.h"
+
+/* Coverage of the decoder and the executor for coverage-guided fuzzing, in
+ * the bitmap layout of AFL. A location is an opcode table entry, a form of
+ * ModR/M, or the outcome of an EHelper. Each pair of successive locations
+ * is an edge, which bumps its byte of the bitmap.
+ *
+ * The locations are numbers which do not depend on where NEMU is loaded,
+ * so the bitmaps of different processes can be compared and merged.
+ */
+
+#define COV_MAP_SIZE (1 << 16)
+
+/* An entry of `opcode_table' is located by its index. An entry of a group
+ * table is located by the opcode it is reached from and its sub-opcode. */
+#define COV_GROUP 0x200
+#define cov_group_loc(opcode, ext) (COV_GROUP + (opcode) * 8 + (ext))
+/* the locations of the ModR/M forms, see modrm.c */
+#define COV_MODRM 0x2000
+/* the outcome of the entry at location `loc', jumping or not */
+#define cov_exec_loc(loc, is_jmp) (0x4000 + (loc) * 2 + (is_jmp))
+
+/* NULL unless coverage is enabled */
+extern uint8_t *cov_map;
+extern __thread uint32_t cov_prev;
+
+static inline uint32_t cov_loc(uint32_t id) {
+  uint32_t h = id * 2654435761u;
+  return h ^ (h >> 15);
+}
+
+static inline void cov_hit(uint32_t id) {
+  if (cov_map != NULL) {
+    uint32_t loc = cov_loc(id);
+    cov_map[(loc ^ cov_prev) & (COV_MAP_SIZE - 1)] ++;
+    cov_prev = loc >> 1;
+  }
+}
+
+void init_coverage(const char *map_file);
+
+#endif
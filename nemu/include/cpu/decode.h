@@ -64,8 +64,8 @@ void read_ModR_M(vaddr_t *, Operand *, bool, Operand *, bool);
 
 void operand_write(Operand *, rtlreg_t *);
 
-/* shared by all helper functions */
-extern DecodeInfo decoding;
+/* shared by all helper functions, one per thread executing a guest */
+extern __thread DecodeInfo decoding;
 
 #define id_src (&decoding.src)
 #define id_src2 (&decoding.src2)
@@ -83,6 +83,7 @@ make_DHelper(I_E2G);
 make_DHelper(I_G2E);
 make_DHelper(I);
 make_DHelper(r);
+make_DHelper(a2r);
 make_DHelper(E);
 make_DHelper(gp7_E);
 make_DHelper(test_I);
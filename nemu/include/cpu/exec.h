@@ -23,6 +23,19 @@ static inline uint32_t instr_fetch(vaddr_t *eip, int len) {
 
 void rtl_setcc(rtlreg_t*, uint8_t);
 
+/* Instruction mix statistics, only collected when enabled. */
+extern bool opstat_enabled;
+/* the ModR/M form of the current instruction, set by read_ModR_M() */
+enum { OPSTAT_MODRM_NONE, OPSTAT_MODRM_REG, OPSTAT_MODRM_MEM };
+extern __thread int opstat_modrm;
+typedef struct {
+  uint64_t instr, byte, prefix, modrm_mem, modrm_reg;
+} OpstatSummary;
+void opstat_summary(OpstatSummary *);
+void opstat_report(FILE *, bool json);
+void opstat_reset();
+void opstat_foreach(void (*)(const char *opcode, const char *name, uint64_t count));
+
 static inline const char* get_cc_name(int subcode) {
   static const char *cc_name[] = {
     "o", "no", "b", "nb",
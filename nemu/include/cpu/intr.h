@@ -0,0 +1,57 @@
+#ifndef __CPU_INTR_H__
+#define __CPU_INTR_H__
+
+#include "nemu.h"
+#include "monitor/reverse.h"
+
+/* The interrupt lines of a processor, like those of a local APIC. The devices
+ * and the other processors post to `intr_pending' of its context, and the
+ * processor takes them between instructions when IF is set.
+ */
+enum { INTR_TIMER, INTR_IPI, NR_INTR };
+
+/* the vectors of the lines in the IDT */
+#define IRQ_TIMER 32
+#define IRQ_IPI 48
+
+static inline void post_intr(NEMUContext *ctx, int line) {
+  __atomic_or_fetch(&ctx->intr_pending, 1u << line, __ATOMIC_RELEASE);
+}
+
+void take_intr(void);
+void deliver_intr(int line);
+void raise_intr(uint8_t NO, vaddr_t ret_addr);
+
+/* The gates are decoded from the IDT once, and again only after lidt or a
+ * store to the pages of an IDT. The pages of the IDTs loaded by any
+ * processor are marked in `idt_page_map', and a store to them bumps
+ * `idt_gen', which makes every processor decode its IDT again.
+ */
+#define IDT_PAGE_SHIFT 12
+
+extern uint8_t idt_page_map[];
+extern uint64_t idt_gen;
+
+void load_idt(vaddr_t base, uint16_t limit);
+
+static inline bool idt_page_hit(paddr_t addr) {
+  uint32_t page = addr >> IDT_PAGE_SHIFT;
+  return (idt_page_map[page >> 3] >> (page & 7)) & 1;
+}
+
+/* Called for every store to the memory. */
+static inline void idt_note_write(paddr_t addr, size_t len) {
+  if (idt_page_hit(addr) || idt_page_hit(addr + len - 1)) {
+    __atomic_add_fetch(&idt_gen, 1, __ATOMIC_RELEASE);
+  }
+}
+
+/* Called after every instruction. A replay for reverse execution takes
+ * the interrupts in the log instead of those pending, up to the check after
+ * the last instruction executed before. */
+static inline void check_intr(void) {
+  if (nr_guest_instr <= ckpt_replay_end) { ckpt_replay_intr(); }
+  else if (nemu_ctx->intr_pending != 0 && cpu.eflags.IF) { take_intr(); }
+}
+
+#endif
@@ -46,11 +46,18 @@ typedef union {
       };
       rtlreg_t val;   
     } eflags;
+  rtlreg_t cs;
+  // IDTR, loaded by lidt
+  struct {
+    uint16_t limit;
+    vaddr_t base;
+  } idtr;
   };
 
 } CPU_state;
 
-extern CPU_state cpu;
+/* `cpu' is the CPU of the guest being executed */
+#include "context.h"
 
 static inline int check_reg_index(int index) {
   assert(index >= 0 && index < 8);
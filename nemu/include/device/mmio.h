@@ -2,9 +2,32 @@
 #define __MMIO_H__
 
 #include "common.h"
+#include <pthread.h>
 
 typedef void(*mmio_callback_t)(paddr_t, int, bool);
 
+#define MMIO_SPACE_MAX (1024 * 1024)
+#define NR_MMIO_MAP 8
+
+typedef struct {
+  paddr_t low;
+  paddr_t high;
+  uint8_t *mmio_space;
+  mmio_callback_t callback;
+} MMIO_t;
+
+/* The memory-mapped I/O space of a guest, see include/context.h */
+typedef struct {
+  uint8_t space_pool[MMIO_SPACE_MAX];
+  uint32_t space_free_index;
+  MMIO_t maps[NR_MMIO_MAP];
+  int nr_map;
+  /* serializes the accesses from the processors of the guest, once
+   * `shared' is set like the one of the port I/O space */
+  pthread_mutex_t lock;
+  bool shared;
+} MMIO_space;
+
 void* add_mmio_map(paddr_t, int, mmio_callback_t);
 int is_mmio(paddr_t);
 
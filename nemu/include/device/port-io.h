@@ -2,12 +2,43 @@
 #define __PORT_IO_H__
 
 #include "common.h"
+#include <pthread.h>
 
 typedef void(*pio_callback_t)(ioaddr_t, int, bool);
 
+#define PORT_IO_SPACE_MAX 65536
+#define NR_PIO_MAP 16
+
+typedef struct {
+  ioaddr_t low;
+  ioaddr_t high;
+  pio_callback_t callback;
+} PIO_t;
+
+/* The port-mapped I/O space of a guest, see include/context.h */
+typedef struct {
+  /* "+ 3" is for hacking, see pio_read() */
+  uint8_t space[PORT_IO_SPACE_MAX + 3];
+  PIO_t maps[NR_PIO_MAP];
+  int nr_map;
+  /* Direct index from a port to the map covering it, built by add_pio_map().
+   * The entry is the map number plus one, so zero means the port is unmapped.
+   */
+  uint8_t port_map[PORT_IO_SPACE_MAX];
+  /* The number of accesses to each port, shown by `info p' in the monitor. */
+  uint64_t port_count[PORT_IO_SPACE_MAX];
+  /* Serializes the accesses from the processors of the guest, so a device
+   * sees the processor accessing it in `nemu_ctx'. It is only taken once
+   * `shared' is set, when a second processor is started. */
+  pthread_mutex_t lock;
+  bool shared;
+} PIO_space;
+
 void* add_pio_map(ioaddr_t, int, pio_callback_t);
 
 uint32_t pio_read(ioaddr_t, int);
 void pio_write(ioaddr_t, int, uint32_t);
 
+void pio_show_stats();
+
 #endif
@@ -0,0 +1,20 @@
+#ifndef __FUZZ_H__
+#define __FUZZ_H__
+
+#include "common.h"
+
+/* The hooks of the in-process fuzzing harness, see src/fuzz.c. They are only
+ * called for a context with `fuzz' set. */
+
+/* Return false and end the case if the access is out of the memory. */
+bool fuzz_check_read(vaddr_t addr, int len);
+/* Also save the page for the restore, and log the store for the check. */
+bool fuzz_note_store(vaddr_t addr, int len, uint32_t data);
+/* Called at an invalid opcode. */
+void fuzz_invalid(void);
+/* End the case at an exception NEMU can not deliver. */
+void fuzz_fault(void);
+
+void fuzz_destroy(struct FuzzState *);
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef __LIBNEMU_H__
+#define __LIBNEMU_H__
+
+#include <stdint.h>
+
+/* The interface to embed NEMU into another program, built by `make lib'.
+ * Each context is an independent guest machine, so a program can run many
+ * guests, e.g. one per thread of a thread pool. A context must not be run by
+ * two threads at the same time. The guests have no devices.
+ */
+
+typedef struct NEMUContext NEMUContext;
+
+/* Create a guest, with the instruction pointer at the entry of the image.
+ * Return NULL if the memory can not be allocated. */
+NEMUContext *nemu_create(void);
+
+/* Load the image `img_file' to the guest memory. An ELF executable is loaded
+ * by its segments and the guest starts at its entry, otherwise the file is a
+ * raw image. Return 0 on success, -1 if the file can not be loaded. */
+int nemu_load(NEMUContext *ctx, const char *img_file);
+
+/* Execute at most `n' instructions on the calling thread.
+ * Return 1 if the guest has ended, 0 otherwise. */
+int nemu_run(NEMUContext *ctx, uint64_t n);
+
+/* The value of eax at `nemu_trap' after the guest has ended, 0 for a good
+ * trap. It is -1 if the guest ended at an invalid instruction. */
+uint32_t nemu_exit_code(NEMUContext *ctx);
+
+/* The number of instructions the guest has executed */
+uint64_t nemu_instr_count(NEMUContext *ctx);
+
+void nemu_destroy(NEMUContext *ctx);
+
+/* In-process fuzzing of the decoder and the executor, see tools/fuzz.
+ *
+ * A case is a few bytes of code and the registers to start with. NEMU and a
+ * reference (see include/monitor/difftest.h) both run it one instruction at
+ * a time, and their registers and memory stores are compared after each.
+ * Then the registers and the memory are restored from the template, so the
+ * next case starts from the same state without a new process. The reference
+ * is shared by the process, so only one context per process can be fuzzed.
+ */
+
+/* the registers of a case, in the order of the encoding of x86 */
+typedef struct {
+  uint32_t eax, ecx, edx, ebx, esp, ebp, esi, edi;
+  uint32_t eip, eflags;
+} NEMURegs;
+
+enum {
+  NEMU_FUZZ_SAME,     /* no difference until the end of the case */
+  NEMU_FUZZ_DIVERGED, /* NEMU and the reference disagree */
+  NEMU_FUZZ_UNIMPL,   /* NEMU does not implement an instruction the reference runs */
+  NEMU_FUZZ_REF_FAIL, /* the reference can not execute an instruction NEMU has run */
+};
+
+typedef struct {
+  int status;         /* NEMU_FUZZ_* */
+  int nr_instr;       /* the instructions executed by NEMU */
+  uint32_t eip;       /* the instruction ending the case */
+  NEMURegs nemu, ref; /* the registers after it */
+} NEMUFuzzResult;
+
+/* Take the current memory and CPU of `ctx' as the template of the cases,
+ * and load the reference from the shared library `ref_so'.
+ * Return 0 on success, -1 if the reference can not be loaded. */
+int nemu_fuzz_init(NEMUContext *ctx, const char *ref_so);
+
+/* Run the case of `code' placed at `regs->eip' for at most `n' instructions
+ * and restore the template. Return the status, or -1 if the code does not
+ * fit in the memory. The case ends early at an invalid opcode, `nemu_trap',
+ * an access out of the memory, or an instruction the reference can not
+ * execute, which is reported as NEMU_FUZZ_REF_FAIL. */
+int nemu_fuzz_one(NEMUContext *ctx, const uint8_t *code, int len,
+    const NEMURegs *regs, int n, NEMUFuzzResult *res);
+
+#endif
@@ -3,7 +3,13 @@
 
 #include "common.h"
 
-extern uint8_t pmem[];
+#define PMEM_SIZE (128 * 1024 * 1024)
+
+/* the guest image is loaded here */
+#define ENTRY_START 0x100000
+
+/* `pmem', `nr_mem_read' and `nr_mem_write' belong to the guest being executed */
+#include "context.h"
 
 /* convert the guest physical address in the guest program to host virtual address in NEMU */
 #define guest_to_host(p) ((void *)(pmem + (unsigned)p))
@@ -14,5 +20,10 @@ uint32_t vaddr_read(vaddr_t, int);
 uint32_t paddr_read(paddr_t, int);
 void vaddr_write(vaddr_t, int, uint32_t);
 void paddr_write(paddr_t, int, uint32_t);
+uint32_t vaddr_xchg(vaddr_t, int, uint32_t);
+void vaddr_write_block(vaddr_t, const uint32_t *, int);
+
+void mem_lock_begin();
+bool mem_lock_end();
 
 #endif
@@ -0,0 +1,40 @@
+#ifndef __BREAKPOINT_H__
+#define __BREAKPOINT_H__
+
+#include "common.h"
+
+/* The addresses of the breakpoints are kept in an open-addressing hash
+ * set, so checking an eip costs a single probe in the common case.
+ */
+
+#define BP_HASH_BITS 7
+#define BP_HASH_SIZE (1 << BP_HASH_BITS)
+
+extern int nr_bp;
+extern vaddr_t bp_hash_addr[];
+extern int8_t bp_hash_idx[];  /* index into the breakpoint pool, -1 for an empty slot */
+
+static inline uint32_t bp_hash(vaddr_t addr) {
+  return (addr * 0x9e3779b1u) >> (32 - BP_HASH_BITS);
+}
+
+bool bp_hit(int idx);
+
+/* Return true if the execution should stop at `eip'. */
+static inline bool check_breakpoint(vaddr_t eip) {
+  if (nr_bp == 0) return false;
+  uint32_t h = bp_hash(eip);
+  while (bp_hash_idx[h] != -1) {
+    if (bp_hash_addr[h] == eip) return bp_hit(bp_hash_idx[h]);
+    h = (h + 1) & (BP_HASH_SIZE - 1);
+  }
+  return false;
+}
+
+bool bp_match(vaddr_t eip);
+int add_bp(vaddr_t addr, char *cond, char **err);
+bool del_bp(int no);
+bool set_bp_ignore(int no, int count);
+void show_breakpoints();
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef __DIFFTEST_H__
+#define __DIFFTEST_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* The interface of a reference implementation for differential testing.
+ * QEMU, driven by the GDB remote protocol, is built in. A reference can also
+ * be a shared library given by --difftest-ref, which is loaded into NEMU and
+ * exports these functions:
+ *
+ *   void difftest_init(size_t mem_size);
+ *   void difftest_memcpy(uint32_t addr, const void *buf, size_t n);
+ *   void difftest_getregs(DiffRegs *r);
+ *   void difftest_setregs(const DiffRegs *r);
+ *   int difftest_step(DiffStore *stores, int max);
+ *
+ * This header is shared with the references, so it only uses the C library.
+ */
+
+typedef struct {
+  uint32_t eax, ecx, edx, ebx, esp, ebp, esi, edi;
+  uint32_t eip, eflags;
+} DiffRegs;
+
+/* a store to memory made by an instruction */
+typedef struct {
+  uint32_t addr;
+  uint32_t len;
+  uint32_t data;
+} DiffStore;
+
+#define DIFF_MAX_STORE 16
+
+/* the return value of step() besides the number of stores */
+#define DIFF_NO_STORE (-1)  /* the reference does not report its stores */
+#define DIFF_FAIL (-2)      /* the reference can not execute the instruction */
+
+typedef struct {
+  const char *name;
+  /* Reset to the flat 32-bit protected mode with `mem_size' bytes of memory. */
+  void (*init)(size_t mem_size);
+  void (*memcpy)(uint32_t addr, const void *buf, size_t n);
+  void (*getregs)(DiffRegs *r);
+  void (*setregs)(const DiffRegs *r);
+  /* Execute one instruction and put the stores it made into `stores'. */
+  int (*step)(DiffStore *stores, int max);
+} DiffBackend;
+
+#endif
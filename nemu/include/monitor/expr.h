@@ -3,6 +3,61 @@
 
 #include "common.h"
 
-uint32_t expr(char *, bool *);
+/* Expressions support the C operators, registers ($eax, $ax, $al, $eip),
+ * symbols and numbers. They are evaluated with 64-bit unsigned integers,
+ * and a dereference reads 4 bytes of guest memory.
+ */
+uint64_t expr(char *, bool *);
+
+/* An expression is parsed into an AST once. The ASTs of recently used
+ * expressions are cached, so repeating a command does not parse again.
+ */
+#define EXPR_NODE_MAX 64
+
+typedef struct {
+  int type;       /* EXPR_NUM, EXPR_REG, EXPR_UNARY, EXPR_BINARY or EXPR_COND */
+  int op;         /* operator token */
+  uint64_t val;   /* constant or register */
+  int lhs, rhs, cond;
+} ExprNode;
+
+typedef struct {
+  int root;
+  int nr_node;
+  ExprNode node[EXPR_NODE_MAX];
+} Expr;
+
+const Expr *expr_parse(char *);
+uint64_t expr_eval(const Expr *, bool *);
+
+/* An expression compiled into postfix bytecode by expr_compile(), so that
+ * it can be evaluated many times without even walking the AST.
+ */
+#define EXPR_CODE_MAX (2 * EXPR_NODE_MAX)
+#define EXPR_REG_EIP 8
+#define EXPR_DEREF_MAX 8
+
+typedef struct {
+  uint16_t op;
+  uint64_t imm;   /* constant, register or jump target */
+} ExprInsn;
+
+typedef struct {
+  int len;
+  ExprInsn insn[EXPR_CODE_MAX];
+  /* Dependencies: the value can only change if one of these changes. */
+  uint32_t reg_mask;  /* bit i for register i, EXPR_REG_EIP for eip */
+  bool has_deref;     /* reads guest memory */
+  /* the addresses of the 4-byte reads, unless one of them is only known
+   * at run time */
+  bool deref_dynamic;
+  int nr_deref;
+  vaddr_t deref_addr[EXPR_DEREF_MAX];
+} ExprCode;
+
+bool expr_compile(char *, ExprCode *);
+uint64_t expr_run(const ExprCode *, bool *);
+uint32_t expr_reg_val(int);
+bool expr_const_deref(const ExprCode *, vaddr_t *);
 
 #endif
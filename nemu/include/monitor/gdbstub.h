@@ -0,0 +1,14 @@
+#ifndef __GDBSTUB_H__
+#define __GDBSTUB_H__
+
+#include "common.h"
+
+/* A server of the GDB remote serial protocol, so that the guest can be
+ * debugged with `target remote' in gdb. `addr' is a TCP port on localhost,
+ * or the path of a Unix socket.
+ */
+void init_gdbstub(const char *addr);
+bool gdbstub_attached();
+void gdbstub_mainloop();
+
+#endif
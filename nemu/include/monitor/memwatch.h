@@ -0,0 +1,52 @@
+#ifndef __MEMWATCH_H__
+#define __MEMWATCH_H__
+
+#include "common.h"
+
+/* Memory watchpoints watch a fixed range of guest memory, such as `w *0x1000'.
+ * Instead of being evaluated after every instruction, they are triggered by
+ * the stores to the watched range.
+ *
+ * The pages read by the expression watchpoints are watched as well, and
+ * `mw_store_gen' counts the stores to the watched pages, so that these
+ * watchpoints are only evaluated again after such a store. If one of them
+ * reads an address only known at run time, every store is counted.
+ */
+
+#define MW_PAGE_SHIFT 12
+
+extern int nr_mw;
+extern bool mw_watching, mw_every_store;
+extern uint8_t mw_page_map[];
+extern uint64_t mw_store_gen;
+
+void mw_store(vaddr_t, int);
+
+static inline bool mw_page_hit(vaddr_t addr) {
+  uint32_t page = addr >> MW_PAGE_SHIFT;
+  return (mw_page_map[page >> 3] >> (page & 7)) & 1;
+}
+
+/* Called for every store. Only stores to a page with a watched range
+ * take the slow path. */
+static inline void mw_check_store(vaddr_t addr, int len) {
+  if (mw_watching && (mw_every_store || mw_page_hit(addr) || mw_page_hit(addr + len - 1))) {
+    mw_store(addr, len);
+  }
+}
+
+/* Called for a store of any length not done by a processor, such as the
+ * DMA of a device. */
+void mw_check_dma(paddr_t, uint32_t);
+void mw_rebuild_page_map();
+
+int add_mw(char *expression, vaddr_t addr, int len, char **err);
+bool del_mw(int no);
+void show_memwatches();
+bool check_memwatches();
+bool memwatch_hit_pending();
+bool memwatch_last_hit(vaddr_t *);
+uint64_t memwatch_signature(uint64_t);
+void refresh_memwatches();
+
+#endif
@@ -1,7 +1,30 @@
 #ifndef __MONITOR_H__
 #define __MONITOR_H__
 
+#include "common.h"
+
 enum { NEMU_STOP, NEMU_RUNNING, NEMU_END };
-extern int nemu_state;
+/* `nemu_state' and `nr_guest_instr' belong to the guest being executed */
+#include "context.h"
+
+/* Stop the running guest. Another processor may end it at any time, which
+ * must not be overwritten, so the state is changed by compare-and-swap. */
+static inline void nemu_stop(void) {
+  int running = NEMU_RUNNING;
+  __atomic_compare_exchange_n(&nemu_state, &running, NEMU_STOP, false,
+      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+/* Remember where the execution stops. Resuming from there does not stop
+ * at the breakpoint on the same instruction again. */
+static inline void nemu_note_stop(void) {
+  nemu_ctx->stopped = true;
+  nemu_ctx->stop_eip = cpu.eip;
+  nemu_ctx->stop_instr = nr_guest_instr;
+}
+
+/* the number of instructions to run in batch mode, see --max-instr */
+extern uint64_t max_instr;
+int batch_exit_status();
 
 #endif
@@ -0,0 +1,19 @@
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include "common.h"
+#include "monitor/monitor.h"
+
+/* The profiler samples the guest call stack every `period' instructions. */
+
+extern uint64_t prof_next_sample;
+
+void profile_sample();
+
+static inline void profile_check() {
+  if (nr_guest_instr >= prof_next_sample) profile_sample();
+}
+
+void init_profile(const char *folded_file, uint64_t period);
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef __REVERSE_H__
+#define __REVERSE_H__
+
+#include "common.h"
+#include "monitor/monitor.h"
+
+/* Reverse execution. A checkpoint of the machine is taken every `interval'
+ * instructions, and going back restores the nearest checkpoint before the
+ * target and replays the guest from there.
+ *
+ * Guest memory is saved incrementally: the first store to a page after a
+ * checkpoint copies the old content of the page into the undo log of that
+ * checkpoint. Device memory outside the guest is logged on every write.
+ * The values returned by port reads and the interrupts taken are
+ * logged, so the replay sees the same input as the original execution.
+ */
+
+#define CKPT_PAGE_SHIFT 12
+#define CKPT_PAGE_SIZE (1 << CKPT_PAGE_SHIFT)
+
+extern bool ckpt_enabled;
+extern uint8_t ckpt_dirty[];
+extern uint64_t ckpt_next;
+extern uint64_t ckpt_replay_end;
+
+void ckpt_save_page(uint32_t page);
+void ckpt_take();
+
+/* Called before the guest memory in [addr, addr + len) is modified. */
+static inline void ckpt_note_write(paddr_t addr, size_t len) {
+  if (!ckpt_enabled) return;
+  uint32_t page = addr >> CKPT_PAGE_SHIFT;
+  uint32_t last = (addr + len - 1) >> CKPT_PAGE_SHIFT;
+  for (; page <= last; page ++) {
+    if (!((ckpt_dirty[page >> 3] >> (page & 7)) & 1)) ckpt_save_page(page);
+  }
+}
+
+/* Called before the device memory outside the guest in [host, host + len),
+ * e.g. a disk image, is modified. Nothing is tracked, every call is logged. */
+void ckpt_note_host_write(void *host, size_t len);
+
+/* Called after every instruction. */
+static inline void ckpt_check() {
+  if (nr_guest_instr >= ckpt_next) ckpt_take();
+}
+
+/* True while executing instructions which have been executed before.
+ * Devices should not repeat their output then. */
+static inline bool ckpt_replaying() {
+  return nr_guest_instr < ckpt_replay_end;
+}
+
+void ckpt_log_input(uint32_t);
+uint32_t ckpt_replay_input();
+/* The interrupts taken, replayed at the same instruction counts. */
+void ckpt_log_intr(int line);
+void ckpt_replay_intr();
+
+/* Device state outside the port I/O space, saved by every checkpoint. */
+void ckpt_add_state(void *, size_t);
+
+void init_reverse(uint64_t interval, size_t budget);
+void reverse_step(uint64_t n);
+void reverse_continue();
+void show_checkpoints();
+
+#endif
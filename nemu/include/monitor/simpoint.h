@@ -0,0 +1,37 @@
+#ifndef __SIMPOINT_H__
+#define __SIMPOINT_H__
+
+#include "common.h"
+#include "monitor/monitor.h"
+#include "cpu/decode.h"
+
+/* SimPoint sampling. The run of the guest is cut into intervals of the same
+ * number of instructions. The fast pass writes the basic block vector of
+ * each interval, and the detailed pass only instruments the representative
+ * intervals picked by tools/simpoint.py. */
+
+extern bool bbv_enabled;
+extern vaddr_t bbv_block_start;
+extern uint64_t bbv_block_len;
+/* the end of the current interval in either pass */
+extern uint64_t sp_next;
+/* set when the detailed pass has run all the intervals */
+extern bool sp_finished;
+
+void bbv_block_end();
+void simpoint_interval_end();
+
+/* Called after every instruction. A taken jump or an interrupt ends the
+ * current basic block. */
+static inline void simpoint_check() {
+  if (bbv_enabled) {
+    bbv_block_len ++;
+    if (cpu.eip != decoding.seq_eip) bbv_block_end();
+  }
+  if (nr_guest_instr >= sp_next) simpoint_interval_end();
+}
+
+void init_bbv(const char *bb_file, uint64_t interval);
+void init_simpoint(const char *prefix, uint64_t interval);
+
+#endif
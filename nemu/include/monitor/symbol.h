@@ -0,0 +1,19 @@
+#ifndef __SYMBOL_H__
+#define __SYMBOL_H__
+
+#include "common.h"
+
+typedef struct {
+  vaddr_t addr;
+  uint32_t size;
+  char *name;
+} Symbol;
+
+void init_symbols(const char *elf_file);
+bool symbol_lookup(const char *name, vaddr_t *addr);
+const Symbol *symbol_find(vaddr_t addr);
+int symbol_index(const Symbol *sym);
+const Symbol *symbol_at(int index);
+int nr_symbols();
+
+#endif
@@ -2,6 +2,9 @@
 #define __WATCHPOINT_H__
 
 #include "common.h"
+#include "monitor/expr.h"
+
+#define NR_WP 32
 
 typedef struct watchpoint {
   int NO;
@@ -10,11 +13,20 @@ typedef struct watchpoint {
   /* TODO: Add more members if necessary */
   char expression[32*32];
   int hit;
-  uint32_t value;
+  uint64_t value;
+
+  /* compiled expression and the state of its dependencies
+   * when it was last evaluated */
+  ExprCode code;
+  uint32_t reg_snap[EXPR_REG_EIP + 1];
+  uint64_t mem_gen;
 
 } WP;
 void show_watchpoints();
 bool check_watchpoints();
 bool del_wp(int n);
 int add_wp(char *expression,char** err);
+uint64_t watch_signature();
+void refresh_watchpoints();
+int wp_watch_derefs(void (*)(vaddr_t, int));
 #endif
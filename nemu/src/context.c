@@ -0,0 +1,98 @@
+#include "nemu.h"
+#include "monitor/monitor.h"
+#include "libnemu.h"
+#include "fuzz.h"
+#include <stdlib.h>
+#include <sys/mman.h>
+
+/* The memory is accessed by its field here, not by the macro of the current guest. */
+#undef pmem
+
+/* The guest of the monitor. Every thread starts on it, so the threads of
+ * the devices see the same guest as the monitor. */
+/* Page aligned, so the ELF loader can map the image into it. */
+static uint8_t main_pmem[PMEM_SIZE] __attribute__((aligned(4096)));
+static PIO_space main_pio = { .lock = PTHREAD_MUTEX_INITIALIZER };
+static MMIO_space main_mmio = { .lock = PTHREAD_MUTEX_INITIALIZER };
+static NEMUContext main_ctx = {
+  .state = NEMU_STOP, .pmem = main_pmem, .pio = &main_pio, .mmio = &main_mmio
+};
+
+__thread NEMUContext *nemu_ctx = &main_ctx;
+
+void cpu_exec(uint64_t);
+int load_elf(const char *, vaddr_t *);
+
+/* embedding interface, see include/libnemu.h */
+
+NEMUContext *nemu_create(void) {
+  NEMUContext *ctx = calloc(1, sizeof(NEMUContext));
+  if (ctx == NULL) return NULL;
+  /* zeroed and page aligned, see main_pmem */
+  ctx->pmem = mmap(NULL, PMEM_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ctx->pmem == MAP_FAILED) { ctx->pmem = NULL; }
+  ctx->pio = calloc(1, sizeof(PIO_space));
+  ctx->mmio = calloc(1, sizeof(MMIO_space));
+  if (ctx->pmem == NULL || ctx->pio == NULL || ctx->mmio == NULL) {
+    nemu_destroy(ctx);
+    return NULL;
+  }
+  pthread_mutex_init(&ctx->pio->lock, NULL);
+  pthread_mutex_init(&ctx->mmio->lock, NULL);
+
+  NEMUContext *prev = nemu_switch_ctx(ctx);
+  nemu_state = NEMU_STOP;
+  cpu.eip = ENTRY_START;
+  cpu.eflags.val = 0x2;
+  nemu_switch_ctx(prev);
+  return ctx;
+}
+
+int nemu_load(NEMUContext *ctx, const char *img_file) {
+  vaddr_t entry;
+  NEMUContext *prev = nemu_switch_ctx(ctx);
+  int ret = load_elf(img_file, &entry);
+  if (ret == 0) { cpu.eip = entry; }
+  nemu_switch_ctx(prev);
+  if (ret != 1) return ret;
+
+  FILE *fp = fopen(img_file, "rb");
+  if (fp == NULL) return -1;
+
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+
+  int ok = (size > 0 && size <= PMEM_SIZE - ENTRY_START &&
+      fread(ctx->pmem + ENTRY_START, size, 1, fp) == 1);
+
+  fclose(fp);
+  return (ok ? 0 : -1);
+}
+
+int nemu_run(NEMUContext *ctx, uint64_t n) {
+  NEMUContext *prev = nemu_switch_ctx(ctx);
+  if (nemu_state != NEMU_END) { cpu_exec(n); }
+  int ended = (nemu_state == NEMU_END);
+  nemu_switch_ctx(prev);
+  return ended;
+}
+
+uint32_t nemu_exit_code(NEMUContext *ctx) {
+  return ctx->halt_ret;
+}
+
+uint64_t nemu_instr_count(NEMUContext *ctx) {
+  NEMUContext *prev = nemu_switch_ctx(ctx);
+  uint64_t n = nr_guest_instr;
+  nemu_switch_ctx(prev);
+  return n;
+}
+
+void nemu_destroy(NEMUContext *ctx) {
+  if (ctx->fuzz != NULL) { fuzz_destroy(ctx->fuzz); }
+  if (ctx->pmem != NULL) { munmap(ctx->pmem, PMEM_SIZE); }
+  free(ctx->pio);
+  free(ctx->mmio);
+  free(ctx);
+}
@@ -0,0 +1,40 @@
+#include "nemu.h"
+#include "cpu/coverage.h"
+#include <stdlib.h>
+#include <sys/shm.h>
+
+/* The bitmap is the shared memory of AFL when NEMU is run by afl-fuzz, which
+ * passes its id in __AFL_SHM_ID. Otherwise it is written to a file at exit,
+ * so the bitmaps of many runs can be merged by OR. */
+
+uint8_t *cov_map = NULL;
+__thread uint32_t cov_prev = 0;
+static const char *cov_file = NULL;
+
+static void write_coverage() {
+  int i, nr_edge = 0;
+  for (i = 0; i < COV_MAP_SIZE; i ++) {
+    if (cov_map[i] != 0) { nr_edge ++; }
+  }
+  FILE *fp = fopen(cov_file, "wb");
+  if (fp == NULL || fwrite(cov_map, COV_MAP_SIZE, 1, fp) != 1) {
+    Log("Can not write '%s'", cov_file);
+  }
+  if (fp != NULL) { fclose(fp); }
+  Log("coverage: %d edges", nr_edge);
+}
+
+void init_coverage(const char *map_file) {
+  const char *shm_id = getenv("__AFL_SHM_ID");
+  if (shm_id != NULL) {
+    void *p = shmat(atoi(shm_id), NULL, 0);
+    Assert(p != (void *)-1, "Can not attach the shared memory of AFL (id %s)", shm_id);
+    cov_map = p;
+  }
+  else if (map_file != NULL) {
+    cov_map = calloc(COV_MAP_SIZE, 1);
+    assert(cov_map);
+    cov_file = map_file;
+    atexit(write_coverage);
+  }
+}
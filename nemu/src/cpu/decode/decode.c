@@ -1,9 +1,9 @@
 #include "cpu/exec.h"
 #include "cpu/rtl.h"
 
-/* shared by all helper functions */
-DecodeInfo decoding;
-rtlreg_t t0, t1, t2, t3;
+/* shared by all helper functions, one per thread executing a guest */
+__thread DecodeInfo decoding;
+__thread rtlreg_t t0, t1, t2, t3;
 const rtlreg_t tzero = 0;
 
 #define make_DopHelper(name) void concat(decode_op_, name) (vaddr_t *eip, Operand *op, bool load_val)
@@ -190,6 +190,12 @@ make_DHelper(r) {
   decode_op_r(eip, id_dest, true);
 }
 
+/* used by xchg with eAX */
+make_DHelper(a2r) {
+  decode_op_r(eip, id_dest, true);
+  decode_op_a(eip, id_src, true);
+}
+
 make_DHelper(E) {
   decode_op_rm(eip, id_dest, true, NULL, false);
 }
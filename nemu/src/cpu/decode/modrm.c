@@ -1,5 +1,6 @@
 #include "cpu/exec.h"
 #include "cpu/rtl.h"
+#include "cpu/coverage.h"
 
 void load_addr(vaddr_t *eip, ModR_M *m, Operand *rm) {
   assert(m->mod != 3);
@@ -45,6 +46,8 @@ void load_addr(vaddr_t *eip, ModR_M *m, Operand *rm) {
     rtl_add(&rm->addr, &rm->addr, &t0);
   }
 
+  cov_hit(COV_MODRM + (m->mod | (m->R_M == R_ESP) << 2 | (base_reg == -1) << 3 | (index_reg != -1) << 4));
+
 #ifdef DEBUG
   char disp_buf[16];
   char base_buf[8];
@@ -93,7 +96,12 @@ void read_ModR_M(vaddr_t *eip, Operand *rm, bool load_rm_val, Operand *reg, bool
 #endif
   }
 
+  if (opstat_enabled) {
+    opstat_modrm = (m.mod == 3 ? OPSTAT_MODRM_REG : OPSTAT_MODRM_MEM);
+  }
+
   if (m.mod == 3) {
+    cov_hit(COV_MODRM + 3);
     rm->type = OP_TYPE_REG;
     rm->reg = m.R_M;
     if (load_rm_val) {
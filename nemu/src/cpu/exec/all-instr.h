@@ -3,12 +3,20 @@
 make_EHelper(mov);
 
 make_EHelper(operand_size);
+make_EHelper(lock);
 
 make_EHelper(inv);
 make_EHelper(nemu_trap);
 make_EHelper(call);
 make_EHelper(push);
 make_EHelper(pop);
+make_EHelper(xchg);
 make_EHelper(sub);
 make_EHelper(xor);
 make_EHelper(ret);
+
+make_EHelper(lidt);
+make_EHelper(int);
+make_EHelper(iret);
+make_EHelper(in);
+make_EHelper(out);
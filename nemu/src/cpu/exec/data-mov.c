@@ -76,3 +76,16 @@ make_EHelper(lea) {
   operand_write(id_dest, &t2);
   print_asm_template2(lea);
 }
+
+make_EHelper(xchg) {
+  if (id_dest->type == OP_TYPE_MEM) {
+    /* xchg with memory is always atomic */
+    t0 = vaddr_xchg(id_dest->addr, id_dest->width, id_src->val);
+  }
+  else {
+    t0 = id_dest->val;
+    operand_write(id_dest, &id_src->val);
+  }
+  operand_write(id_src, &t0);
+  print_asm_template2(xchg);
+}
@@ -1,15 +1,18 @@
 #include "cpu/exec.h"
 #include "all-instr.h"
+#include "cpu/coverage.h"
+#include <stdlib.h>
 
 typedef struct {
   DHelper decode;
   EHelper execute;
   int width;
+  const char *name;
 } opcode_entry;
 
-#define IDEXW(id, ex, w)   {concat(decode_, id), concat(exec_, ex), w}
+#define IDEXW(id, ex, w)   {concat(decode_, id), concat(exec_, ex), w, str(ex)}
 #define IDEX(id, ex)       IDEXW(id, ex, 0)
-#define EXW(ex, w)         {NULL, concat(exec_, ex), w}
+#define EXW(ex, w)         {NULL, concat(exec_, ex), w, str(ex)}
 #define EX(ex)             EXW(ex, 0)
 #define EMPTY              EX(inv)
 
@@ -20,12 +23,31 @@ static inline void set_width(int width) {
   decoding.src.width = decoding.dest.width = decoding.src2.width = width;
 }
 
-/* Instruction Decode and EXecute */
-static inline void idex(vaddr_t *eip, opcode_entry *e) {
+/* The group tables, whose entries are counted after the 512 entries of
+ * `opcode_table' by the instruction mix statistics. */
+enum { OPSTAT_gp1, OPSTAT_gp2, OPSTAT_gp3, OPSTAT_gp4, OPSTAT_gp5, OPSTAT_gp7, OPSTAT_NR_GROUP };
+#define opstat_group_slot(name, ext) (512 + concat(OPSTAT_, name) * 8 + (ext))
+
+bool opstat_enabled = false;
+__thread int opstat_modrm = OPSTAT_MODRM_NONE;
+/* The counter slot of the entry which executes the instruction. A prefix
+ * or an escape calls idex() again, so the last one set is the leaf. */
+static __thread int opstat_slot;
+static __thread bool opstat_prefix;
+
+/* Instruction Decode and EXecute, `loc' locates the entry for the coverage
+ * and `slot' for the instruction mix statistics */
+static inline void idex(vaddr_t *eip, opcode_entry *e, uint32_t loc, int slot) {
   /* eip is pointing to the byte next to opcode */
+  if (opstat_enabled) {
+    opstat_slot = slot;
+    opstat_prefix = decoding.is_operand_size_16;
+  }
+  cov_hit(loc);
   if (e->decode)
     e->decode(eip);
   e->execute(eip);
+  cov_hit(cov_exec_loc(loc, decoding.is_jmp));
 }
 
 static make_EHelper(2byte_esc);
@@ -36,7 +58,9 @@ static make_EHelper(2byte_esc);
     /* 0x04 */	item4, item5, item6, item7  \
   }; \
 static make_EHelper(name) { \
-  idex(eip, &concat(opcode_table_, name)[decoding.ext_opcode]); \
+  idex(eip, &concat(opcode_table_, name)[decoding.ext_opcode], \
+      cov_group_loc(decoding.opcode, decoding.ext_opcode), \
+      opstat_group_slot(name, decoding.ext_opcode)); \
 }
 
 /* 0x80, 0x81, 0x83 */
@@ -66,7 +90,7 @@ make_group(gp5,
 
   /* 0x0f 0x01*/
 make_group(gp7,
-    EMPTY, EMPTY, EMPTY, EMPTY,
+    EMPTY, EMPTY, EMPTY, EX(lidt),
     EMPTY, EMPTY, EMPTY, EMPTY)
 
 /* TODO: Add more instructions!!! */
@@ -105,11 +129,11 @@ opcode_entry opcode_table [512] = {
   /* 0x78 */	EMPTY, EMPTY, EMPTY, EMPTY,
   /* 0x7c */	EMPTY, EMPTY, EMPTY, EMPTY,
   /* 0x80 */	IDEXW(I2E, gp1, 1), IDEX(I2E, gp1), EMPTY, IDEX(SI2E, gp1),
-  /* 0x84 */	EMPTY, EMPTY, EMPTY, EMPTY,
+  /* 0x84 */	EMPTY, EMPTY, IDEXW(G2E, xchg, 1), IDEX(G2E, xchg),
   /* 0x88 */	IDEXW(mov_G2E, mov, 1), IDEX(mov_G2E, mov), IDEXW(mov_E2G, mov, 1), IDEX(mov_E2G, mov),
   /* 0x8c */	EMPTY, EMPTY, EMPTY, EMPTY,
-  /* 0x90 */	EMPTY, EMPTY, EMPTY, EMPTY,
-  /* 0x94 */	EMPTY, EMPTY, EMPTY, EMPTY,
+  /* 0x90 */	EMPTY, IDEX(a2r, xchg), IDEX(a2r, xchg), IDEX(a2r, xchg),
+  /* 0x94 */	IDEX(a2r, xchg), IDEX(a2r, xchg), IDEX(a2r, xchg), IDEX(a2r, xchg),
   /* 0x98 */	EMPTY, EMPTY, EMPTY, EMPTY,
   /* 0x9c */	EMPTY, EMPTY, EMPTY, EMPTY,
   /* 0xa0 */	IDEXW(O2a, mov, 1), IDEX(O2a, mov), IDEXW(a2O, mov, 1), IDEX(a2O, mov),
@@ -123,16 +147,16 @@ opcode_entry opcode_table [512] = {
   /* 0xc0 */	IDEXW(gp2_Ib2E, gp2, 1), IDEX(gp2_Ib2E, gp2), EMPTY, EX(ret),
   /* 0xc4 */	EMPTY, EMPTY, IDEXW(mov_I2E, mov, 1), IDEX(mov_I2E, mov),
   /* 0xc8 */	EMPTY, EMPTY, EMPTY, EMPTY,
-  /* 0xcc */	EMPTY, EMPTY, EMPTY, EMPTY,
+  /* 0xcc */	EMPTY, IDEXW(I, int, 1), EMPTY, EX(iret),
   /* 0xd0 */	IDEXW(gp2_1_E, gp2, 1), IDEX(gp2_1_E, gp2), IDEXW(gp2_cl2E, gp2, 1), IDEX(gp2_cl2E, gp2),
   /* 0xd4 */	EMPTY, EMPTY, EX(nemu_trap), EMPTY,
   /* 0xd8 */	EMPTY, EMPTY, EMPTY, EMPTY,
   /* 0xdc */	EMPTY, EMPTY, EMPTY, EMPTY,
   /* 0xe0 */	EMPTY, EMPTY, EMPTY, EMPTY,
-  /* 0xe4 */	EMPTY, EMPTY, EMPTY, EMPTY,
+  /* 0xe4 */	IDEXW(in_I2a, in, 1), IDEX(in_I2a, in), IDEXW(out_a2I, out, 1), IDEX(out_a2I, out),
   /* 0xe8 */	IDEXW(call_I,call,4), EMPTY, EMPTY, EMPTY,
-  /* 0xec */	EMPTY, EMPTY, EMPTY, EMPTY,
-  /* 0xf0 */	EMPTY, EMPTY, EMPTY, EMPTY,
+  /* 0xec */	IDEXW(in_dx2a, in, 1), IDEX(in_dx2a, in), IDEXW(out_a2dx, out, 1), IDEX(out_a2dx, out),
+  /* 0xf0 */	EX(lock), EMPTY, EMPTY, EMPTY,
   /* 0xf4 */	EMPTY, EMPTY, IDEXW(E, gp3, 1), IDEX(E, gp3),
   /* 0xf8 */	EMPTY, EMPTY, EMPTY, EMPTY,
   /* 0xfc */	EMPTY, EMPTY, IDEXW(E, gp4, 1), IDEX(E, gp5),
@@ -209,14 +233,14 @@ static make_EHelper(2byte_esc) {
   uint32_t opcode = instr_fetch(eip, 1) | 0x100;
   decoding.opcode = opcode;
   set_width(opcode_table[opcode].width);
-  idex(eip, &opcode_table[opcode]);
+  idex(eip, &opcode_table[opcode], opcode, opcode);
 }
 
 make_EHelper(real) {
   uint32_t opcode = instr_fetch(eip, 1);
   decoding.opcode = opcode;
   set_width(opcode_table[opcode].width);
-  idex(eip, &opcode_table[opcode]);
+  idex(eip, &opcode_table[opcode], opcode, opcode);
 }
 
 static inline void update_eip(void) {
@@ -230,8 +254,14 @@ void exec_wrapper(bool print_flag) {
 #endif
 
   decoding.seq_eip = cpu.eip;
+  opstat_modrm = OPSTAT_MODRM_NONE;
   exec_real(&decoding.seq_eip);
 
+  if (opstat_enabled) {
+    void opstat_count(int slot, int len, bool prefix);
+    opstat_count(opstat_slot, decoding.seq_eip - cpu.eip, opstat_prefix);
+  }
+
 #ifdef DEBUG
   int instr_len = decoding.seq_eip - cpu.eip;
   sprintf(decoding.p, "%*.s", 50 - (12 + 3 * instr_len), "");
@@ -253,3 +283,134 @@ void exec_wrapper(bool print_flag) {
   difftest_step(eip);
 #endif
 }
+
+/* Instruction mix statistics
+ *
+ * Each instruction bumps a single counter, the one of its leaf entry and its
+ * form: the length, the operand-size prefix and the ModR/M operand. The
+ * totals are derived from these counters when reported. */
+
+#define OPSTAT_MAX_LEN 15
+#define OPSTAT_NR_FORM (OPSTAT_MAX_LEN * 2 * 3)
+#define OPSTAT_NR_ENTRY (512 + 8 * OPSTAT_NR_GROUP)
+
+static const struct {
+  const char *name;
+  opcode_entry *table;
+} opstat_groups[OPSTAT_NR_GROUP] = {
+  [OPSTAT_gp1] = {"gp1", opcode_table_gp1}, [OPSTAT_gp2] = {"gp2", opcode_table_gp2},
+  [OPSTAT_gp3] = {"gp3", opcode_table_gp3}, [OPSTAT_gp4] = {"gp4", opcode_table_gp4},
+  [OPSTAT_gp5] = {"gp5", opcode_table_gp5}, [OPSTAT_gp7] = {"gp7", opcode_table_gp7},
+};
+
+static uint64_t opstat_counter[OPSTAT_NR_ENTRY][OPSTAT_NR_FORM];
+
+static inline int opstat_form(int len, bool prefix, int modrm) {
+  return ((len - 1) * 2 + prefix) * 3 + modrm;
+}
+
+void opstat_count(int slot, int len, bool prefix) {
+  if (len > OPSTAT_MAX_LEN) { len = OPSTAT_MAX_LEN; }
+  opstat_counter[slot][opstat_form(len, prefix, opstat_modrm)] ++;
+}
+
+void opstat_summary(OpstatSummary *sum) {
+  memset(sum, 0, sizeof(*sum));
+  int i, len, prefix, modrm;
+  for (i = 0; i < OPSTAT_NR_ENTRY; i ++) {
+    for (len = 1; len <= OPSTAT_MAX_LEN; len ++) {
+      for (prefix = 0; prefix < 2; prefix ++) {
+        for (modrm = 0; modrm < 3; modrm ++) {
+          uint64_t n = opstat_counter[i][opstat_form(len, prefix, modrm)];
+          sum->instr += n;
+          sum->byte += n * len;
+          if (prefix) { sum->prefix += n; }
+          if (modrm == OPSTAT_MODRM_MEM) { sum->modrm_mem += n; }
+          if (modrm == OPSTAT_MODRM_REG) { sum->modrm_reg += n; }
+        }
+      }
+    }
+  }
+}
+
+typedef struct {
+  char opcode[16];
+  opcode_entry *e;
+  uint64_t count;
+} OpstatItem;
+
+static int opstat_cmp(const void *a, const void *b) {
+  uint64_t x = ((const OpstatItem *)a)->count, y = ((const OpstatItem *)b)->count;
+  return (x < y) - (x > y);
+}
+
+/* Collect the executed entries, including the ones in the group tables,
+ * sorted by count. Return the number of items. */
+static int opstat_collect(OpstatItem *items) {
+  int n = 0, i, j;
+  for (i = 0; i < OPSTAT_NR_ENTRY; i ++) {
+    uint64_t count = 0;
+    for (j = 0; j < OPSTAT_NR_FORM; j ++) { count += opstat_counter[i][j]; }
+    if (count == 0) continue;
+
+    if (i < 512) {
+      snprintf(items[n].opcode, sizeof(items[n].opcode), (i < 0x100 ? "%02x" : "0f %02x"), i & 0xff);
+      items[n].e = &opcode_table[i];
+    }
+    else {
+      int g = (i - 512) / 8;
+      snprintf(items[n].opcode, sizeof(items[n].opcode), "%s/%d", opstat_groups[g].name, (i - 512) % 8);
+      items[n].e = &opstat_groups[g].table[(i - 512) % 8];
+    }
+    items[n ++].count = count;
+  }
+  qsort(items, n, sizeof(OpstatItem), opstat_cmp);
+  return n;
+}
+
+void opstat_report(FILE *fp, bool json) {
+  static OpstatItem items[OPSTAT_NR_ENTRY];
+  int n = opstat_collect(items);
+  OpstatSummary sum;
+  opstat_summary(&sum);
+  uint64_t nr_instr = (sum.instr == 0 ? 1 : sum.instr);
+  uint64_t nr_modrm = sum.modrm_mem + sum.modrm_reg;
+  int i;
+
+  if (json) {
+    fprintf(fp, "{\n  \"instructions\": %" PRIu64 ",\n  \"bytes\": %" PRIu64 ",\n"
+        "  \"operand_size_prefix\": %" PRIu64 ",\n"
+        "  \"modrm_mem\": %" PRIu64 ",\n  \"modrm_reg\": %" PRIu64 ",\n  \"opcodes\": [",
+        sum.instr, sum.byte, sum.prefix, sum.modrm_mem, sum.modrm_reg);
+    for (i = 0; i < n; i ++) {
+      fprintf(fp, "%s\n    {\"opcode\": \"%s\", \"name\": \"%s\", \"count\": %" PRIu64 "}",
+          (i == 0 ? "" : ","), items[i].opcode, items[i].e->name, items[i].count);
+    }
+    fprintf(fp, "\n  ]\n}\n");
+    return;
+  }
+
+  fprintf(fp, "instructions: %" PRIu64 ", average length: %.2f bytes\n",
+      sum.instr, (double)sum.byte / nr_instr);
+  fprintf(fp, "operand-size prefix: %" PRIu64 " (%.2f%%)\n", sum.prefix, 100.0 * sum.prefix / nr_instr);
+  fprintf(fp, "ModR/M operands: %" PRIu64 " memory, %" PRIu64 " register (%.2f%% memory)\n",
+      sum.modrm_mem, sum.modrm_reg, (nr_modrm == 0 ? 0 : 100.0 * sum.modrm_mem / nr_modrm));
+  fprintf(fp, "%-8s %-16s %16s %8s\n", "Opcode", "Name", "Count", "%");
+  for (i = 0; i < n; i ++) {
+    fprintf(fp, "%-8s %-16s %16" PRIu64 " %7.2f%%\n", items[i].opcode, items[i].e->name,
+        items[i].count, 100.0 * items[i].count / nr_instr);
+  }
+}
+
+/* Call `f' on each executed entry, the most executed first. */
+void opstat_foreach(void (*f)(const char *opcode, const char *name, uint64_t count)) {
+  static OpstatItem items[OPSTAT_NR_ENTRY];
+  int n = opstat_collect(items), i;
+  for (i = 0; i < n; i ++) {
+    f(items[i].opcode, items[i].e->name, items[i].count);
+  }
+}
+
+void opstat_reset() {
+  memset(opstat_counter, 0, sizeof(opstat_counter));
+}
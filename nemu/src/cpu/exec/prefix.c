@@ -7,3 +7,22 @@ make_EHelper(operand_size) {
   exec_real(eip);
   decoding.is_operand_size_16 = false;
 }
+
+make_EHelper(lock) {
+  /* The read-modify-write is done by compare-and-swap, and is executed again
+   * if another processor has changed the memory meanwhile, see memory.c. */
+  CPU_state saved = cpu;
+  vaddr_t start = *eip;
+#ifdef DEBUG
+  char *p = decoding.p;
+#endif
+  do {
+    cpu = saved;
+    *eip = start;
+#ifdef DEBUG
+    decoding.p = p;
+#endif
+    mem_lock_begin();
+    exec_real(eip);
+  } while (!mem_lock_end());
+}
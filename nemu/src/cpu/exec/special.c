@@ -1,5 +1,6 @@
 #include "cpu/exec.h"
 #include "monitor/monitor.h"
+#include "fuzz.h"
 
 make_EHelper(nop) {
   print_asm("nop");
@@ -8,6 +9,14 @@ make_EHelper(nop) {
 make_EHelper(inv) {
   /* invalid opcode */
 
+  if (nemu_ctx->fuzz != NULL) {
+    /* The fuzzing harness asks the reference about it. */
+    fuzz_invalid();
+    nemu_ctx->halt_ret = -1;
+    nemu_state = NEMU_END;
+    return;
+  }
+
   uint32_t temp[2];
   vaddr_t ori_eip = cpu.eip;
   *eip = ori_eip;
@@ -27,6 +36,7 @@ make_EHelper(inv) {
       "* The machine is always right!\n"
       "* Every line of untested code is always wrong!\33[0m\n\n", logo);
 
+  nemu_ctx->halt_ret = -1;
   nemu_state = NEMU_END;
 
   print_asm("invalid opcode");
@@ -35,8 +45,17 @@ make_EHelper(inv) {
 make_EHelper(nemu_trap) {
   print_asm("nemu trap (eax = %d)", cpu.eax);
 
-  printf("\33[1;31mnemu: HIT %s TRAP\33[0m at eip = 0x%08x\n\n",
-      (cpu.eax == 0 ? "GOOD" : "BAD"), cpu.eip);
+#ifdef HAS_IOE
+  /* make sure all the output of the guest is shown before the trap message */
+  extern void serial_flush();
+  serial_flush();
+#endif
+
+  if (nemu_ctx->fuzz == NULL) {
+    printf("\33[1;31mnemu: HIT %s TRAP\33[0m at eip = 0x%08x\n\n",
+        (cpu.eax == 0 ? "GOOD" : "BAD"), cpu.eip);
+  }
+  nemu_ctx->halt_ret = cpu.eax;
   nemu_state = NEMU_END;
 
 #ifdef DIFF_TEST
@@ -1,10 +1,15 @@
 #include "cpu/exec.h"
+#include "cpu/intr.h"
 
 void diff_test_skip_qemu();
 void diff_test_skip_nemu();
 
 make_EHelper(lidt) {
-  TODO();
+  rtl_lm(&t0, &id_dest->addr, 2);
+  rtl_addi(&t1, &id_dest->addr, 2);
+  rtl_lm(&t1, &t1, 4);
+  if (decoding.is_operand_size_16) { t1 &= 0xffffff; }
+  load_idt(t1, t0);
 
   print_asm_template1(lidt);
 }
@@ -26,7 +31,7 @@ make_EHelper(mov_cr2r) {
 }
 
 make_EHelper(int) {
-  TODO();
+  raise_intr(id_dest->val, *eip);
 
   print_asm("int %s", id_dest->str);
 
@@ -36,7 +41,12 @@ make_EHelper(int) {
 }
 
 make_EHelper(iret) {
-  TODO();
+  rtl_pop(&decoding.jmp_eip);
+  rtl_pop(&t0);
+  cpu.cs = t0;
+  rtl_pop(&t0);
+  cpu.eflags.val = t0;
+  decoding.is_jmp = 1;
 
   print_asm("iret");
 }
@@ -45,7 +55,8 @@ uint32_t pio_read(ioaddr_t, int);
 void pio_write(ioaddr_t, int, uint32_t);
 
 make_EHelper(in) {
-  TODO();
+  t0 = pio_read(id_src->val, id_dest->width);
+  operand_write(id_dest, &t0);
 
   print_asm_template2(in);
 
@@ -55,7 +66,7 @@ make_EHelper(in) {
 }
 
 make_EHelper(out) {
-  TODO();
+  pio_write(id_dest->val, id_src->width, id_src->val);
 
   print_asm_template2(out);
 
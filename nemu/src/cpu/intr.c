@@ -1,13 +1,97 @@
 #include "cpu/exec.h"
+#include "cpu/intr.h"
 #include "memory/mmu.h"
+#include "fuzz.h"
+
+#define NR_GATE 256
+
+uint8_t idt_page_map[(PMEM_SIZE >> IDT_PAGE_SHIFT) / 8];
+uint64_t idt_gen = 1;
+
+void load_idt(vaddr_t base, uint16_t limit) {
+  cpu.idtr.base = base;
+  cpu.idtr.limit = limit;
+
+  uint32_t page = base >> IDT_PAGE_SHIFT;
+  uint32_t last = (base + limit) >> IDT_PAGE_SHIFT;
+  for (; page <= last && page < (PMEM_SIZE >> IDT_PAGE_SHIFT); page ++) {
+    __atomic_or_fetch(&idt_page_map[page >> 3], 1 << (page & 7), __ATOMIC_RELAXED);
+  }
+  nemu_ctx->idt_gen = 0;
+}
+
+static void decode_idt() {
+  /* A store from now on is seen by the next interrupt. */
+  uint64_t gen = __atomic_load_n(&idt_gen, __ATOMIC_ACQUIRE);
+  int nr_gate = (cpu.idtr.limit + 1) / sizeof(GateDesc);
+  int i;
+  for (i = 0; i < NR_GATE; i ++) {
+    vaddr_t addr = cpu.idtr.base + i * sizeof(GateDesc);
+    if (i >= nr_gate || addr + sizeof(GateDesc) > PMEM_SIZE) {
+      nemu_ctx->idt[i].present = false;
+      continue;
+    }
+
+    GateDesc gate;
+    memcpy(&gate, guest_to_host(addr), sizeof(gate));
+    nemu_ctx->idt[i].target = (gate.offset_31_16 << 16) | gate.offset_15_0;
+    /* the selector and the type of the gate */
+    nemu_ctx->idt[i].cs = gate.dont_care0;
+    nemu_ctx->idt[i].trap = (gate.dont_care1 >> 8) & 1;
+    nemu_ctx->idt[i].present = gate.present;
+  }
+  nemu_ctx->idt_gen = gen;
+}
 
 void raise_intr(uint8_t NO, vaddr_t ret_addr) {
-  /* TODO: Trigger an interrupt/exception with ``NO''.
-   * That is, use ``NO'' to index the IDT.
-   */
+  if (nemu_ctx->idt_gen != __atomic_load_n(&idt_gen, __ATOMIC_ACQUIRE)) {
+    decode_idt();
+  }
+  if (!nemu_ctx->idt[NO].present) {
+    if (nemu_ctx->fuzz != NULL) {
+      fuzz_fault();
+      return;
+    }
+    panic("no gate for interrupt %d in the IDT at 0x%08x", NO, cpu.idtr.base);
+  }
+
+  /* the frame is pushed in one write, eflags at the top */
+  uint32_t frame[3] = { ret_addr, cpu.cs, cpu.eflags.val };
+  cpu.esp -= sizeof(frame);
+  vaddr_write_block(cpu.esp, frame, 3);
+
+  if (!nemu_ctx->idt[NO].trap) { cpu.eflags.IF = 0; }
+  cpu.cs = nemu_ctx->idt[NO].cs;
+  decoding.jmp_eip = nemu_ctx->idt[NO].target;
+  decoding.is_jmp = 1;
+}
+
+/* Take the interrupt of `line' between two instructions. */
+void deliver_intr(int line) {
+  static const uint8_t vector[NR_INTR] = { IRQ_TIMER, IRQ_IPI };
+
+  raise_intr(vector[line], cpu.eip);
+  cpu.eip = decoding.jmp_eip;
+  decoding.is_jmp = 0;
+
+#ifdef DIFF_TEST
+  /* The reference does not take interrupts. */
+  void difftest_sync_intr(vaddr_t, int);
+  difftest_sync_intr(cpu.esp, 12);
+#endif
+}
 
-  TODO();
+void take_intr() {
+  /* the line with the lowest number goes first */
+  uint32_t pending = __atomic_load_n(&nemu_ctx->intr_pending, __ATOMIC_ACQUIRE);
+  int line = __builtin_ctz(pending);
+  __atomic_and_fetch(&nemu_ctx->intr_pending, ~(1u << line), __ATOMIC_ACQ_REL);
+  ckpt_log_intr(line);
+  deliver_intr(line);
 }
 
 void dev_raise_intr() {
+  /* The timer ticks on every processor. */
+  void mpe_post_intr_all(int);
+  mpe_post_intr_all(INTR_TIMER);
 }
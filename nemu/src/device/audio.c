@@ -0,0 +1,196 @@
+#include "common.h"
+#include "device/port-io.h"
+#include "device/mmio.h"
+#include "monitor/reverse.h"
+#include <SDL2/SDL.h>
+
+/* An audio device playing signed 16-bit samples. The guest sets up the
+ * format with the control registers, copies a batch of samples into the
+ * stream buffer and writes its length to COMMIT. The device then moves the
+ * batch into a ring buffer, which is drained by the SDL audio callback
+ * thread, or written to a WAV file in dump mode.
+ */
+
+#define AUDIO_PORT 0x200
+#define FREQ_OFFSET 0       /* w: sample rate */
+#define CHANNELS_OFFSET 4   /* w: number of channels */
+#define SAMPLES_OFFSET 8    /* w: samples per SDL callback */
+#define INIT_OFFSET 12      /* w: open the device with the format above */
+#define SBUF_SIZE_OFFSET 16 /* r: size of the stream buffer in bytes */
+#define COUNT_OFFSET 20     /* r: bytes queued but not played yet */
+#define COMMIT_OFFSET 24    /* w: queue this many bytes from the stream buffer */
+#define NR_AUDIO_PORT 28
+
+#define AUDIO_SBUF_ADDR 0xc0000
+#define AUDIO_SBUF_SIZE 0x10000
+
+/* The ring is not larger than the stream buffer, so a guest never waits
+ * for more than one buffer of samples to play. */
+#define RING_SIZE AUDIO_SBUF_SIZE
+
+static uint32_t *audio_port_base;
+static uint8_t *sbuf;
+
+/* Single producer (the CPU thread in audio_commit()), single consumer
+ * (the SDL callback thread). Each index is written by one side only and
+ * is free running, so the fill level is always tail - head. */
+static uint8_t ring[RING_SIZE];
+static uint32_t ring_head;
+static uint32_t ring_tail;
+
+static bool audio_opened = false;
+static FILE *dump_fp = NULL;
+static uint32_t dump_size = 0;
+
+static inline uint32_t ring_count() {
+  return __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE) -
+    __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+}
+
+static uint32_t ring_push(const uint8_t *buf, uint32_t len) {
+  uint32_t tail = ring_tail;
+  uint32_t head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+  uint32_t free = RING_SIZE - (tail - head);
+  if (len > free) { len = free; }
+
+  uint32_t idx = tail % RING_SIZE;
+  uint32_t n = (len < RING_SIZE - idx ? len : RING_SIZE - idx);
+  memcpy(ring + idx, buf, n);
+  memcpy(ring, buf + n, len - n);
+
+  __atomic_store_n(&ring_tail, tail + len, __ATOMIC_RELEASE);
+  return len;
+}
+
+static uint32_t ring_pop(uint8_t *buf, uint32_t len) {
+  uint32_t head = ring_head;
+  uint32_t tail = __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE);
+  if (len > tail - head) { len = tail - head; }
+
+  uint32_t idx = head % RING_SIZE;
+  uint32_t n = (len < RING_SIZE - idx ? len : RING_SIZE - idx);
+  memcpy(buf, ring + idx, n);
+  memcpy(buf + n, ring, len - n);
+
+  __atomic_store_n(&ring_head, head + len, __ATOMIC_RELEASE);
+  return len;
+}
+
+static void audio_play(void *userdata, uint8_t *stream, int len) {
+  uint32_t n = ring_pop(stream, len);
+  if (n < len) {
+    /* underrun, play silence */
+    memset(stream + n, 0, len - n);
+  }
+}
+
+/* WAV dump */
+
+static void dump_header(uint32_t freq, uint32_t channels, uint32_t data_size) {
+  struct {
+    char riff[4]; uint32_t riff_size; char wave[4];
+    char fmt[4]; uint32_t fmt_size; uint16_t format, channels;
+    uint32_t freq, byte_rate; uint16_t block_align, bits;
+    char data[4]; uint32_t data_size;
+  } __attribute__((packed)) h = {
+    .riff = "RIFF", .riff_size = 36 + data_size, .wave = "WAVE",
+    .fmt = "fmt ", .fmt_size = 16, .format = 1 /* PCM */, .channels = channels,
+    .freq = freq, .byte_rate = freq * channels * 2, .block_align = channels * 2, .bits = 16,
+    .data = "data", .data_size = data_size,
+  };
+  fseek(dump_fp, 0, SEEK_SET);
+  fwrite(&h, sizeof(h), 1, dump_fp);
+}
+
+static void dump_finish() {
+  if (audio_opened) {
+    dump_header(audio_port_base[FREQ_OFFSET / 4], audio_port_base[CHANNELS_OFFSET / 4], dump_size);
+  }
+  fclose(dump_fp);
+}
+
+static void dump_drain() {
+  uint8_t buf[4096];
+  uint32_t n;
+  while ((n = ring_pop(buf, sizeof(buf))) > 0) {
+    fwrite(buf, n, 1, dump_fp);
+    dump_size += n;
+  }
+}
+
+static void audio_open() {
+  uint32_t freq = audio_port_base[FREQ_OFFSET / 4];
+  uint32_t channels = audio_port_base[CHANNELS_OFFSET / 4];
+  uint32_t samples = audio_port_base[SAMPLES_OFFSET / 4];
+  Assert(!audio_opened, "the audio device can only be initialized once");
+  Assert(freq != 0 && channels != 0, "invalid audio format: %d Hz, %d channels", freq, channels);
+
+  ring_head = ring_tail = 0;
+
+  if (dump_fp != NULL) {
+    dump_header(freq, channels, 0);
+    audio_opened = true;
+    return;
+  }
+
+  SDL_AudioSpec s = {};
+  s.freq = freq;
+  s.format = AUDIO_S16SYS;
+  s.channels = channels;
+  s.samples = samples;
+  s.callback = audio_play;
+  s.userdata = NULL;
+
+  int ret = SDL_InitSubSystem(SDL_INIT_AUDIO);
+  if (ret == 0) { ret = SDL_OpenAudio(&s, NULL); }
+  if (ret != 0) {
+    /* Nothing would drain the ring, so the samples are dropped and COUNT
+     * stays 0, as on a host without audio. */
+    Log("Can not open audio, the samples are dropped: %s", SDL_GetError());
+    return;
+  }
+  SDL_PauseAudio(0);
+  audio_opened = true;
+}
+
+static void audio_commit() {
+  uint32_t len = audio_port_base[COMMIT_OFFSET / 4];
+  Assert(len <= AUDIO_SBUF_SIZE, "audio commit of %d bytes exceeds the stream buffer", len);
+  if (!audio_opened) { return; }
+
+  uint32_t n = ring_push(sbuf, len);
+  if (dump_fp != NULL) { dump_drain(); }
+  if (n < len) {
+    Log("audio ring buffer overflow, %d bytes dropped", len - n);
+  }
+}
+
+void audio_io_handler(ioaddr_t addr, int len, bool is_write) {
+  /* The samples have been played when the guest is replayed. */
+  if (is_write && ckpt_replaying()) { return; }
+  if (is_write) {
+    switch (addr - AUDIO_PORT) {
+      case INIT_OFFSET: audio_open(); break;
+      case COMMIT_OFFSET: audio_commit(); break;
+    }
+  }
+  else if (addr - AUDIO_PORT == COUNT_OFFSET) {
+    audio_port_base[COUNT_OFFSET / 4] = ring_count();
+  }
+}
+
+void audio_sbuf_handler(paddr_t addr, int len, bool is_write) {
+}
+
+/* Write the samples to `file' instead of playing them. Call it before the guest starts. */
+void init_audio_dump(const char *file) {
+  dump_fp = fopen(file, "wb");
+  Assert(dump_fp, "Can not open '%s'", file);
+  atexit(dump_finish);
+}
+
+void init_audio() {
+  audio_port_base = add_pio_map(AUDIO_PORT, NR_AUDIO_PORT, audio_io_handler);
+  audio_port_base[SBUF_SIZE_OFFSET / 4] = AUDIO_SBUF_SIZE;
+  sbuf = add_mmio_map(AUDIO_SBUF_ADDR, AUDIO_SBUF_SIZE, audio_sbuf_handler);
+}
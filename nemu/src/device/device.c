@@ -18,10 +18,14 @@ void init_serial();
 void init_timer();
 void init_vga();
 void init_i8042();
+void init_audio();
+void init_perf();
 
 extern void timer_intr();
 extern void send_key(uint8_t, bool);
 extern void update_screen();
+extern void vga_open();
+extern bool vga_is_open();
 
 
 static void timer_sig_handler(int signum) {
@@ -43,6 +47,12 @@ void device_update() {
   }
   device_update_flag = false;
 
+  /* There is no window to update or take events from yet, see vga.c. */
+  vga_open();
+  if (!vga_is_open()) {
+    return;
+  }
+
   if (update_screen_flag) {
     update_screen();
     update_screen_flag = false;
@@ -69,6 +79,10 @@ void device_update() {
 }
 
 void sdl_clear_event_queue() {
+  if (!vga_is_open()) {
+    return;
+  }
+
   SDL_Event event;
   while (SDL_PollEvent(&event));
 }
@@ -78,6 +92,8 @@ void init_device() {
   init_timer();
   init_vga();
   init_i8042();
+  init_audio();
+  init_perf();
 
   struct sigaction s;
   memset(&s, 0, sizeof(s));
@@ -0,0 +1,135 @@
+#include "nemu.h"
+#include "device/port-io.h"
+#include "monitor/reverse.h"
+#include "monitor/memwatch.h"
+#include "cpu/intr.h"
+#include <fcntl.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* A paravirtual disk backed by a host file. The guest puts requests into
+ * a descriptor ring in its memory and writes the producer index to
+ * RING_TAIL. The device then transfers the data of all pending requests
+ * between the file and guest memory directly, and advances RING_HEAD.
+ */
+
+#define DISK_PORT 0x300
+#define NR_SECTOR_OFFSET 0  /* r: capacity in sectors */
+#define RING_BASE_OFFSET 4  /* w: guest physical address of the ring */
+#define RING_SIZE_OFFSET 8  /* w: number of descriptors, a power of 2 */
+#define RING_TAIL_OFFSET 12 /* w: producer index, writing it starts DMA */
+#define RING_HEAD_OFFSET 16 /* r: consumer index */
+#define NR_DISK_PORT 20
+
+#define SECTOR_SIZE 512
+
+enum { DISK_CMD_READ, DISK_CMD_WRITE };
+enum { DISK_STATUS_OK, DISK_STATUS_ERR };
+
+typedef struct {
+  uint32_t sector;
+  uint32_t nr_sector;
+  paddr_t buf;
+  uint16_t cmd;
+  uint16_t status;   /* written back by the device */
+} DiskDesc;
+
+static uint32_t *disk_port_base;
+static uint8_t *disk_image;
+static uint32_t disk_nr_sector;
+static uint32_t ring_head;
+
+#ifdef DIFF_TEST
+void difftest_memcpy_to_ref(uint32_t, void *, int);
+#endif
+
+/* Write guest memory as a store of the guest does, for the checkpoints,
+ * the IDT, the watchpoints and the diff-test reference. */
+static void dma_to_guest(paddr_t addr, const void *src, uint32_t len) {
+  ckpt_note_write(addr, len);
+  idt_note_write(addr, len);
+  mw_check_dma(addr, len);
+  memcpy(guest_to_host(addr), src, len);
+#ifdef DIFF_TEST
+  difftest_memcpy_to_ref(addr, guest_to_host(addr), len);
+#endif
+}
+
+static uint16_t disk_do_request(DiskDesc *d) {
+  if (d->sector > disk_nr_sector || d->nr_sector > disk_nr_sector - d->sector) {
+    return DISK_STATUS_ERR;
+  }
+
+  uint32_t len = d->nr_sector * SECTOR_SIZE;
+  if (d->buf > PMEM_SIZE || len > PMEM_SIZE - d->buf) {
+    return DISK_STATUS_ERR;
+  }
+
+  uint8_t *p = disk_image + (size_t)d->sector * SECTOR_SIZE;
+  switch (d->cmd) {
+    case DISK_CMD_READ: dma_to_guest(d->buf, p, len); break;
+    case DISK_CMD_WRITE:
+      /* going back restores the sectors as well */
+      ckpt_note_host_write(p, len);
+      memcpy(p, guest_to_host(d->buf), len);
+      break;
+    default: return DISK_STATUS_ERR;
+  }
+  return DISK_STATUS_OK;
+}
+
+static void disk_process_ring() {
+  paddr_t ring_base = disk_port_base[RING_BASE_OFFSET / 4];
+  uint32_t ring_size = disk_port_base[RING_SIZE_OFFSET / 4];
+  uint32_t ring_tail = disk_port_base[RING_TAIL_OFFSET / 4];
+
+  Assert(ring_size != 0 && (ring_size & (ring_size - 1)) == 0,
+      "disk ring size %d is not a power of 2", ring_size);
+  Assert(ring_base < PMEM_SIZE && ring_size * sizeof(DiskDesc) <= PMEM_SIZE - ring_base,
+      "disk ring [0x%08x, +%d) is out of physical memory", ring_base, ring_size);
+
+  DiskDesc *ring = guest_to_host(ring_base);
+  for (; ring_head != ring_tail; ring_head ++) {
+    uint32_t i = ring_head & (ring_size - 1);
+    uint16_t status = disk_do_request(&ring[i]);
+    dma_to_guest(ring_base + i * sizeof(DiskDesc) + offsetof(DiskDesc, status), &status, sizeof(status));
+  }
+  disk_port_base[RING_HEAD_OFFSET / 4] = ring_head;
+}
+
+void disk_io_handler(ioaddr_t addr, int len, bool is_write) {
+  if (is_write) {
+    switch (addr - DISK_PORT) {
+      case RING_SIZE_OFFSET: ring_head = disk_port_base[RING_HEAD_OFFSET / 4] = 0; break;
+      case RING_TAIL_OFFSET: disk_process_ring(); break;
+    }
+  }
+}
+
+void init_disk(const char *file) {
+  int fd = open(file, O_RDWR);
+  bool writable = (fd >= 0);
+  if (!writable) { fd = open(file, O_RDONLY); }
+  Assert(fd >= 0, "Can not open '%s'", file);
+
+  struct stat st;
+  int ret = fstat(fd, &st);
+  Assert(ret == 0, "Can not stat '%s'", file);
+  disk_nr_sector = st.st_size / SECTOR_SIZE;
+
+  if (disk_nr_sector != 0) {
+    /* A read-only image is mapped privately, so the guest still sees its own writes. */
+    disk_image = mmap(NULL, (size_t)disk_nr_sector * SECTOR_SIZE, PROT_READ | PROT_WRITE,
+        (writable ? MAP_SHARED : MAP_PRIVATE), fd, 0);
+    Assert(disk_image != MAP_FAILED, "Can not map '%s'", file);
+  }
+  close(fd);
+
+  Log("The disk is %s, %d sectors%s", file, disk_nr_sector, (writable ? "" : ", read-only"));
+
+  disk_port_base = add_pio_map(DISK_PORT, NR_DISK_PORT, disk_io_handler);
+  disk_port_base[NR_SECTOR_OFFSET / 4] = disk_nr_sector;
+  ckpt_add_state(&ring_head, sizeof(ring_head));
+}
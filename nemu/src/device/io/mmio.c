@@ -1,25 +1,16 @@
-#include "common.h"
+#include "nemu.h"
 #include "device/mmio.h"
 
-#define MMIO_SPACE_MAX (512 * 1024)
-#define NR_MAP 8
-
-static uint8_t mmio_space_pool[MMIO_SPACE_MAX];
-static uint32_t mmio_space_free_index = 0;
-
-typedef struct {
-  paddr_t low;
-  paddr_t high;
-  uint8_t *mmio_space;
-  mmio_callback_t callback;
-} MMIO_t;
-
-static MMIO_t maps[NR_MAP];
-static int nr_map = 0;
+/* the memory-mapped I/O space of the current guest */
+#define mmio_space_pool (nemu_ctx->mmio->space_pool)
+#define mmio_space_free_index (nemu_ctx->mmio->space_free_index)
+#define maps (nemu_ctx->mmio->maps)
+#define nr_map (nemu_ctx->mmio->nr_map)
+#define mmio_lock (nemu_ctx->mmio->lock)
 
 /* device interface */
 void* add_mmio_map(paddr_t addr, int len, mmio_callback_t callback) {
-  assert(nr_map < NR_MAP);
+  assert(nr_map < NR_MMIO_MAP);
   assert(mmio_space_free_index + len <= MMIO_SPACE_MAX);
 
   uint8_t *space_base = &mmio_space_pool[mmio_space_free_index];
@@ -46,9 +37,12 @@ int is_mmio(paddr_t addr) {
 uint32_t mmio_read(paddr_t addr, int len, int map_NO) {
   assert(len >= 1 && len <= 4);
   MMIO_t *map = &maps[map_NO];
+  bool locked = nemu_ctx->mmio->shared;
+  if (locked) { pthread_mutex_lock(&mmio_lock); }
   uint32_t data = *(uint32_t *)(map->mmio_space + (addr - map->low)) 
     & (~0u >> ((4 - len) << 3));
   map->callback(addr, len, false);
+  if (locked) { pthread_mutex_unlock(&mmio_lock); }
   return data;
 }
 
@@ -59,6 +53,8 @@ void mmio_write(paddr_t addr, int len, uint32_t data, int map_NO) {
   uint8_t *p = map->mmio_space + (addr - map->low);
   uint8_t *p_data = (uint8_t *)&data;
 
+  bool locked = nemu_ctx->mmio->shared;
+  if (locked) { pthread_mutex_lock(&mmio_lock); }
   switch (len) {
     case 4: p[3] = p_data[3];
     case 3: p[2] = p_data[2];
@@ -67,4 +63,5 @@ void mmio_write(paddr_t addr, int len, uint32_t data, int map_NO) {
   }
 
   maps[map_NO].callback(addr, len, true);
+  if (locked) { pthread_mutex_unlock(&mmio_lock); }
 }
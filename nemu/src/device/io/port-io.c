@@ -1,56 +1,110 @@
-#include "common.h"
+#include "nemu.h"
 #include "device/port-io.h"
+#include "monitor/reverse.h"
+#include <stdlib.h>
 
-#define PORT_IO_SPACE_MAX 65536
-#define NR_MAP 8
+/* the port-mapped I/O space of the current guest */
+#define pio_space (nemu_ctx->pio->space)
+#define maps (nemu_ctx->pio->maps)
+#define nr_map (nemu_ctx->pio->nr_map)
+#define port_map (nemu_ctx->pio->port_map)
+#define port_count (nemu_ctx->pio->port_count)
+#define pio_lock (nemu_ctx->pio->lock)
 
-/* "+ 3" is for hacking, see pio_read() below */
-static uint8_t pio_space[PORT_IO_SPACE_MAX + 3];
-
-typedef struct {
-  ioaddr_t low;
-  ioaddr_t high;
-  pio_callback_t callback;
-} PIO_t;
-
-static PIO_t maps[NR_MAP];
-static int nr_map = 0;
-
-static void pio_callback(ioaddr_t addr, int len, bool is_write) {
-  int i;
-  for (i = 0; i < nr_map; i ++) {
-    if (addr >= maps[i].low && addr + len - 1 <= maps[i].high) {
-      maps[i].callback(addr, len, is_write);
-      return;
+static inline void pio_callback(ioaddr_t addr, int len, bool is_write) {
+  int idx = port_map[addr];
+  port_count[addr] ++;
+  if (idx != 0) {
+    PIO_t *map = &maps[idx - 1];
+    if (addr + len - 1 <= map->high) {
+      map->callback(addr, len, is_write);
     }
   }
 }
 
 /* device interface */
 void* add_pio_map(ioaddr_t addr, int len, pio_callback_t callback) {
-  assert(nr_map < NR_MAP);
+  assert(nr_map < NR_PIO_MAP);
   assert(addr + len <= PORT_IO_SPACE_MAX);
   maps[nr_map].low = addr;
   maps[nr_map].high = addr + len - 1;
   maps[nr_map].callback = callback;
   nr_map ++;
+
+  int i;
+  for (i = addr; i < addr + len; i ++) {
+    Assert(port_map[i] == 0, "port 0x%x is already mapped", i);
+    port_map[i] = nr_map;
+  }
+  /* The device registers are saved by the checkpoints of reverse execution. */
+  ckpt_add_state(pio_space + addr, len);
   return pio_space + addr;
 }
 
 
 /* CPU interface */
 uint32_t pio_read(ioaddr_t addr, int len) {
-  assert(len == 1 || len == 2 || len == 4);
-  assert(addr + len - 1 < PORT_IO_SPACE_MAX);
+  /* The input from the devices is logged, and taken from the log
+   * when replaying for reverse execution. */
+  if (ckpt_replaying()) {
+    port_count[addr] ++;
+    return ckpt_replay_input();
+  }
+  /* `shared' may be set by this access, see start_ap() */
+  bool locked = nemu_ctx->pio->shared;
+  if (locked) { pthread_mutex_lock(&pio_lock); }
   pio_callback(addr, len, false);		// prepare data to read
   uint32_t data = *(uint32_t *)(pio_space + addr) & (~0u >> ((4 - len) << 3));
+  if (locked) { pthread_mutex_unlock(&pio_lock); }
+  ckpt_log_input(data);
   return data;
 }
 
 void pio_write(ioaddr_t addr, int len, uint32_t data) {
-  assert(len == 1 || len == 2 || len == 4);
-  assert(addr + len - 1 < PORT_IO_SPACE_MAX);
-  memcpy(pio_space + addr, &data, len);
+  bool locked = nemu_ctx->pio->shared;
+  if (locked) { pthread_mutex_lock(&pio_lock); }
+  switch (len) {
+    case 4: *(uint32_t *)(pio_space + addr) = data; break;
+    case 2: *(uint16_t *)(pio_space + addr) = data; break;
+    case 1: pio_space[addr] = data; break;
+    default: assert(0);
+  }
   pio_callback(addr, len, true);
+  if (locked) { pthread_mutex_unlock(&pio_lock); }
+}
+
+/* monitor interface */
+static int port_count_cmp(const void *a, const void *b) {
+  uint64_t ca = port_count[*(const int *)a];
+  uint64_t cb = port_count[*(const int *)b];
+  return (ca < cb) - (ca > cb);
 }
 
+void pio_show_stats() {
+  static int ports[PORT_IO_SPACE_MAX];
+  int nr_port = 0;
+  int i;
+  for (i = 0; i < PORT_IO_SPACE_MAX; i ++) {
+    if (port_count[i] != 0) { ports[nr_port ++] = i; }
+  }
+
+  if (nr_port == 0) {
+    printf("No port has been accessed.\n");
+    return;
+  }
+
+  qsort(ports, nr_port, sizeof(ports[0]), port_count_cmp);
+
+  printf("Port\tAccesses\tMap\n");
+  for (i = 0; i < nr_port; i ++) {
+    int port = ports[i];
+    printf("0x%04x\t%-12lu\t", port, (unsigned long)port_count[port]);
+    if (port_map[port] != 0) {
+      PIO_t *map = &maps[port_map[port] - 1];
+      printf("[0x%04x, 0x%04x]\n", map->low, map->high);
+    }
+    else {
+      printf("unmapped\n");
+    }
+  }
+}
@@ -48,6 +48,12 @@ void send_key(uint8_t scancode, bool is_keydown) {
 
 void i8042_io_handler(ioaddr_t addr, int len, bool is_write) {
   if (!is_write) {
+#ifdef HAS_IOE
+    /* The keys come from the window. */
+    extern void vga_request_open();
+    vga_request_open();
+#endif
+
     if (addr == I8042_DATA_PORT) {
       i8042_status_port_base[0] &= ~I8042_STATUS_HASKEY_MASK;
     }
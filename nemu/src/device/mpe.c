@@ -0,0 +1,142 @@
+#include "nemu.h"
+#include "device/port-io.h"
+#include "monitor/monitor.h"
+#include "cpu/intr.h"
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+/* Multi-processor extension. The processors of the guest share the memory
+ * and the devices, each has its own context (see include/context.h). The
+ * first one (the BSP) is run by the monitor, the others (the APs) each run on
+ * a host thread after the BSP starts them.
+ *
+ * The APs start at the address written to START, with %eax holding the number
+ * of the processor and the other registers cleared. An AP stops when it
+ * writes STOP, and the whole guest ends when any processor hits `nemu_trap'.
+ * The APs only run while the BSP is running, so they pause with the monitor.
+ */
+
+#define MPE_PORT 0x100 // Note that this is not the standard
+#define NR_CPU_OFFSET 0 /* r: number of processors */
+#define CPU_ID_OFFSET 4 /* r: number of the processor reading it */
+#define START_OFFSET 8  /* w: start the APs at this address */
+#define IPI_OFFSET 12   /* w: send an IPI to the processor with this number */
+#define STOP_OFFSET 16  /* w: stop the AP writing it */
+#define NR_MPE_PORT 20
+
+#define MAX_CPU 8
+/* the number of instructions an AP executes between two looks at the BSP */
+#define AP_SLICE 1024
+
+static uint32_t *mpe_port_base;
+
+static int nr_cpu = 1;
+/* `vcpu[0]' is the BSP, the processors are published by `nr_started' */
+static NEMUContext *vcpu[MAX_CPU];
+static int nr_started = 0;
+
+void exec_wrapper(bool);
+
+static void *ap_main(void *arg) {
+  nemu_switch_ctx(arg);
+  NEMUContext *bsp = vcpu[0];
+
+  while (nemu_state == NEMU_RUNNING) {
+    int bsp_state = __atomic_load_n(&bsp->state, __ATOMIC_ACQUIRE);
+    if (bsp_state == NEMU_END) { return NULL; }
+    if (bsp_state != NEMU_RUNNING) {
+      struct timespec t = { .tv_sec = 0, .tv_nsec = 1000000 };
+      nanosleep(&t, NULL);
+      continue;
+    }
+
+    int i;
+    for (i = 0; i < AP_SLICE && nemu_state == NEMU_RUNNING; i ++) {
+      exec_wrapper(false);
+      nr_guest_instr ++;
+      check_intr();
+    }
+  }
+
+  if (nemu_state == NEMU_END) {
+    /* End the guest with the exit code of this processor. */
+    bsp->halt_ret = nemu_ctx->halt_ret;
+    __atomic_store_n(&bsp->state, NEMU_END, __ATOMIC_RELEASE);
+  }
+  return NULL;
+}
+
+static void start_ap(vaddr_t entry) {
+  NEMUContext *bsp = vcpu[0];
+  /* The I/O accesses are serialized from now on. This runs in an access of
+   * the BSP before any AP exists, which has decided not to take the lock. */
+  if (nr_started < nr_cpu) { bsp->pio->shared = bsp->mmio->shared = true; }
+  int i;
+  for (i = nr_started; i < nr_cpu; i ++) {
+    /* The AP shares the memory and the I/O spaces with the BSP. */
+    NEMUContext *ctx = malloc(sizeof(NEMUContext));
+    assert(ctx != NULL);
+    *ctx = *bsp;
+    ctx->cpu_id = i;
+    ctx->intr_pending = 0;
+    ctx->idt_gen = 0;
+    ctx->halt_ret = 0;
+
+    NEMUContext *prev = nemu_switch_ctx(ctx);
+    memset(&cpu, 0, sizeof(cpu));
+    cpu.eax = i;
+    cpu.eip = entry;
+    cpu.eflags.val = 0x2;
+    nemu_state = NEMU_RUNNING;
+    nr_guest_instr = nr_mem_read = nr_mem_write = 0;
+    nemu_switch_ctx(prev);
+
+    vcpu[i] = ctx;
+    __atomic_store_n(&nr_started, i + 1, __ATOMIC_RELEASE);
+
+    pthread_t t;
+    int ret = pthread_create(&t, NULL, ap_main, ctx);
+    Assert(ret == 0, "Can not start processor %d", i);
+    pthread_detach(t);
+  }
+}
+
+/* Post an interrupt to all the processors started. It is called by the
+ * timer in a signal handler, so it only touches the contexts atomically. */
+void mpe_post_intr_all(int line) {
+  int n = __atomic_load_n(&nr_started, __ATOMIC_ACQUIRE);
+  int i;
+  for (i = 0; i < n; i ++) {
+    post_intr(vcpu[i], line);
+  }
+}
+
+static void mpe_io_handler(ioaddr_t addr, int len, bool is_write) {
+  uint32_t val = mpe_port_base[(addr - MPE_PORT) / 4];
+  switch (addr - MPE_PORT) {
+    case CPU_ID_OFFSET:
+      if (!is_write) { mpe_port_base[CPU_ID_OFFSET / 4] = nemu_ctx->cpu_id; }
+      break;
+    case START_OFFSET:
+      if (is_write) { start_ap(val); }
+      break;
+    case IPI_OFFSET:
+      if (is_write && val < __atomic_load_n(&nr_started, __ATOMIC_ACQUIRE)) {
+        post_intr(vcpu[val], INTR_IPI);
+      }
+      break;
+    case STOP_OFFSET:
+      if (is_write && nemu_ctx->cpu_id != 0) { nemu_state = NEMU_STOP; }
+      break;
+  }
+}
+
+void init_mpe(int n) {
+  Assert(n >= 1 && n <= MAX_CPU, "The number of processors should be in [1, %d]", MAX_CPU);
+  nr_cpu = n;
+  vcpu[0] = nemu_ctx;
+  __atomic_store_n(&nr_started, 1, __ATOMIC_RELEASE);
+  mpe_port_base = add_pio_map(MPE_PORT, NR_MPE_PORT, mpe_io_handler);
+  mpe_port_base[NR_CPU_OFFSET / 4] = n;
+}
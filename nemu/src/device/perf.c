@@ -0,0 +1,48 @@
+#include "nemu.h"
+#include "device/port-io.h"
+#include "monitor/monitor.h"
+
+/* Performance counters of the guest. Write the number of a counter to
+ * SELECT, then read LO and HI. Reading LO latches the whole 64-bit value,
+ * so LO followed by HI is consistent.
+ *
+ * Cycles follow a simple model: one cycle per instruction plus one per
+ * memory access. There is no TLB or cache model yet, so those counters
+ * read as 0.
+ */
+
+#define PERF_PORT 0x50
+#define SELECT_OFFSET 0 /* w: counter number */
+#define LO_OFFSET 4     /* r: low 32 bits, latches the counter */
+#define HI_OFFSET 8     /* r: high 32 bits of the latched value */
+#define NR_PERF_PORT 12
+
+enum {
+  PERF_INSTRET, PERF_CYCLE, PERF_MEM_READ, PERF_MEM_WRITE,
+  PERF_TLB_HIT, PERF_TLB_MISS, PERF_CACHE_HIT, PERF_CACHE_MISS,
+  NR_PERF
+};
+
+static uint32_t *perf_port_base;
+
+static uint64_t perf_counter(uint32_t no) {
+  switch (no) {
+    case PERF_INSTRET: return nr_guest_instr;
+    case PERF_CYCLE: return nr_guest_instr + nr_mem_read + nr_mem_write;
+    case PERF_MEM_READ: return nr_mem_read;
+    case PERF_MEM_WRITE: return nr_mem_write;
+    default: return 0;
+  }
+}
+
+void perf_io_handler(ioaddr_t addr, int len, bool is_write) {
+  if (!is_write && addr - PERF_PORT == LO_OFFSET) {
+    uint64_t val = perf_counter(perf_port_base[SELECT_OFFSET / 4]);
+    perf_port_base[LO_OFFSET / 4] = (uint32_t)val;
+    perf_port_base[HI_OFFSET / 4] = val >> 32;
+  }
+}
+
+void init_perf() {
+  perf_port_base = add_pio_map(PERF_PORT, NR_PERF_PORT, perf_io_handler);
+}
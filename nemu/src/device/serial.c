@@ -1,29 +1,203 @@
 #include "common.h"
 #include "device/port-io.h"
+#include "monitor/reverse.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
 
 /* http://en.wikibooks.org/wiki/Serial_Programming/8250_UART_Programming */
 
 #define SERIAL_PORT 0x3F8
 #define CH_OFFSET 0
 #define LSR_OFFSET 5		/* line status register */
+#define LSR_TX_READY 0x20
+#define LSR_RX_READY 0x01
 
 static uint8_t *serial_port_base;
 
+/* The output of the serial port is buffered in a ring, and a background
+ * thread writes it to the host stdout. The writer is woken up when the
+ * pending data exceeds TX_FLUSH_THRESHOLD, otherwise it waits at most
+ * TX_FLUSH_MS before writing out what has been buffered.
+ */
+#define TX_BUF_SIZE (1024 * 1024)
+#define TX_FLUSH_THRESHOLD (TX_BUF_SIZE / 4)
+#define TX_FLUSH_MS 20
+
+static char tx_buf[TX_BUF_SIZE];
+/* Free running indices. `tx_head' is only advanced by the writer
+ * and `tx_tail' is only advanced by the CPU, both under `tx_lock'.
+ */
+static uint32_t tx_head = 0, tx_tail = 0;
+static bool tx_flush_req = false;
+static pthread_mutex_t tx_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t tx_wakeup = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t tx_drained = PTHREAD_COND_INITIALIZER;
+static pthread_once_t tx_writer_once = PTHREAD_ONCE_INIT;
+
+static void* tx_writer(void *arg) {
+  pthread_mutex_lock(&tx_lock);
+  while (1) {
+    while (tx_head == tx_tail) {
+      pthread_cond_wait(&tx_wakeup, &tx_lock);
+    }
+
+    if (!tx_flush_req && tx_tail - tx_head < TX_FLUSH_THRESHOLD) {
+      /* give the guest a chance to produce more output */
+      struct timespec deadline;
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_nsec += TX_FLUSH_MS * 1000000L;
+      if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec ++;
+        deadline.tv_nsec -= 1000000000L;
+      }
+      pthread_cond_timedwait(&tx_wakeup, &tx_lock, &deadline);
+    }
+    tx_flush_req = false;
+
+    uint32_t head = tx_head, tail = tx_tail;
+    pthread_mutex_unlock(&tx_lock);
+
+    /* [head, tail) is not touched by the CPU until `tx_head' is advanced */
+    while (head != tail) {
+      uint32_t off = head % TX_BUF_SIZE;
+      uint32_t len = tail - head;
+      if (off + len > TX_BUF_SIZE) { len = TX_BUF_SIZE - off; }
+      fwrite(tx_buf + off, 1, len, stdout);
+      head += len;
+    }
+    fflush(stdout);
+
+    pthread_mutex_lock(&tx_lock);
+    tx_head = tail;
+    pthread_cond_broadcast(&tx_drained);
+  }
+  return NULL;
+}
+
+static void start_tx_writer() {
+  pthread_t tid;
+  int ret = pthread_create(&tid, NULL, tx_writer, NULL);
+  Assert(ret == 0, "Can not create the serial writer thread");
+  pthread_detach(tid);
+}
+
+static void serial_putc(char c) {
+  pthread_once(&tx_writer_once, start_tx_writer);
+
+  pthread_mutex_lock(&tx_lock);
+  while (tx_tail - tx_head == TX_BUF_SIZE) {
+    tx_flush_req = true;
+    pthread_cond_signal(&tx_wakeup);
+    pthread_cond_wait(&tx_drained, &tx_lock);
+  }
+  tx_buf[tx_tail % TX_BUF_SIZE] = c;
+  tx_tail ++;
+  if (tx_tail - tx_head == 1 || tx_tail - tx_head >= TX_FLUSH_THRESHOLD) {
+    pthread_cond_signal(&tx_wakeup);
+  }
+  pthread_mutex_unlock(&tx_lock);
+}
+
+/* Block until everything the guest has output reaches the host stdout. */
+void serial_flush() {
+  pthread_mutex_lock(&tx_lock);
+  while (tx_head != tx_tail) {
+    tx_flush_req = true;
+    pthread_cond_signal(&tx_wakeup);
+    pthread_cond_wait(&tx_drained, &tx_lock);
+  }
+  pthread_mutex_unlock(&tx_lock);
+}
+
+/* The input of the serial port comes from a host file or stdin, which is
+ * read by a background thread into a FIFO. The data ready bit of LSR is
+ * set as long as the FIFO is not empty.
+ */
+#define RX_FIFO_SIZE 4096
+
+static uint8_t rx_fifo[RX_FIFO_SIZE];
+static uint32_t rx_head = 0, rx_tail = 0;
+static pthread_mutex_t rx_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rx_space = PTHREAD_COND_INITIALIZER;
+
+static void* rx_reader(void *arg) {
+  int fd = (intptr_t)arg;
+  uint8_t buf[RX_FIFO_SIZE];
+  while (1) {
+    pthread_mutex_lock(&rx_lock);
+    while (rx_tail - rx_head == RX_FIFO_SIZE) {
+      pthread_cond_wait(&rx_space, &rx_lock);
+    }
+    uint32_t space = RX_FIFO_SIZE - (rx_tail - rx_head);
+    pthread_mutex_unlock(&rx_lock);
+
+    ssize_t nread = read(fd, buf, space);
+    if (nread <= 0) { break; }
+
+    pthread_mutex_lock(&rx_lock);
+    ssize_t i;
+    for (i = 0; i < nread; i ++) {
+      rx_fifo[(rx_tail + i) % RX_FIFO_SIZE] = buf[i];
+    }
+    rx_tail += nread;
+    pthread_mutex_unlock(&rx_lock);
+  }
+
+  if (fd != STDIN_FILENO) { close(fd); }
+  return NULL;
+}
+
+static void serial_update_lsr() {
+  /* an unlocked peek is enough: the reader only makes the FIFO longer */
+  bool has_data = (__atomic_load_n(&rx_tail, __ATOMIC_ACQUIRE) != rx_head);
+  serial_port_base[LSR_OFFSET] = LSR_TX_READY | (has_data ? LSR_RX_READY : 0);
+}
+
+static void serial_getc() {
+  pthread_mutex_lock(&rx_lock);
+  if (rx_head != rx_tail) {
+    serial_port_base[CH_OFFSET] = rx_fifo[rx_head % RX_FIFO_SIZE];
+    rx_head ++;
+    pthread_cond_signal(&rx_space);
+  }
+  pthread_mutex_unlock(&rx_lock);
+}
+
 void serial_io_handler(ioaddr_t addr, int len, bool is_write) {
   if (is_write) {
     assert(len == 1);
-    if (addr == SERIAL_PORT + CH_OFFSET) {
-      char c = serial_port_base[CH_OFFSET];
+    if (addr == SERIAL_PORT + CH_OFFSET && !ckpt_replaying()) {
       /* We bind the serial port with the host stdout in NEMU. */
-      putc(c, stdout);
-      if (c == '\n') {
-        fflush(stdout);
-      }
+      serial_putc(serial_port_base[CH_OFFSET]);
     }
   }
+  else {
+    if (addr == SERIAL_PORT + CH_OFFSET) {
+      serial_getc();
+    }
+    serial_update_lsr();
+  }
+}
+
+void init_serial_input(const char *file) {
+  int fd = STDIN_FILENO;
+  if (strcmp(file, "-") != 0) {
+    fd = open(file, O_RDONLY);
+    Assert(fd >= 0, "Can not open '%s'", file);
+  }
+  Log("Serial input is from %s", (fd == STDIN_FILENO ? "stdin" : file));
+
+  pthread_t tid;
+  int ret = pthread_create(&tid, NULL, rx_reader, (void *)(intptr_t)fd);
+  Assert(ret == 0, "Can not create the serial reader thread");
+  pthread_detach(tid);
 }
 
 void init_serial() {
   serial_port_base = add_pio_map(SERIAL_PORT, 8, serial_io_handler);
-  serial_port_base[LSR_OFFSET] = 0x20; /* the status is always free */
+  serial_port_base[LSR_OFFSET] = LSR_TX_READY;
+  atexit(serial_flush);
 }
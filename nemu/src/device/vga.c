@@ -15,8 +15,41 @@ static SDL_Renderer *renderer;
 static SDL_Texture *texture;
 
 static uint32_t (*vmem) [SCREEN_W];
+static bool vga_opened = false, vga_failed = false;
+static bool vga_open_requested = false;
+
+/* SDL and the window are brought up when the guest first touches the screen
+ * or reads the keyboard, so a guest without them starts fast. Any processor
+ * may ask for them, and the main thread brings them up in device_update(). */
+void vga_request_open() {
+  if (!__atomic_load_n(&vga_open_requested, __ATOMIC_RELAXED)) {
+    __atomic_store_n(&vga_open_requested, true, __ATOMIC_RELAXED);
+  }
+}
+
+void vga_open() {
+  if (vga_opened || vga_failed || !__atomic_load_n(&vga_open_requested, __ATOMIC_RELAXED)) {
+    return;
+  }
+
+  if (SDL_Init(SDL_INIT_VIDEO) != 0 ||
+      SDL_CreateWindowAndRenderer(SCREEN_W * 2, SCREEN_H * 2, 0, &window, &renderer) != 0) {
+    Log("Can not open the screen: %s", SDL_GetError());
+    vga_failed = true;
+    return;
+  }
+  SDL_SetWindowTitle(window, "NEMU");
+  texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+      SDL_TEXTUREACCESS_STATIC, SCREEN_W, SCREEN_H);
+  vga_opened = true;
+}
+
+bool vga_is_open() {
+  return vga_opened;
+}
 
 void vga_vmem_io_handler(paddr_t addr, int len, bool is_write) {
+  vga_request_open();
 }
 
 void update_screen() {
@@ -27,12 +60,6 @@ void update_screen() {
 }
 
 void init_vga() {
-  SDL_Init(SDL_INIT_VIDEO);
-  SDL_CreateWindowAndRenderer(SCREEN_W * 2, SCREEN_H * 2, 0, &window, &renderer);
-  SDL_SetWindowTitle(window, "NEMU");
-  texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
-      SDL_TEXTUREACCESS_STATIC, SCREEN_W, SCREEN_H);
-
   vmem = add_mmio_map(VMEM, 0x80000, vga_vmem_io_handler);
 }
 #endif	/* HAS_IOE */
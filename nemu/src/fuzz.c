@@ -0,0 +1,231 @@
+#include "nemu.h"
+#include "monitor/monitor.h"
+#include "monitor/difftest.h"
+#include "libnemu.h"
+#include "fuzz.h"
+#include <stdlib.h>
+
+/* In-process fuzzing harness, see include/libnemu.h.
+ *
+ * The memory is restored by pages. The first store of a case to a page saves
+ * the page of the template, and the saved pages are copied back to NEMU and
+ * to the reference at the end of the case. The pages stored to by the
+ * reference are saved as well, in case NEMU does not store there. A case
+ * only touches a few pages, which is much cheaper than a new process.
+ */
+
+#define FUZZ_PAGE_SHIFT 12
+#define FUZZ_PAGE_SIZE (1 << FUZZ_PAGE_SHIFT)
+#define NR_FUZZ_PAGE (PMEM_SIZE >> FUZZ_PAGE_SHIFT)
+
+typedef struct FuzzState {
+  CPU_state tmpl_cpu;       /* the CPU of the template */
+  uint8_t dirty[NR_FUZZ_PAGE / 8];
+  uint32_t *saved_page;     /* the pages saved in this case */
+  uint8_t *saved;           /* and their content in the template */
+  int nr_saved, max_saved;
+  bool fault, invalid;
+  /* the stores of the current instruction */
+  DiffStore store[DIFF_MAX_STORE];
+  int nr_store;
+} FuzzState;
+
+/* the reference shared by the process */
+static DiffBackend *ref = NULL;
+
+DiffBackend *difftest_load_ref(const char *);
+void exec_wrapper(bool);
+
+static inline bool in_pmem(vaddr_t addr, int len) {
+  return addr < PMEM_SIZE && len <= PMEM_SIZE - addr;
+}
+
+static void save_page(FuzzState *fz, uint32_t page) {
+  if ((fz->dirty[page >> 3] >> (page & 7)) & 1) return;
+  fz->dirty[page >> 3] |= 1 << (page & 7);
+
+  if (fz->nr_saved == fz->max_saved) {
+    fz->max_saved = (fz->max_saved == 0 ? 16 : fz->max_saved * 2);
+    fz->saved_page = realloc(fz->saved_page, fz->max_saved * sizeof(uint32_t));
+    fz->saved = realloc(fz->saved, (size_t)fz->max_saved * FUZZ_PAGE_SIZE);
+    assert(fz->saved_page && fz->saved);
+  }
+  fz->saved_page[fz->nr_saved] = page;
+  memcpy(fz->saved + (size_t)fz->nr_saved * FUZZ_PAGE_SIZE,
+      guest_to_host(page * FUZZ_PAGE_SIZE), FUZZ_PAGE_SIZE);
+  fz->nr_saved ++;
+}
+
+static void save_range(FuzzState *fz, vaddr_t addr, int len) {
+  uint32_t page = addr >> FUZZ_PAGE_SHIFT;
+  uint32_t last = (addr + len - 1) >> FUZZ_PAGE_SHIFT;
+  for (; page <= last; page ++) {
+    save_page(fz, page);
+  }
+}
+
+static void restore_pages(FuzzState *fz) {
+  int i;
+  for (i = 0; i < fz->nr_saved; i ++) {
+    uint32_t page = fz->saved_page[i];
+    void *p = guest_to_host(page * FUZZ_PAGE_SIZE);
+    memcpy(p, fz->saved + (size_t)i * FUZZ_PAGE_SIZE, FUZZ_PAGE_SIZE);
+    ref->memcpy(page << FUZZ_PAGE_SHIFT, p, FUZZ_PAGE_SIZE);
+    fz->dirty[page >> 3] &= ~(1 << (page & 7));
+  }
+  fz->nr_saved = 0;
+}
+
+static void fault(FuzzState *fz) {
+  fz->fault = true;
+  nemu_state = NEMU_END;
+}
+
+bool fuzz_check_read(vaddr_t addr, int len) {
+  if (in_pmem(addr, len)) return true;
+  fault(nemu_ctx->fuzz);
+  return false;
+}
+
+bool fuzz_note_store(vaddr_t addr, int len, uint32_t data) {
+  FuzzState *fz = nemu_ctx->fuzz;
+  if (!in_pmem(addr, len)) {
+    fault(fz);
+    return false;
+  }
+  save_range(fz, addr, len);
+
+  if (fz->nr_store < DIFF_MAX_STORE) {
+    DiffStore *s = &fz->store[fz->nr_store];
+    s->addr = addr;
+    s->len = len;
+    s->data = (len == 4 ? data : data & ((1u << (len * 8)) - 1));
+  }
+  fz->nr_store ++;
+  return true;
+}
+
+void fuzz_invalid(void) {
+  nemu_ctx->fuzz->invalid = true;
+}
+
+void fuzz_fault(void) {
+  fault(nemu_ctx->fuzz);
+}
+
+void fuzz_destroy(FuzzState *fz) {
+  free(fz->saved_page);
+  free(fz->saved);
+  free(fz);
+}
+
+/* the interface */
+
+int nemu_fuzz_init(NEMUContext *ctx, const char *ref_so) {
+  if (ref == NULL) {
+    ref = difftest_load_ref(ref_so);
+    if (ref == NULL) return -1;
+    ref->init(PMEM_SIZE);
+  }
+
+  FuzzState *fz = calloc(1, sizeof(FuzzState));
+  if (fz == NULL) return -1;
+
+  NEMUContext *prev = nemu_switch_ctx(ctx);
+  fz->tmpl_cpu = cpu;
+  /* The memory of the reference starts zeroed, and so do most pages. */
+  static const uint8_t zero[FUZZ_PAGE_SIZE];
+  uint32_t addr;
+  for (addr = 0; addr < PMEM_SIZE; addr += FUZZ_PAGE_SIZE) {
+    if (memcmp(guest_to_host(addr), zero, FUZZ_PAGE_SIZE) != 0) {
+      ref->memcpy(addr, guest_to_host(addr), FUZZ_PAGE_SIZE);
+    }
+  }
+  ctx->fuzz = fz;
+  nemu_switch_ctx(prev);
+  return 0;
+}
+
+static inline void nemu_regs(NEMURegs *r) {
+  memcpy(&r->eax, &cpu.eax, sizeof(uint32_t) * 9);
+  r->eflags = cpu.eflags.val;
+}
+
+static inline bool same_stores(FuzzState *fz, DiffStore *s, int n) {
+  int nemu_n = (fz->nr_store < DIFF_MAX_STORE ? fz->nr_store : DIFF_MAX_STORE);
+  return n == nemu_n && memcmp(s, fz->store, sizeof(*s) * n) == 0;
+}
+
+int nemu_fuzz_one(NEMUContext *ctx, const uint8_t *code, int len,
+    const NEMURegs *regs, int n, NEMUFuzzResult *res) {
+  FuzzState *fz = ctx->fuzz;
+  assert(fz != NULL);
+  if (len <= 0 || !in_pmem(regs->eip, len)) return -1;
+
+  NEMUContext *prev = nemu_switch_ctx(ctx);
+  save_range(fz, regs->eip, len);
+  memcpy(guest_to_host(regs->eip), code, len);
+  ref->memcpy(regs->eip, code, len);
+
+  /* `NEMURegs' is laid out as `DiffRegs' */
+  DiffRegs r;
+  memcpy(&r, regs, sizeof(r));
+  r.eflags |= 0x2;
+  ref->setregs(&r);
+  cpu = fz->tmpl_cpu;
+  /* the IDT cache may be of the last case */
+  ctx->idt_gen = 0;
+  memcpy(&cpu.eax, &r.eax, sizeof(uint32_t) * 9);
+  cpu.eflags.val = r.eflags;
+  nemu_state = NEMU_RUNNING;
+  fz->fault = fz->invalid = false;
+
+  int status = NEMU_FUZZ_SAME;
+  res->nr_instr = 0;
+  while (res->nr_instr < n) {
+    res->eip = cpu.eip;
+    fz->nr_store = 0;
+    exec_wrapper(false);
+    nr_guest_instr ++;
+    res->nr_instr ++;
+
+    /* The reference can not access it either. */
+    if (fz->fault) break;
+    /* nemu_trap */
+    if (nemu_state != NEMU_RUNNING && !fz->invalid) break;
+
+    DiffStore s[DIFF_MAX_STORE];
+    int nr = ref->step(s, DIFF_MAX_STORE);
+    if (nr == DIFF_FAIL) {
+      status = NEMU_FUZZ_REF_FAIL;
+      break;
+    }
+
+    int i;
+    for (i = 0; i < nr; i ++) {
+      if (in_pmem(s[i].addr, s[i].len)) { save_range(fz, s[i].addr, s[i].len); }
+    }
+    if (fz->invalid) {
+      status = NEMU_FUZZ_UNIMPL;
+      break;
+    }
+
+    ref->getregs(&r);
+    if (memcmp(&r.eax, &cpu.eax, sizeof(uint32_t) * 9) != 0 ||
+        (nr != DIFF_NO_STORE && !same_stores(fz, s, nr))) {
+      status = NEMU_FUZZ_DIVERGED;
+      break;
+    }
+  }
+
+  res->status = status;
+  nemu_regs(&res->nemu);
+  ref->getregs(&r);
+  memcpy(&res->ref, &r, sizeof(r));
+
+  restore_pages(fz);
+  nemu_ctx->halt_ret = 0;
+  nemu_state = NEMU_STOP;
+  nemu_switch_ctx(prev);
+  return status;
+}
@@ -1,5 +1,6 @@
 int init_monitor(int, char *[]);
 void ui_mainloop(int);
+int batch_exit_status();
 
 int main(int argc, char *argv[]) {
   /* Initialize the monitor. */
@@ -8,5 +9,5 @@ int main(int argc, char *argv[]) {
   /* Receive commands from user. */
   ui_mainloop(is_batch_mode);
 
-  return 0;
+  return (is_batch_mode ? batch_exit_status() : 0);
 }
@@ -1,28 +1,166 @@
 #include "nemu.h"
-
-#define PMEM_SIZE (128 * 1024 * 1024)
+#include "device/mmio.h"
+#include "monitor/memwatch.h"
+#include "monitor/reverse.h"
+#include "cpu/intr.h"
+#include "fuzz.h"
 
 #define pmem_rw(addr, type) *(type *)({\
     Assert(addr < PMEM_SIZE, "physical address(0x%08x) is out of bound", addr); \
     guest_to_host(addr); \
     })
 
-uint8_t pmem[PMEM_SIZE];
-
 /* Memory accessing interfaces */
 
 uint32_t paddr_read(paddr_t addr, int len) {
+  int map_NO = is_mmio(addr);
+  if (map_NO != -1) {
+    return mmio_read(addr, len, map_NO);
+  }
   return pmem_rw(addr, uint32_t) & (~0u >> ((4 - len) << 3));
 }
 
 void paddr_write(paddr_t addr, int len, uint32_t data) {
+  int map_NO = is_mmio(addr);
+  if (map_NO != -1) {
+    mmio_write(addr, len, data, map_NO);
+    return;
+  }
+  ckpt_note_write(addr, len);
+  idt_note_write(addr, len);
   memcpy(guest_to_host(addr), &data, len);
 }
 
+/* Atomic accesses for the processors sharing the memory.
+ *
+ * A lock-prefixed instruction is executed between mem_lock_begin() and
+ * mem_lock_end(). Its reads are remembered, and its write back to an address
+ * it has read is a compare-and-swap against the value read. If another
+ * processor has changed the memory meanwhile, nothing is written and
+ * mem_lock_end() returns false, so the instruction is executed again.
+ */
+#define NR_LOCK_READ 8
+
+static __thread bool locked = false, lock_failed;
+static __thread int nr_lock_read;
+static __thread struct {
+  paddr_t addr;
+  int len;
+  uint32_t data;
+} lock_read[NR_LOCK_READ];
+
+void mem_lock_begin() {
+  locked = true;
+  lock_failed = false;
+  nr_lock_read = 0;
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+bool mem_lock_end() {
+  locked = false;
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  return !lock_failed;
+}
+
+static inline bool cas(void *p, int len, uint32_t old, uint32_t new) {
+  switch (len) {
+    case 4: { uint32_t o = old; return __atomic_compare_exchange_n((uint32_t *)p, &o, new, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); }
+    case 2: { uint16_t o = old; return __atomic_compare_exchange_n((uint16_t *)p, &o, new, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); }
+    case 1: { uint8_t o = old; return __atomic_compare_exchange_n((uint8_t *)p, &o, new, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); }
+    default: assert(0);
+  }
+}
+
+static void locked_write(paddr_t addr, int len, uint32_t data) {
+  int i;
+  for (i = nr_lock_read - 1; i >= 0; i --) {
+    if (lock_read[i].addr == addr && lock_read[i].len == len) { break; }
+  }
+  if (i < 0 || is_mmio(addr) != -1) {
+    paddr_write(addr, len, data);
+    return;
+  }
+
+  Assert(addr < PMEM_SIZE, "physical address(0x%08x) is out of bound", addr);
+  ckpt_note_write(addr, len);
+  idt_note_write(addr, len);
+  if (!cas(guest_to_host(addr), len, lock_read[i].data, data)) { lock_failed = true; }
+}
+
 uint32_t vaddr_read(vaddr_t addr, int len) {
-  return paddr_read(addr, len);
+  nr_mem_read ++;
+  if (nemu_ctx->fuzz != NULL && !fuzz_check_read(addr, len)) { return 0; }
+  uint32_t data = paddr_read(addr, len);
+  if (locked && nr_lock_read < NR_LOCK_READ) {
+    lock_read[nr_lock_read].addr = addr;
+    lock_read[nr_lock_read].len = len;
+    lock_read[nr_lock_read].data = data;
+    nr_lock_read ++;
+  }
+  return data;
 }
 
 void vaddr_write(vaddr_t addr, int len, uint32_t data) {
+  nr_mem_write ++;
+  if (nemu_ctx->fuzz != NULL && !fuzz_note_store(addr, len, data)) { return; }
+  mw_check_store(addr, len);
+#ifdef DIFF_TEST
+  void difftest_log_store(vaddr_t, int, uint32_t);
+  difftest_log_store(addr, len, data);
+#endif
+  if (locked) {
+    locked_write(addr, len, data);
+    return;
+  }
   paddr_write(addr, len, data);
 }
+
+/* Store `nr_word' words from `addr' up, as that many 4-byte stores do. The
+ * words are copied in one write when the range is ordinary memory and the
+ * stores need not be seen one by one. */
+void vaddr_write_block(vaddr_t addr, const uint32_t *data, int nr_word) {
+#ifndef DIFF_TEST
+  int len = nr_word * 4;
+  if (nemu_ctx->fuzz == NULL && !locked && addr < PMEM_SIZE && len <= PMEM_SIZE - addr &&
+      is_mmio(addr) == -1 && is_mmio(addr + len - 1) == -1) {
+    nr_mem_write += nr_word;
+    mw_check_store(addr, len);
+    ckpt_note_write(addr, len);
+    idt_note_write(addr, len);
+    memcpy(guest_to_host(addr), data, len);
+    return;
+  }
+#endif
+  int i;
+  for (i = 0; i < nr_word; i ++) {
+    vaddr_write(addr + i * 4, 4, data[i]);
+  }
+}
+
+/* Exchange `data' with the memory atomically, as xchg does, and return the
+ * old value. The read is not counted, since the decoder has read it. */
+uint32_t vaddr_xchg(vaddr_t addr, int len, uint32_t data) {
+  nr_mem_write ++;
+  if (nemu_ctx->fuzz != NULL && !fuzz_note_store(addr, len, data)) { return 0; }
+  mw_check_store(addr, len);
+#ifdef DIFF_TEST
+  void difftest_log_store(vaddr_t, int, uint32_t);
+  difftest_log_store(addr, len, data);
+#endif
+  if (is_mmio(addr) != -1) {
+    uint32_t old = paddr_read(addr, len);
+    paddr_write(addr, len, data);
+    return old;
+  }
+
+  Assert(addr < PMEM_SIZE, "physical address(0x%08x) is out of bound", addr);
+  ckpt_note_write(addr, len);
+  idt_note_write(addr, len);
+  void *p = guest_to_host(addr);
+  switch (len) {
+    case 4: return __atomic_exchange_n((uint32_t *)p, data, __ATOMIC_SEQ_CST);
+    case 2: return __atomic_exchange_n((uint16_t *)p, data, __ATOMIC_SEQ_CST);
+    case 1: return __atomic_exchange_n((uint8_t *)p, data, __ATOMIC_SEQ_CST);
+    default: assert(0);
+  }
+}
@@ -1,6 +1,11 @@
 #include "nemu.h"
 #include "monitor/monitor.h"
 #include "monitor/watchpoint.h"
+#include "monitor/breakpoint.h"
+#include "monitor/profile.h"
+#include "monitor/reverse.h"
+#include "monitor/simpoint.h"
+#include "cpu/intr.h"
 /* The assembly code of instructions executed is only output to the screen
  * when the number of instructions executed is less than this value.
  * This is useful when you use the `si' command.
@@ -8,8 +13,6 @@
  */
 #define MAX_INSTR_TO_PRINT 10
 
-int nemu_state = NEMU_STOP;
-
 void exec_wrapper(bool);
 
 /* Simulate how the CPU works. */
@@ -20,18 +23,38 @@ void cpu_exec(uint64_t n) {
   }
   nemu_state = NEMU_RUNNING;
 
+  /* A breakpoint at the first instruction, e.g. the entry, stops before it
+   * is executed, unless it is where the last stop happened. */
+  bool resume = nemu_ctx->stopped && nemu_ctx->stop_eip == cpu.eip &&
+    nemu_ctx->stop_instr == nr_guest_instr;
+  if (!resume && check_breakpoint(cpu.eip)) {
+    nemu_stop();
+    nemu_note_stop();
+    return;
+  }
+
   bool print_flag = n < MAX_INSTR_TO_PRINT;
 
   for (; n > 0; n --) {
     /* Execute one instruction, including instruction fetch,
      * instruction decode, and the actual execution. */
     exec_wrapper(print_flag);
+    nr_guest_instr ++;
+    check_intr();
+    profile_check();
+    simpoint_check();
+    ckpt_check();
+
+    /* Stop before executing the instruction at a breakpoint. */
+    if (nemu_state == NEMU_RUNNING && check_breakpoint(cpu.eip)) {
+      nemu_stop();
+    }
 
 #ifdef DEBUG
     /* TODO: check watchpoints here. */
     bool stop=check_watchpoints();
     if(stop){
-      nemu_state=NEMU_STOP;
+      nemu_stop();
     }
 #endif
 
@@ -40,8 +63,15 @@ void cpu_exec(uint64_t n) {
     device_update();
 #endif
 
-    if (nemu_state != NEMU_RUNNING) { return; }
+    if (nemu_state != NEMU_RUNNING) { break; }
   }
 
-  if (nemu_state == NEMU_RUNNING) { nemu_state = NEMU_STOP; }
+#ifdef DIFF_TEST
+  void difftest_sync(void);
+  difftest_sync();
+#endif
+
+  /* Another processor may have ended the guest meanwhile. */
+  nemu_stop();
+  nemu_note_stop();
 }
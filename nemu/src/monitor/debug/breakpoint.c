@@ -0,0 +1,138 @@
+#include "nemu.h"
+#include "monitor/breakpoint.h"
+#include "monitor/expr.h"
+
+#define NR_BP 32
+
+typedef struct {
+  bool used;
+  vaddr_t addr;
+  int hit;
+  int ignore;       /* number of hits to ignore */
+  bool has_cond;
+  ExprCode cond;
+  char cond_str[128];
+} BP;
+
+static BP bp_pool[NR_BP];
+
+int nr_bp = 0;
+vaddr_t bp_hash_addr[BP_HASH_SIZE];
+int8_t bp_hash_idx[BP_HASH_SIZE] = { [0 ... BP_HASH_SIZE - 1] = -1 };
+
+static void bp_hash_insert(vaddr_t addr, int idx) {
+  uint32_t h = bp_hash(addr);
+  while (bp_hash_idx[h] != -1) {
+    h = (h + 1) & (BP_HASH_SIZE - 1);
+  }
+  bp_hash_addr[h] = addr;
+  bp_hash_idx[h] = idx;
+}
+
+static int bp_find(vaddr_t addr) {
+  uint32_t h = bp_hash(addr);
+  while (bp_hash_idx[h] != -1) {
+    if (bp_hash_addr[h] == addr) return bp_hash_idx[h];
+    h = (h + 1) & (BP_HASH_SIZE - 1);
+  }
+  return -1;
+}
+
+/* Deleting from an open-addressing table would break the probe chains,
+ * so the table is rebuilt instead. */
+static void bp_hash_rebuild() {
+  memset(bp_hash_idx, -1, sizeof(bp_hash_idx));
+  int i;
+  for (i = 0; i < NR_BP; i ++) {
+    if (bp_pool[i].used) bp_hash_insert(bp_pool[i].addr, i);
+  }
+}
+
+bool bp_hit(int idx) {
+  BP *bp = &bp_pool[idx];
+  if (bp->has_cond) {
+    bool ok;
+    uint64_t val = expr_run(&bp->cond, &ok);
+    if (ok && val == 0) return false;
+  }
+
+  bp->hit ++;
+  if (bp->ignore > 0) {
+    bp->ignore --;
+    return false;
+  }
+  printf("hit breakpoint %d at 0x%08x\n", idx, bp->addr);
+  return true;
+}
+
+/* Like check_breakpoint(), but without counting the hit. */
+bool bp_match(vaddr_t eip) {
+  if (nr_bp == 0) return false;
+  int idx = bp_find(eip);
+  if (idx == -1) return false;
+  BP *bp = &bp_pool[idx];
+  if (bp->has_cond) {
+    bool ok;
+    uint64_t val = expr_run(&bp->cond, &ok);
+    if (ok && val == 0) return false;
+  }
+  return true;
+}
+
+int add_bp(vaddr_t addr, char *cond, char **err) {
+  if (bp_find(addr) != -1) {
+    *err = "there is already a breakpoint at this address";
+    return 0;
+  }
+
+  int i;
+  for (i = 0; i < NR_BP; i ++) {
+    if (!bp_pool[i].used) break;
+  }
+  if (i == NR_BP) {
+    *err = "too many breakpoints";
+    return 0;
+  }
+
+  BP *bp = &bp_pool[i];
+  bp->has_cond = (cond != NULL);
+  if (cond != NULL) {
+    if (strlen(cond) >= sizeof(bp->cond_str) || !expr_compile(cond, &bp->cond)) {
+      *err = "condition check failed";
+      return 0;
+    }
+    strcpy(bp->cond_str, cond);
+  }
+  bp->used = true;
+  bp->addr = addr;
+  bp->hit = 0;
+  bp->ignore = 0;
+  bp_hash_insert(addr, i);
+  nr_bp ++;
+  return i;
+}
+
+bool del_bp(int no) {
+  if (no < 0 || no >= NR_BP || !bp_pool[no].used) return false;
+  bp_pool[no].used = false;
+  nr_bp --;
+  bp_hash_rebuild();
+  return true;
+}
+
+bool set_bp_ignore(int no, int count) {
+  if (no < 0 || no >= NR_BP || !bp_pool[no].used) return false;
+  bp_pool[no].ignore = count;
+  return true;
+}
+
+void show_breakpoints() {
+  printf("NO\tAddress\t\tHit\tIgnore\tCondition\n");
+  int i;
+  for (i = 0; i < NR_BP; i ++) {
+    BP *bp = &bp_pool[i];
+    if (!bp->used) continue;
+    printf("%d\t0x%08x\t%d\t%d\t%s\n", i, bp->addr, bp->hit, bp->ignore,
+        (bp->has_cond ? bp->cond_str : ""));
+  }
+}
@@ -1,429 +1,702 @@
 #include "nemu.h"
-#include "utils.h"
-/* We use the POSIX regex functions to process regular expressions.
- * Type 'man regex' for more information about POSIX regex functions.
+#include "monitor/expr.h"
+#include "monitor/symbol.h"
+#include <ctype.h>
+#include <stdlib.h>
+
+/* The lexer scans the expression once from left to right, and the parser
+ * pulls tokens from it and builds the AST by precedence climbing.
  */
-#include <sys/types.h>
-#include <regex.h>
 
 enum
 {
-  TK_NOTYPE = 256,
-  TK_LEFT_PARENTHESES,
-  TK_RIGHT_PARENTHESES,
-  TK_DREF,
-  TK_NEG,
-  TK_NOT,
-  TK_MUL,
-  TK_DIV,
-  TK_PLUS,
-  TK_SUB,
+  TK_END = 256,
+  TK_NUM,
+  TK_REG,
+  TK_SYM,
+  TK_SHL,
+  TK_SHR,
+  TK_LE,
+  TK_GE,
   TK_EQ,
-  TK_NOT_EQ,
+  TK_NE,
   TK_AND,
   TK_OR,
-  TK_NUMBER,
-  TK_HEX,
-  TK_REG
+  TK_NEG,
+  TK_DEREF,
+
+  /* only in bytecode */
+  OP_JZ_KEEP,  // if top == 0 jump, else pop
+  OP_JNZ_KEEP, // if top != 0 set top = 1 and jump, else pop
+  OP_JZ,       // pop, jump if it is 0
+  OP_JMP,
+  OP_BOOL,
 };
 
-static struct rule
+enum
 {
-  char *regex;
-  int token_type;
-} rules[] = {
-
-    /* TODO: Add more rules.
-   * Pay attention to the precedence level of different rules.
-   */
-    {"\\$[a-zA-Z]+", TK_REG},      // register name
-    {"0x[0-9A-Za-z]+", TK_HEX},    // hex
-    {"[0-9]+", TK_NUMBER},         // number
-    {" +", TK_NOTYPE},             // spaces
-    {"\\+", TK_PLUS},              // plus
-    {"-", TK_SUB},                 // sub
-    {"\\*", TK_MUL},               // mul or deference
-    {"/", TK_DIV},                 // div
-    {"\\(", TK_LEFT_PARENTHESES},  // left parentheses
-    {"\\)", TK_RIGHT_PARENTHESES}, // right parentheses
-    {"==", TK_EQ},                 // equal
-    {"!=", TK_NOT_EQ},             // not equal
-    {"&&", TK_AND},                // and
-    {"\\|\\|", TK_OR},             // or
-    {"!", TK_NOT}                  // not
+  EXPR_NUM,
+  EXPR_REG,
+  EXPR_UNARY,
+  EXPR_BINARY,
+  EXPR_COND
 };
-#define NR_REGEX (sizeof(rules) / sizeof(rules[0]))
-static regex_t re[NR_REGEX];
 
-/* Rules are used for many times.
- * Therefore we compile them only once before any usage.
- */
-void init_regex()
+typedef struct
 {
-  int i;
-  char error_msg[128];
-  int ret;
+  char *str;
+  char *p;
+  char *tok_start;
+  int type;
+  uint64_t val;
+  char name[64];
+} Lexer;
 
-  for (i = 0; i < NR_REGEX; i++)
-  {
-    ret = regcomp(&re[i], rules[i].regex, REG_EXTENDED);
-    if (ret != 0)
-    {
-      regerror(ret, &re[i], error_msg, 128);
-      panic("regex compilation failed: %s\n%s", error_msg, rules[i].regex);
-    }
-  }
-}
+/* A register operand is encoded as (width << 4) | index,
+ * where the index of eip is EXPR_REG_EIP. */
+#define REG_ENCODE(index, width) (((width) << 4) | (index))
+#define REG_INDEX(r) ((r) & 0xf)
+#define REG_WIDTH(r) ((r) >> 4)
 
-typedef struct token
-{
-  int type;
-  char str[32];
-} Token;
-
-Token tokens[32];
-int nr_token;
-char token_strs[TK_OR - TK_NOTYPE + 1][10] = {
-    " ", "(", ")", " [*] ", " [-] ", "!", "*", "/", "+",
-    "-", "==", "!=", "&&", "||"};
-static char *get_token_str(int token_type)
+static void syntax_error(Lexer *l, const char *msg)
 {
-  int index = token_type - TK_NOTYPE;
-
-  return token_strs[index];
+  printf("%s at position %d\n%s\n%*.s^\n", msg, (int)(l->tok_start - l->str),
+         l->str, (int)(l->tok_start - l->str), "");
 }
 
-static bool make_token(char *e)
+static bool lookup_register(const char *name, uint64_t *r)
 {
-  int position = 0;
   int i;
-  regmatch_t pmatch;
-
-  nr_token = 0;
-
-  while (e[position] != '\0')
+  if (strcmp(name, "eip") == 0)
   {
-    /* Try all rules one by one. */
-    for (i = 0; i < NR_REGEX; i++)
+    *r = REG_ENCODE(EXPR_REG_EIP, 4);
+    return true;
+  }
+  for (i = R_EAX; i <= R_EDI; i++)
+  {
+    if (strcmp(regsl[i], name) == 0)
     {
-      if (regexec(&re[i], e + position, 1, &pmatch, 0) == 0 && pmatch.rm_so == 0)
-      {
-        char *substr_start = e + position;
-        int substr_len = pmatch.rm_eo;
-
-        // Log("match rules[%d] = \"%s\" at position %d with len %d: %.*s",
-        //     i, rules[i].regex, position, substr_len, substr_len, substr_start);
-        position += substr_len;
-
-        /* TODO: Now a new token is recognized with rules[i]. Add codes
-         * to record the token in the array `tokens'. For certain types
-         * of tokens, some extra actions should be performed.
-         */
-        Token new_token;
-        memset(new_token.str, 0, sizeof(new_token.str));
-        int new_token_type = rules[i].token_type;
-        // save token type
-        if (new_token_type >= TK_NOTYPE && new_token_type <= TK_REG)
-        {
-          new_token.type = new_token_type;
-        }
-        // save token value
-        switch (new_token_type)
-        {
-        case TK_REG:
-          strncpy(new_token.str, substr_start + 1, substr_len - 1);
-          break;
-        case TK_NUMBER:
-          strncpy(new_token.str, substr_start, substr_len);
-          break;
-        case TK_HEX:
-          strncpy(new_token.str, substr_start + 2, substr_len - 2);
-          break;
-        // fix token type
-        case TK_SUB:
-          if (nr_token == 0 || (tokens[nr_token - 1].type >= TK_NEG && tokens[nr_token - 1].type <= TK_OR))
-          {
-            new_token.type = TK_NEG;
-          }
-          break;
-        case TK_MUL:
-          if (nr_token == 0 || (tokens[nr_token - 1].type >= TK_DREF && tokens[nr_token - 1].type <= TK_OR))
-          {
-            new_token.type = TK_DREF;
-          }
-          break;
-        default:
-          break;
-        }
-        if (new_token.type == TK_NOTYPE)
-          break;
-        tokens[nr_token] = new_token;
-        nr_token++;
-
-        break;
-      }
+      *r = REG_ENCODE(i, 4);
+      return true;
     }
-
-    if (i == NR_REGEX)
+    if (strcmp(regsw[i], name) == 0)
     {
-      printf("no match at position %d\n%s\n%*.s^\n", position, e, position, "");
-      return false;
+      *r = REG_ENCODE(i, 2);
+      return true;
+    }
+    if (strcmp(regsb[i], name) == 0)
+    {
+      *r = REG_ENCODE(i, 1);
+      return true;
     }
   }
+  return false;
+}
 
+static bool lookup_symbol(const char *name, uint64_t *val)
+{
+  vaddr_t addr;
+  if (!symbol_lookup(name, &addr))
+  {
+    return false;
+  }
+  *val = addr;
   return true;
 }
 
-int check_parentheses(int p, int q)
+static bool next_token(Lexer *l)
 {
-  int stack = 0;
-  bool has_parentheses = false;
-  for (int i = p; i <= q; i++)
+  char *p = l->p;
+  while (isspace((unsigned char)*p))
+    p++;
+  l->tok_start = p;
+
+  if (*p == '\0')
   {
-    if (tokens[i].type == TK_LEFT_PARENTHESES)
-    {
-      has_parentheses = true;
-      stack++;
-    }
-    if (tokens[i].type == TK_RIGHT_PARENTHESES)
+    l->type = TK_END;
+    l->p = p;
+    return true;
+  }
+
+  if (isdigit((unsigned char)*p))
+  {
+    char *end;
+    l->type = TK_NUM;
+    /* decimal unless it starts with 0x, `010' is ten and not eight */
+    bool hex = (p[0] == '0' && (p[1] == 'x' || p[1] == 'X'));
+    l->val = strtoull(p, &end, (hex ? 16 : 10));
+    while (*end == 'u' || *end == 'U' || *end == 'l' || *end == 'L')
+      end++;
+    if (isalnum((unsigned char)*end) || *end == '_')
     {
-      has_parentheses = true;
-      stack--;
+      syntax_error(l, "bad number");
+      return false;
     }
-    // too many right parentheses
-    if (stack < 0)
+    l->p = end;
+    return true;
+  }
+
+  if (*p == '$' || isalpha((unsigned char)*p) || *p == '_')
+  {
+    char *start = (*p == '$' ? p + 1 : p);
+    char *end = start;
+    while (isalnum((unsigned char)*end) || *end == '_')
+      end++;
+    int len = end - start;
+    if (len == 0 || len >= sizeof(l->name))
     {
+      syntax_error(l, "bad name");
       return false;
     }
+    memcpy(l->name, start, len);
+    l->name[len] = '\0';
+    l->type = (*p == '$' ? TK_REG : TK_SYM);
+    l->p = end;
+    return true;
   }
-  if (has_parentheses)
+
+  static const struct
+  {
+    char str[3];
+    int type;
+  } ops2[] = {
+      {"<<", TK_SHL}, {">>", TK_SHR}, {"<=", TK_LE}, {">=", TK_GE},
+      {"==", TK_EQ}, {"!=", TK_NE}, {"&&", TK_AND}, {"||", TK_OR}};
+  int i;
+  for (i = 0; i < sizeof(ops2) / sizeof(ops2[0]); i++)
   {
-    // too many left parentheses
-    if (stack != 0)
+    if (p[0] == ops2[i].str[0] && p[1] == ops2[i].str[1])
     {
-      return false;
+      l->type = ops2[i].type;
+      l->p = p + 2;
+      return true;
     }
-    return tokens[p].type == TK_LEFT_PARENTHESES && tokens[q].type == TK_RIGHT_PARENTHESES && (p != 0 || q != nr_token - 1);
   }
 
-  return -1;
+  if (strchr("+-*/%&|^~!<>()?:", *p) != NULL)
+  {
+    l->type = *p;
+    l->p = p + 1;
+    return true;
+  }
+
+  syntax_error(l, "unknown character");
+  return false;
 }
 
-static int op_priority[TK_OR - TK_LEFT_PARENTHESES + 1] = {
-    0, 0, 1, 1, 1, 2, 2, 3, 3, 4, 4, 5, 6};
+static int new_node(Expr *e, Lexer *l, int type, int op)
+{
+  if (e->nr_node == EXPR_NODE_MAX)
+  {
+    syntax_error(l, "expression too long");
+    return -1;
+  }
+  ExprNode *n = &e->node[e->nr_node];
+  memset(n, 0, sizeof(*n));
+  n->type = type;
+  n->op = op;
+  return e->nr_node++;
+}
 
-int get_op_priority(int token_type)
+/* binding power of binary operators, 0 if the token is not one */
+static int binary_prec(int type)
 {
-  // * (dereference) - (negative) !(not)
-  // * /
-  // + -
-  // == !=
-  // &&
-  // ||
-  return op_priority[token_type - TK_LEFT_PARENTHESES];
+  switch (type)
+  {
+  case '?': return 1;
+  case TK_OR: return 2;
+  case TK_AND: return 3;
+  case '|': return 4;
+  case '^': return 5;
+  case '&': return 6;
+  case TK_EQ: case TK_NE: return 7;
+  case '<': case '>': case TK_LE: case TK_GE: return 8;
+  case TK_SHL: case TK_SHR: return 9;
+  case '+': case '-': return 10;
+  case '*': case '/': case '%': return 11;
+  default: return 0;
+  }
 }
 
-int find_dominant_op(int p, int q)
+static int parse(Expr *e, Lexer *l, int min_prec);
+
+static int parse_primary(Expr *e, Lexer *l)
 {
-  int parentheses = 0;
-  int dominant_op = -1;
-  for (int i = q; i >= p; i--)
+  int n, type = l->type;
+  switch (type)
   {
-    int token_type = tokens[i].type;
-    if (token_type == TK_RIGHT_PARENTHESES)
+  case TK_NUM:
+    if ((n = new_node(e, l, EXPR_NUM, 0)) < 0)
+      return -1;
+    e->node[n].val = l->val;
+    return next_token(l) ? n : -1;
+
+  case TK_REG:
+    if ((n = new_node(e, l, EXPR_REG, 0)) < 0)
+      return -1;
+    if (!lookup_register(l->name, &e->node[n].val))
     {
-      parentheses++;
-      continue;
+      syntax_error(l, "unknown register");
+      return -1;
     }
-    if (token_type == TK_LEFT_PARENTHESES)
+    return next_token(l) ? n : -1;
+
+  case TK_SYM:
+    if ((n = new_node(e, l, EXPR_NUM, 0)) < 0)
+      return -1;
+    if (!lookup_symbol(l->name, &e->node[n].val))
     {
-      parentheses--;
-      continue;
+      syntax_error(l, "unknown symbol");
+      return -1;
     }
-    // in parenthese
-    if (parentheses != 0)
-      continue;
-    if (!(token_type >= TK_LEFT_PARENTHESES && token_type <= TK_OR))
-      continue;
-    // set default
-    if (dominant_op == -1)
-      dominant_op = i;
-    int priority_new = get_op_priority(token_type);
-    int priority_old = get_op_priority(tokens[dominant_op].type);
-
-    if (priority_new > priority_old)
+    return next_token(l) ? n : -1;
+
+  case '(':
+    if (!next_token(l) || (n = parse(e, l, 1)) < 0)
+      return -1;
+    if (l->type != ')')
     {
-      dominant_op = i;
+      syntax_error(l, "expect ')'");
+      return -1;
     }
-    // support unary operator
-    if ((token_type == tokens[dominant_op].type) && token_type >= TK_DREF && token_type <= TK_NOT)
+    return next_token(l) ? n : -1;
+
+  case '-': case '*': case '!': case '~': case '+':
+    if (!next_token(l))
+      return -1;
+    int operand = parse_primary(e, l);
+    if (operand < 0 || type == '+')
+      return operand;
+    int op = (type == '-' ? TK_NEG : type == '*' ? TK_DEREF : type);
+    if ((n = new_node(e, l, EXPR_UNARY, op)) < 0)
+      return -1;
+    e->node[n].lhs = operand;
+    return n;
+
+  default:
+    syntax_error(l, "expect an operand");
+    return -1;
+  }
+}
+
+static int parse(Expr *e, Lexer *l, int min_prec)
+{
+  int lhs = parse_primary(e, l);
+  if (lhs < 0)
+    return -1;
+
+  int prec;
+  while ((prec = binary_prec(l->type)) >= min_prec && prec > 0)
+  {
+    int op = l->type;
+    int n;
+    if (!next_token(l))
+      return -1;
+
+    if (op == '?')
+    {
+      // right associative, and the middle operand is parsed as if parenthesized
+      int t, f;
+      if ((t = parse(e, l, 1)) < 0)
+        return -1;
+      if (l->type != ':')
+      {
+        syntax_error(l, "expect ':'");
+        return -1;
+      }
+      if (!next_token(l) || (f = parse(e, l, prec)) < 0)
+        return -1;
+      if ((n = new_node(e, l, EXPR_COND, op)) < 0)
+        return -1;
+      e->node[n].cond = lhs;
+      e->node[n].lhs = t;
+      e->node[n].rhs = f;
+    }
+    else
     {
-      dominant_op = i;
+      int rhs = parse(e, l, prec + 1);
+      if (rhs < 0 || (n = new_node(e, l, EXPR_BINARY, op)) < 0)
+        return -1;
+      e->node[n].lhs = lhs;
+      e->node[n].rhs = rhs;
     }
+    lhs = n;
   }
-  return dominant_op;
+  return lhs;
 }
 
+static bool parse_expr(char *str, Expr *e)
+{
+  Lexer l = {.str = str, .p = str};
+  e->nr_node = 0;
+  if (!next_token(&l))
+    return false;
+  e->root = parse(e, &l, 1);
+  if (e->root < 0)
+    return false;
+  if (l.type != TK_END)
+  {
+    syntax_error(&l, "unexpected token");
+    return false;
+  }
+  return true;
+}
 
+#define EXPR_CACHE_SIZE 16
+#define EXPR_CACHE_STR_LEN 128
 
-uint32_t register_val(char *str, bool *find)
+static struct
 {
-  if(strcmp(str,"eip")==0){
-    *find=true;
-    return cpu.eip;
+  char str[EXPR_CACHE_STR_LEN];
+  uint32_t last_use;
+  Expr e;
+} expr_cache[EXPR_CACHE_SIZE];
+static uint32_t expr_cache_clock = 0;
+
+/* Return the AST of `str', or NULL if it has a syntax error.
+ * The AST stays valid until the next call. */
+const Expr *expr_parse(char *str)
+{
+  static Expr uncached;
+  int i, victim = 0;
+
+  while (isspace((unsigned char)*str))
+    str++;
+  if (strlen(str) >= EXPR_CACHE_STR_LEN)
+  {
+    return parse_expr(str, &uncached) ? &uncached : NULL;
   }
-  int i;
-  for (i = R_EAX; i <= R_EDI; i++)
+
+  expr_cache_clock++;
+  for (i = 0; i < EXPR_CACHE_SIZE; i++)
   {
-    // Log("%u",reg_l(i));
-    if (strcmp(regsl[i], str) == 0)
+    if (expr_cache[i].last_use != 0 && strcmp(expr_cache[i].str, str) == 0)
     {
-      *find = true;
-      return reg_l(i);
+      expr_cache[i].last_use = expr_cache_clock;
+      return &expr_cache[i].e;
     }
+    if (expr_cache[i].last_use < expr_cache[victim].last_use)
+      victim = i;
+  }
+
+  if (!parse_expr(str, &expr_cache[victim].e))
+  {
+    expr_cache[victim].last_use = 0;
+    return NULL;
   }
-  return 0;
+  strcpy(expr_cache[victim].str, str);
+  expr_cache[victim].last_use = expr_cache_clock;
+  return &expr_cache[victim].e;
 }
 
-void show_eval_expr(int p, int q)
+/* Evaluation */
+
+uint32_t expr_reg_val(int index)
+{
+  return (index == EXPR_REG_EIP ? cpu.eip : reg_l(index));
+}
+
+static uint64_t reg_val(uint64_t r)
 {
-  Log("eval: ");
-  for (int i = p; i <= q; i++)
+  int index = REG_INDEX(r);
+  switch (REG_WIDTH(r))
   {
-    Log(" ");
-    int token_type = tokens[i].type;
-    switch (token_type)
-    {
-    case TK_NUMBER:
-      Log("%s", tokens[i].str);
-      break;
-    case TK_HEX:
-      Log("0x%s", tokens[i].str);
-      break;
-    case TK_REG:
-      Log("$%s", tokens[i].str);
-      break;
-    default:
-      Log("%s", get_token_str(tokens[i].type));
-      break;
-    }
+  case 2: return reg_w(index);
+  case 1: return reg_b(index);
+  default: return expr_reg_val(index);
   }
-  Log("\n");
 }
-bool eval_ok = true;
-uint32_t eval(int p, int q)
+
+static bool deref(uint64_t addr, uint64_t *val)
 {
-  if (!eval_ok)
-    return 0;
+  if (addr > PMEM_SIZE - 4)
+  {
+    printf("cannot access memory at address 0x%" PRIx64 "\n", addr);
+    return false;
+  }
+  /* the debugger reads are not counted as accesses of the guest */
+  *val = paddr_read(addr, 4);
+  return true;
+}
 
-  if (p > q)
+static bool unary_op(int op, uint64_t *val)
+{
+  switch (op)
   {
-    // bad expression
-    printf("eval failed bad expression\n");
-    eval_ok = false;
-    return 0;
+  case TK_NEG: *val = -*val; return true;
+  case '!': *val = !*val; return true;
+  case '~': *val = ~*val; return true;
+  case TK_DEREF: return deref(*val, val);
+  default: assert(0);
+  }
+}
+
+static bool binary_op(int op, uint64_t *val1, uint64_t val2)
+{
+  uint64_t a = *val1, b = val2;
+  switch (op)
+  {
+  case '+': a = a + b; break;
+  case '-': a = a - b; break;
+  case '*': a = a * b; break;
+  case '/':
+  case '%':
+    if (b == 0)
+    {
+      printf("division by zero\n");
+      return false;
+    }
+    a = (op == '/' ? a / b : a % b);
+    break;
+  case TK_SHL: a = (b >= 64 ? 0 : a << b); break;
+  case TK_SHR: a = (b >= 64 ? 0 : a >> b); break;
+  case '<': a = a < b; break;
+  case '>': a = a > b; break;
+  case TK_LE: a = a <= b; break;
+  case TK_GE: a = a >= b; break;
+  case TK_EQ: a = a == b; break;
+  case TK_NE: a = a != b; break;
+  case '&': a = a & b; break;
+  case '^': a = a ^ b; break;
+  case '|': a = a | b; break;
+  default: assert(0);
   }
-  else if (p == q)
+  *val1 = a;
+  return true;
+}
+
+static bool eval(const Expr *e, int n, uint64_t *val)
+{
+  const ExprNode *node = &e->node[n];
+  uint64_t val2;
+  switch (node->type)
   {
-    bool register_exist;
-    uint32_t rval = 0;
-    switch (tokens[p].type)
+  case EXPR_NUM:
+    *val = node->val;
+    return true;
+  case EXPR_REG:
+    *val = reg_val(node->val);
+    return true;
+  case EXPR_UNARY:
+    return eval(e, node->lhs, val) && unary_op(node->op, val);
+  case EXPR_COND:
+    if (!eval(e, node->cond, val))
+      return false;
+    return eval(e, (*val ? node->lhs : node->rhs), val);
+  case EXPR_BINARY:
+    if (!eval(e, node->lhs, val))
+      return false;
+    if (node->op == TK_AND || node->op == TK_OR)
     {
-    case TK_NUMBER:
-      return str2uint32(tokens[p].str);
-    case TK_HEX:
-      return str2uint32_hex(tokens[p].str);
-    case TK_REG:
-      register_exist = false;
-      rval = register_val(tokens[p].str, &register_exist);
-      if (!register_exist)
+      // short circuit
+      if ((node->op == TK_AND) == (*val == 0))
       {
-        printf("eval failed register $%s is not exist\n", tokens[p].str);
-        eval_ok = false;
-        return 0;
+        *val = (node->op == TK_OR);
+        return true;
       }
-      return rval;
-    default:
-      assert(0);
-      return 0;
+      if (!eval(e, node->rhs, val))
+        return false;
+      *val = (*val != 0);
+      return true;
     }
+    return eval(e, node->rhs, &val2) && binary_op(node->op, val, val2);
+  default:
+    assert(0);
   }
-  else if (check_parentheses(p, q) == true)
+}
+
+uint64_t expr_eval(const Expr *e, bool *success)
+{
+  uint64_t val = 0;
+  *success = eval(e, e->root, &val);
+  return val;
+}
+
+uint64_t expr(char *str, bool *success)
+{
+  const Expr *e = expr_parse(str);
+  if (e == NULL)
   {
-    return eval(p + 1, q - 1);
+    *success = false;
+    return 0;
   }
-  else
+  return expr_eval(e, success);
+}
+
+/* Bytecode */
+
+static void emit(ExprCode *code, int op, uint64_t imm)
+{
+  assert(code->len < EXPR_CODE_MAX);
+  code->insn[code->len].op = op;
+  code->insn[code->len].imm = imm;
+  code->len++;
+}
+
+/* Whether the value of node `n' is known without reading the machine. */
+static bool is_const(const Expr *e, int n)
+{
+  const ExprNode *node = &e->node[n];
+  switch (node->type)
+  {
+  case EXPR_NUM: return true;
+  case EXPR_REG: return false;
+  case EXPR_UNARY: return node->op != TK_DEREF && is_const(e, node->lhs);
+  case EXPR_COND: return is_const(e, node->cond) && is_const(e, node->lhs) && is_const(e, node->rhs);
+  case EXPR_BINARY: return is_const(e, node->lhs) && is_const(e, node->rhs);
+  default: assert(0);
+  }
+}
+
+static void compile(const Expr *e, int n, ExprCode *code)
+{
+  const ExprNode *node = &e->node[n];
+  int jump, jump2;
+  switch (node->type)
   {
-    int dominant_op = find_dominant_op(p, q);
-    if (dominant_op == -1)
+  case EXPR_NUM:
+    emit(code, TK_NUM, node->val);
+    break;
+  case EXPR_REG:
+    emit(code, TK_REG, node->val);
+    code->reg_mask |= 1u << REG_INDEX(node->val);
+    break;
+  case EXPR_UNARY:
+    compile(e, node->lhs, code);
+    emit(code, node->op, 0);
+    if (node->op == TK_DEREF)
     {
-      printf("eval failed bad expression\n");
-      eval_ok = false;
-      return 0;
+      uint64_t addr;
+      code->has_deref = true;
+      if (code->nr_deref < EXPR_DEREF_MAX && is_const(e, node->lhs) && eval(e, node->lhs, &addr))
+        code->deref_addr[code->nr_deref++] = addr;
+      else
+        code->deref_dynamic = true;
     }
-    // Log("dominant_op :%s\n",get_token_str(tokens[dominant_op].type));
-    int op_type = tokens[dominant_op].type;
-    uint32_t val1 = 0, val2 = 0;
-    if (op_type >= TK_DREF && op_type <= TK_NOT)
+    break;
+  case EXPR_COND:
+    compile(e, node->cond, code);
+    jump = code->len;
+    emit(code, OP_JZ, 0);
+    compile(e, node->lhs, code);
+    jump2 = code->len;
+    emit(code, OP_JMP, 0);
+    code->insn[jump].imm = code->len;
+    compile(e, node->rhs, code);
+    code->insn[jump2].imm = code->len;
+    break;
+  case EXPR_BINARY:
+    compile(e, node->lhs, code);
+    if (node->op == TK_AND || node->op == TK_OR)
     {
-      val1 = eval(dominant_op + 1, q);
+      jump = code->len;
+      emit(code, (node->op == TK_AND ? OP_JZ_KEEP : OP_JNZ_KEEP), 0);
+      compile(e, node->rhs, code);
+      emit(code, OP_BOOL, 0);
+      code->insn[jump].imm = code->len;
     }
     else
     {
-      val1 = eval(p, dominant_op - 1);
-      val2 = eval(dominant_op + 1, q);
+      compile(e, node->rhs, code);
+      emit(code, node->op, 0);
     }
+    break;
+  default:
+    assert(0);
+  }
+}
 
-    switch (op_type)
+bool expr_compile(char *str, ExprCode *code)
+{
+  const Expr *e = expr_parse(str);
+  if (e == NULL)
+  {
+    return false;
+  }
+  code->len = 0;
+  code->reg_mask = 0;
+  code->has_deref = false;
+  code->deref_dynamic = false;
+  code->nr_deref = 0;
+  compile(e, e->root, code);
+  return true;
+}
+
+uint64_t expr_run(const ExprCode *code, bool *success)
+{
+  uint64_t stack[EXPR_CODE_MAX];
+  int sp = 0;
+  int pc = 0;
+  *success = false;
+  while (pc < code->len)
+  {
+    const ExprInsn *insn = &code->insn[pc++];
+    switch (insn->op)
     {
-    case TK_AND:
-      return val1 && val2;
-    case TK_OR:
-      return val1 || val2;
-    case TK_EQ:
-      return val1 == val2;
-    case TK_NOT_EQ:
-      return val1 != val2;
-    case TK_PLUS:
-      return val1 + val2;
-    case TK_SUB:
-      return val1 - val2;
-    case TK_MUL:
-      return val1 * val2;
-    case TK_DIV:
-      if (val2 == 0)
-      {
-        printf("eval failed : the denominator can't be zero\n");
-        eval_ok = false;
+    case TK_NUM:
+      stack[sp++] = insn->imm;
+      break;
+    case TK_REG:
+      stack[sp++] = reg_val(insn->imm);
+      break;
+    case TK_NEG: case '!': case '~': case TK_DEREF:
+      if (!unary_op(insn->op, &stack[sp - 1]))
         return 0;
+      break;
+    case OP_JZ_KEEP:
+      if (stack[sp - 1] == 0)
+        pc = insn->imm;
+      else
+        sp--;
+      break;
+    case OP_JNZ_KEEP:
+      if (stack[sp - 1] != 0)
+      {
+        stack[sp - 1] = 1;
+        pc = insn->imm;
       }
-      return val1 / val2;
-    case TK_NEG:
-      return -val1;
-    case TK_NOT:
-      return !val1;
-    case TK_DREF:
-      return vaddr_read(val1, 4);
+      else
+        sp--;
+      break;
+    case OP_JZ:
+      if (stack[--sp] == 0)
+        pc = insn->imm;
+      break;
+    case OP_JMP:
+      pc = insn->imm;
+      break;
+    case OP_BOOL:
+      stack[sp - 1] = (stack[sp - 1] != 0);
+      break;
     default:
-      assert(0);
+      sp--;
+      if (!binary_op(insn->op, &stack[sp - 1], stack[sp]))
+        return 0;
+      break;
     }
   }
-  return 0;
+  *success = true;
+  return stack[0];
 }
 
-uint32_t expr(char *e, bool *success)
+/* Check whether the expression is `*ADDR' where ADDR is a constant,
+ * and compute ADDR if so.
+ */
+bool expr_const_deref(const ExprCode *code, vaddr_t *addr)
 {
-  if (!make_token(e))
+  if (code->len < 2 || code->reg_mask != 0 || code->insn[code->len - 1].op != TK_DEREF)
   {
-    *success = false;
-    return 0;
+    return false;
+  }
+  ExprCode addr_code = *code;
+  addr_code.len--;
+  int i;
+  for (i = 0; i < addr_code.len; i++)
+  {
+    if (addr_code.insn[i].op == TK_DEREF)
+      return false;
   }
-  eval_ok = true;
-  uint32_t result = eval(0, nr_token - 1);
-  *success = eval_ok;
-  return result;
-
-  /* TODO: Insert codes to evaluate the expression. */
-  // TODO();
-  return 0;
+  bool success;
+  *addr = expr_run(&addr_code, &success);
+  return success;
 }
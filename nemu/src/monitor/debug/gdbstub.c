@@ -0,0 +1,390 @@
+#include "nemu.h"
+#include "monitor/monitor.h"
+#include "monitor/gdbstub.h"
+#include "monitor/breakpoint.h"
+#include "monitor/memwatch.h"
+#include "monitor/reverse.h"
+#include "../diff-test/protocol.h"
+#include <stdlib.h>
+
+/* The largest packet we accept, advertised in qSupported. gdb splits
+ * memory accesses by it, so `x/1000x' takes a single `m' packet. */
+#define PACKET_SIZE 0x4000
+#define MAX_MEM_LEN ((PACKET_SIZE - 32) / 2)
+
+/* Check for ^C once per this many instructions when continuing. */
+#define POLL_INTERVAL 100000
+
+#define NR_GDB_BP 64
+
+void cpu_exec(uint64_t);
+
+static struct gdb_conn *conn = NULL;
+static char out[PACKET_SIZE];
+
+/* The breakpoints and the write watchpoints inserted by gdb,
+ * with their numbers in the monitor. */
+static struct {
+  bool used;
+  bool is_watch;
+  vaddr_t addr;
+  int no;
+} gdb_bp[NR_GDB_BP];
+
+static const char target_xml[] =
+  "<?xml version=\"1.0\"?>"
+  "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+  "<target version=\"1.0\">"
+  "<architecture>i386</architecture>"
+  "<feature name=\"org.gnu.gdb.i386.core\">"
+  "<reg name=\"eax\" bitsize=\"32\" type=\"int32\"/>"
+  "<reg name=\"ecx\" bitsize=\"32\" type=\"int32\"/>"
+  "<reg name=\"edx\" bitsize=\"32\" type=\"int32\"/>"
+  "<reg name=\"ebx\" bitsize=\"32\" type=\"int32\"/>"
+  "<reg name=\"esp\" bitsize=\"32\" type=\"data_ptr\"/>"
+  "<reg name=\"ebp\" bitsize=\"32\" type=\"data_ptr\"/>"
+  "<reg name=\"esi\" bitsize=\"32\" type=\"int32\"/>"
+  "<reg name=\"edi\" bitsize=\"32\" type=\"int32\"/>"
+  "<reg name=\"eip\" bitsize=\"32\" type=\"code_ptr\"/>"
+  "<reg name=\"eflags\" bitsize=\"32\" type=\"int32\"/>"
+  "<reg name=\"cs\" bitsize=\"32\" type=\"int32\"/>"
+  "<reg name=\"ss\" bitsize=\"32\" type=\"int32\"/>"
+  "<reg name=\"ds\" bitsize=\"32\" type=\"int32\"/>"
+  "<reg name=\"es\" bitsize=\"32\" type=\"int32\"/>"
+  "<reg name=\"fs\" bitsize=\"32\" type=\"int32\"/>"
+  "<reg name=\"gs\" bitsize=\"32\" type=\"int32\"/>"
+  /* gdb requires the x87 registers in the core feature,
+   * NEMU does not have them and reads them as zero. */
+  "<reg name=\"st0\" bitsize=\"80\" type=\"i387_ext\"/>"
+  "<reg name=\"st1\" bitsize=\"80\" type=\"i387_ext\"/>"
+  "<reg name=\"st2\" bitsize=\"80\" type=\"i387_ext\"/>"
+  "<reg name=\"st3\" bitsize=\"80\" type=\"i387_ext\"/>"
+  "<reg name=\"st4\" bitsize=\"80\" type=\"i387_ext\"/>"
+  "<reg name=\"st5\" bitsize=\"80\" type=\"i387_ext\"/>"
+  "<reg name=\"st6\" bitsize=\"80\" type=\"i387_ext\"/>"
+  "<reg name=\"st7\" bitsize=\"80\" type=\"i387_ext\"/>"
+  "<reg name=\"fctrl\" bitsize=\"32\" type=\"int\" group=\"float\"/>"
+  "<reg name=\"fstat\" bitsize=\"32\" type=\"int\" group=\"float\"/>"
+  "<reg name=\"ftag\" bitsize=\"32\" type=\"int\" group=\"float\"/>"
+  "<reg name=\"fiseg\" bitsize=\"32\" type=\"int\" group=\"float\"/>"
+  "<reg name=\"fioff\" bitsize=\"32\" type=\"int\" group=\"float\"/>"
+  "<reg name=\"foseg\" bitsize=\"32\" type=\"int\" group=\"float\"/>"
+  "<reg name=\"fooff\" bitsize=\"32\" type=\"int\" group=\"float\"/>"
+  "<reg name=\"fop\" bitsize=\"32\" type=\"int\" group=\"float\"/>"
+  "</feature>"
+  "</target>";
+
+#define NR_GDB_REG 32
+#define NR_CPU_REG 10     /* eax - edi, eip and eflags */
+#define GDB_REG_BYTES (16 * 4 + 8 * 10 + 8 * 4)
+
+static int reg_size(int i) {
+  return (i >= 16 && i < 24 ? 10 : 4);
+}
+
+static uint32_t *cpu_reg(int i) {
+  if (i < 8) return &cpu.gpr[i]._32;
+  if (i == 8) return &cpu.eip;
+  return &cpu.eflags.val;
+}
+
+static char *put_hex(char *p, const uint8_t *buf, int len) {
+  int i;
+  for (i = 0; i < len; i ++) {
+    *p ++ = hex_encode(buf[i] >> 4);
+    *p ++ = hex_encode(buf[i] & 0xf);
+  }
+  *p = '\0';
+  return p;
+}
+
+/* Decode `len' bytes of hex, return false if there are not enough digits. */
+static bool get_hex(const char *p, uint8_t *buf, int len) {
+  int i;
+  for (i = 0; i < len; i ++) {
+    uint16_t b = gdb_decode_hex(p[2 * i], p[2 * i + 1]);
+    if (b == UINT16_MAX) return false;
+    buf[i] = b;
+  }
+  return true;
+}
+
+/* Return the value of register i in the target byte order. */
+static void read_reg(int i, uint8_t *buf) {
+  memset(buf, 0, reg_size(i));
+  if (i < NR_CPU_REG) { memcpy(buf, cpu_reg(i), 4); }
+}
+
+static void write_reg(int i, const uint8_t *buf) {
+  if (i < NR_CPU_REG) { memcpy(cpu_reg(i), buf, 4); }
+}
+
+/* Guest memory is accessed physically, and not counted by the
+ * performance counters. */
+static bool mem_valid(vaddr_t addr, uint32_t len) {
+  return addr < PMEM_SIZE && len <= PMEM_SIZE - addr;
+}
+
+static const char *cmd_read_mem(char *args) {
+  char *p;
+  vaddr_t addr = strtoul(args, &p, 16);
+  uint32_t len = strtoul(p + 1, NULL, 16);
+  if (len > MAX_MEM_LEN) { len = MAX_MEM_LEN; }
+  if (!mem_valid(addr, len)) return "E14";
+
+  put_hex(out, guest_to_host(addr), len);
+  return out;
+}
+
+static const char *cmd_write_mem(char *args) {
+  char *p;
+  vaddr_t addr = strtoul(args, &p, 16);
+  uint32_t len = strtoul(p + 1, &p, 16);
+  if (*p != ':' || !mem_valid(addr, len)) return "E14";
+
+  uint8_t *buf = malloc(len + 1);
+  assert(buf);
+  bool ok = get_hex(p + 1, buf, len);
+  if (ok) {
+    uint32_t i;
+    for (i = 0; i < len; i ++) {
+      paddr_write(addr + i, 1, buf[i]);
+    }
+  }
+  free(buf);
+  return (ok ? "OK" : "E22");
+}
+
+static const char *cmd_read_regs() {
+  uint8_t buf[GDB_REG_BYTES];
+  int i, off = 0;
+  for (i = 0; i < NR_GDB_REG; i ++) {
+    read_reg(i, buf + off);
+    off += reg_size(i);
+  }
+  put_hex(out, buf, off);
+  return out;
+}
+
+static const char *cmd_write_regs(char *args) {
+  uint8_t buf[GDB_REG_BYTES];
+  if (!get_hex(args, buf, NR_CPU_REG * 4)) return "E22";
+  int i;
+  for (i = 0; i < NR_CPU_REG; i ++) {
+    write_reg(i, buf + i * 4);
+  }
+  return "OK";
+}
+
+static const char *cmd_read_reg(char *args) {
+  int i = strtoul(args, NULL, 16);
+  if (i >= NR_GDB_REG) return "E22";
+  uint8_t buf[10];
+  read_reg(i, buf);
+  put_hex(out, buf, reg_size(i));
+  return out;
+}
+
+static const char *cmd_write_reg(char *args) {
+  char *p;
+  int i = strtoul(args, &p, 16);
+  uint8_t buf[10];
+  if (i >= NR_GDB_REG || *p != '=' || !get_hex(p + 1, buf, reg_size(i))) return "E22";
+  write_reg(i, buf);
+  return "OK";
+}
+
+/* Z0 and Z2 are mapped to the breakpoints and the memory watchpoints
+ * of the monitor, Z1 and Z3 are not supported. */
+static const char *cmd_breakpoint(char *args, bool insert) {
+  char *p;
+  int type = strtoul(args, &p, 16);
+  vaddr_t addr = strtoul(p + 1, &p, 16);
+  int kind = strtoul(p + 1, NULL, 16);
+  if (type != 0 && type != 2) return "";
+  bool is_watch = (type == 2);
+  if (is_watch && ((kind != 1 && kind != 2 && kind != 4) || !mem_valid(addr, kind))) return "E22";
+
+  int i;
+  for (i = 0; i < NR_GDB_BP; i ++) {
+    if (gdb_bp[i].used && gdb_bp[i].is_watch == is_watch && gdb_bp[i].addr == addr) break;
+  }
+
+  if (!insert) {
+    if (i == NR_GDB_BP) return "E22";
+    if (is_watch) { del_mw(gdb_bp[i].no); }
+    else { del_bp(gdb_bp[i].no); }
+    gdb_bp[i].used = false;
+    return "OK";
+  }
+
+  if (i != NR_GDB_BP) return "OK";
+  for (i = 0; i < NR_GDB_BP; i ++) {
+    if (!gdb_bp[i].used) break;
+  }
+  if (i == NR_GDB_BP) return "E28";
+
+  char *err = NULL;
+  int no;
+  if (is_watch) {
+    char expression[32];
+    snprintf(expression, sizeof(expression), "*0x%x", addr);
+    no = add_mw(expression, addr, kind, &err);
+  }
+  else {
+    no = add_bp(addr, NULL, &err);
+  }
+  if (err != NULL) return "E28";
+
+  gdb_bp[i].used = true;
+  gdb_bp[i].is_watch = is_watch;
+  gdb_bp[i].addr = addr;
+  gdb_bp[i].no = no;
+  return "OK";
+}
+
+/* The stop reply after the guest runs. */
+static const char *stop_reply(bool interrupted) {
+  vaddr_t addr;
+  if (nemu_state == NEMU_END) {
+    sprintf(out, "W%02x", cpu.eax & 0xff);
+  }
+  else if (memwatch_last_hit(&addr)) {
+    sprintf(out, "T05watch:%x;", addr);
+  }
+  else {
+    strcpy(out, (interrupted ? "S02" : "S05"));
+  }
+  return out;
+}
+
+static const char *cmd_continue() {
+  vaddr_t addr;
+  memwatch_last_hit(&addr);
+  while (nemu_state != NEMU_END) {
+    uint64_t n = nr_guest_instr;
+    cpu_exec(POLL_INTERVAL);
+
+    /* Stopped by a breakpoint or a watchpoint. A stop at the last
+     * instruction of the batch is told by the eip for a breakpoint, and
+     * by the pending hit for a watchpoint. */
+    if (nr_guest_instr - n < POLL_INTERVAL || bp_match(cpu.eip) || memwatch_hit_pending()) break;
+    if (gdb_poll_interrupt(conn)) return stop_reply(true);
+  }
+  return stop_reply(false);
+}
+
+static const char *cmd_step() {
+  vaddr_t addr;
+  memwatch_last_hit(&addr);
+  if (nemu_state != NEMU_END) { cpu_exec(1); }
+  return stop_reply(false);
+}
+
+static const char *cmd_query(char *args) {
+  if (strncmp(args, "Supported", 9) == 0) {
+    sprintf(out, "PacketSize=%x;qXfer:features:read+;QStartNoAckMode+%s", PACKET_SIZE,
+        (ckpt_enabled ? ";ReverseStep+;ReverseContinue+" : ""));
+    return out;
+  }
+  if (strcmp(args, "Attached") == 0) return "1";
+  if (strcmp(args, "C") == 0) return "QC1";
+  if (strcmp(args, "fThreadInfo") == 0) return "m1";
+  if (strcmp(args, "sThreadInfo") == 0) return "l";
+
+  const char *xfer = "Xfer:features:read:target.xml:";
+  if (strncmp(args, xfer, strlen(xfer)) == 0) {
+    char *p;
+    uint32_t off = strtoul(args + strlen(xfer), &p, 16);
+    uint32_t len = strtoul(p + 1, NULL, 16);
+    uint32_t size = sizeof(target_xml) - 1;
+    if (off > size) { off = size; }
+    if (len > size - off) { len = size - off; }
+    if (len > PACKET_SIZE - 2) { len = PACKET_SIZE - 2; }
+    out[0] = (off + len < size ? 'm' : 'l');
+    memcpy(out + 1, target_xml + off, len);
+    out[len + 1] = '\0';
+    return out;
+  }
+  return "";
+}
+
+static const char *handle(char *packet) {
+  char *args = packet + 1;
+  switch (packet[0]) {
+    case '?': return stop_reply(false);
+    case 'g': return cmd_read_regs();
+    case 'G': return cmd_write_regs(args);
+    case 'p': return cmd_read_reg(args);
+    case 'P': return cmd_write_reg(args);
+    case 'm': return cmd_read_mem(args);
+    case 'M': return cmd_write_mem(args);
+    case 'c': return cmd_continue();
+    case 's': return cmd_step();
+    case 'Z': return cmd_breakpoint(args, true);
+    case 'z': return cmd_breakpoint(args, false);
+    case 'H': return "OK";
+    case 'T': return "OK";
+    case 'q': return cmd_query(args);
+    case 'b':
+      if (!ckpt_enabled) return "E22";
+      if (args[0] == 's') { reverse_step(1); }
+      else if (args[0] == 'c') { reverse_continue(); }
+      else return "";
+      return stop_reply(false);
+    default: return "";
+  }
+}
+
+void gdbstub_mainloop() {
+  while (1) {
+    size_t size;
+    char *packet = (char *)gdb_recv(conn, &size);
+    const char *reply;
+
+    if (strcmp(packet, "QStartNoAckMode") == 0) {
+      gdb_send(conn, (const uint8_t *)"OK", 2);
+      gdb_set_noack(conn);
+      free(packet);
+      continue;
+    }
+    if (packet[0] == 'k') {
+      free(packet);
+      break;
+    }
+    if (packet[0] == 'D') {
+      /* Let the guest run to the end without the debugger. */
+      gdb_send(conn, (const uint8_t *)"OK", 2);
+      free(packet);
+      gdb_end(conn);
+      conn = NULL;
+      cpu_exec(-1);
+      return;
+    }
+
+    reply = handle(packet);
+    gdb_send(conn, (const uint8_t *)reply, strlen(reply));
+    free(packet);
+  }
+
+  gdb_end(conn);
+  conn = NULL;
+}
+
+bool gdbstub_attached() {
+  return conn != NULL;
+}
+
+void init_gdbstub(const char *addr) {
+  char *end;
+  unsigned long port = strtoul(addr, &end, 10);
+  if (*end == '\0' && port != 0 && port < 65536) {
+    Log("Waiting for gdb on localhost:%lu", port);
+    conn = gdb_accept_inet(port);
+  }
+  else {
+    Log("Waiting for gdb on %s", addr);
+    conn = gdb_accept_unix(addr);
+  }
+  Log("gdb is connected");
+}
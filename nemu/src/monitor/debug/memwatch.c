@@ -0,0 +1,195 @@
+#include "nemu.h"
+#include "monitor/memwatch.h"
+#include "monitor/watchpoint.h"
+
+#define NR_MW 512
+
+/* Memory watchpoints are numbered after the expression watchpoints,
+ * so that `d N' can tell them apart. */
+#define MW_NO(i) (NR_WP + (i))
+
+typedef struct {
+  bool used;
+  bool pending;   /* a store hit the range since the last check */
+  vaddr_t addr;
+  int len;        /* 1, 2 or 4 bytes */
+  uint32_t value;
+  int hit;
+  char expression[64];
+} MW;
+
+static MW mw_pool[NR_MW];
+
+bool mw_watching = false, mw_every_store = false;
+uint64_t mw_store_gen = 0;
+
+/* indices of the used entries, scanned when a store hits a watched page */
+static int mw_active[NR_MW];
+int nr_mw = 0;
+
+static bool mw_pending = false;
+
+/* the range of the last hit, reported to gdb */
+static bool mw_hit = false;
+static vaddr_t mw_hit_addr;
+
+/* one bit per page of the 32-bit address space */
+uint8_t mw_page_map[(1 << (32 - MW_PAGE_SHIFT)) / 8];
+
+static inline void mw_page_set(vaddr_t addr) {
+  uint32_t page = addr >> MW_PAGE_SHIFT;
+  mw_page_map[page >> 3] |= 1 << (page & 7);
+}
+
+static void mw_page_set_range(vaddr_t addr, int len) {
+  mw_page_set(addr);
+  mw_page_set(addr + len - 1);
+}
+
+/* Called when a watched range or an expression watchpoint is added or
+ * deleted. */
+void mw_rebuild_page_map() {
+  memset(mw_page_map, 0, sizeof(mw_page_map));
+  int i;
+  for (i = 0; i < nr_mw; i ++) {
+    mw_page_set_range(mw_pool[mw_active[i]].addr, mw_pool[mw_active[i]].len);
+  }
+  int nr_deref = wp_watch_derefs(mw_page_set_range);
+  mw_every_store = (nr_deref < 0);
+  mw_watching = (nr_mw != 0 || nr_deref != 0);
+}
+
+void mw_store(vaddr_t addr, int len) {
+  /* the stores of the other processors are counted as well */
+  __atomic_add_fetch(&mw_store_gen, 1, __ATOMIC_RELAXED);
+  int i;
+  for (i = 0; i < nr_mw; i ++) {
+    MW *mw = &mw_pool[mw_active[i]];
+    if (addr < mw->addr + mw->len && mw->addr < addr + len) {
+      mw->pending = true;
+      mw_pending = true;
+    }
+  }
+}
+
+int add_mw(char *expression, vaddr_t addr, int len, char **err) {
+  int i;
+  if (addr >= PMEM_SIZE || len > PMEM_SIZE - addr) {
+    *err = "address out of the physical memory";
+    return 0;
+  }
+  for (i = 0; i < NR_MW; i ++) {
+    if (!mw_pool[i].used) break;
+  }
+  if (i == NR_MW) {
+    *err = "too many memory watchpoints";
+    return 0;
+  }
+
+  MW *mw = &mw_pool[i];
+  mw->used = true;
+  mw->pending = false;
+  mw->addr = addr;
+  mw->len = len;
+  mw->value = paddr_read(addr, len);
+  mw->hit = 0;
+  snprintf(mw->expression, sizeof(mw->expression), "%s", expression);
+
+  mw_active[nr_mw ++] = i;
+  mw_rebuild_page_map();
+  return MW_NO(i);
+}
+
+bool del_mw(int no) {
+  int i;
+  for (i = 0; i < nr_mw; i ++) {
+    if (MW_NO(mw_active[i]) == no) {
+      mw_pool[mw_active[i]].used = false;
+      mw_active[i] = mw_active[-- nr_mw];
+      mw_rebuild_page_map();
+      return true;
+    }
+  }
+  return false;
+}
+
+void mw_check_dma(paddr_t addr, uint32_t len) {
+  if (!mw_watching || len == 0) return;
+  uint32_t page;
+  for (page = addr >> MW_PAGE_SHIFT; page <= (addr + len - 1) >> MW_PAGE_SHIFT; page ++) {
+    if (mw_every_store || mw_page_hit(page << MW_PAGE_SHIFT)) {
+      mw_store(addr, len);
+      return;
+    }
+  }
+}
+
+void show_memwatches() {
+  int i;
+  for (i = 0; i < nr_mw; i ++) {
+    MW *mw = &mw_pool[mw_active[i]];
+    printf("%d\t%s\t%d\t[0x%08x, 0x%08x)\n", MW_NO(mw_active[i]), mw->expression, mw->hit,
+        mw->addr, mw->addr + mw->len);
+  }
+}
+
+/* Re-read the ranges written since the last check. */
+bool check_memwatches() {
+  if (!mw_pending) return false;
+  mw_pending = false;
+
+  bool stop = false;
+  int i;
+  for (i = 0; i < nr_mw; i ++) {
+    MW *mw = &mw_pool[mw_active[i]];
+    if (!mw->pending) continue;
+    mw->pending = false;
+
+    /* paddr_read() is not counted as an access of the guest */
+    uint32_t new_value = paddr_read(mw->addr, mw->len);
+    if (new_value != mw->value) {
+      printf("hit watchpoint %d: %s\n", MW_NO(mw_active[i]), mw->expression);
+      printf("old value = 0x%08x \n", mw->value);
+      printf("new value = 0x%08x \n", new_value);
+      mw->value = new_value;
+      mw->hit ++;
+      mw_hit = true;
+      mw_hit_addr = mw->addr;
+      stop = true;
+    }
+  }
+  return stop;
+}
+
+/* Return true if a memory watchpoint was hit since the last call of
+ * memwatch_last_hit(), which is left to report it. */
+bool memwatch_hit_pending() {
+  return mw_hit;
+}
+
+/* Return true if a memory watchpoint was hit since the last call. */
+bool memwatch_last_hit(vaddr_t *addr) {
+  bool hit = mw_hit;
+  mw_hit = false;
+  *addr = mw_hit_addr;
+  return hit;
+}
+
+uint64_t memwatch_signature(uint64_t sig) {
+  int i;
+  for (i = 0; i < nr_mw; i ++) {
+    MW *mw = &mw_pool[mw_active[i]];
+    sig = (sig ^ paddr_read(mw->addr, mw->len)) * 0x100000001b3ull;
+  }
+  return sig;
+}
+
+void refresh_memwatches() {
+  int i;
+  for (i = 0; i < nr_mw; i ++) {
+    MW *mw = &mw_pool[mw_active[i]];
+    mw->value = paddr_read(mw->addr, mw->len);
+    mw->pending = false;
+  }
+  mw_pending = false;
+}
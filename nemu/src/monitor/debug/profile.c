@@ -0,0 +1,203 @@
+#include "nemu.h"
+#include "monitor/profile.h"
+#include "monitor/symbol.h"
+#include <stdlib.h>
+
+/* Each sample is the current eip followed by the return addresses found
+ * by walking the EBP chain, which works for code compiled with frame
+ * pointers. The addresses are mapped to functions, and the samples with
+ * the same stack of functions are counted together. At exit, the stacks
+ * are written in the folded format of flamegraph.pl, and a flat report
+ * of the hottest functions is printed.
+ */
+
+#define MAX_DEPTH 64
+#define TOP_N 20
+#define UNKNOWN_FUNC (-1)
+
+typedef struct {
+  uint32_t hash;
+  int depth;
+  int *funcs;   /* function of each frame, innermost first */
+  uint64_t count;
+} Stack;
+
+uint64_t prof_next_sample = UINT64_MAX;
+static uint64_t prof_period;
+static const char *prof_file;
+static uint64_t nr_sample = 0;
+
+/* an open-addressing hash table of the stacks seen */
+static Stack *stacks = NULL;
+static uint32_t stacks_size = 0, nr_stacks = 0;
+
+static inline bool in_pmem(vaddr_t addr, int len) {
+  return addr <= PMEM_SIZE - len;
+}
+
+static inline int func_of(vaddr_t addr) {
+  const Symbol *s = symbol_find(addr);
+  return (s == NULL ? UNKNOWN_FUNC : symbol_index(s));
+}
+
+static uint32_t hash_funcs(const int *funcs, int depth) {
+  uint32_t h = 2166136261u;
+  int i;
+  for (i = 0; i < depth; i ++) {
+    h = (h ^ (uint32_t)funcs[i]) * 16777619u;
+  }
+  return h;
+}
+
+static Stack *stack_slot(Stack *table, uint32_t size, uint32_t hash, const int *funcs, int depth) {
+  uint32_t i = hash & (size - 1);
+  while (table[i].funcs != NULL) {
+    if (table[i].hash == hash && table[i].depth == depth &&
+        memcmp(table[i].funcs, funcs, depth * sizeof(int)) == 0) {
+      break;
+    }
+    i = (i + 1) & (size - 1);
+  }
+  return &table[i];
+}
+
+static void stacks_grow() {
+  uint32_t new_size = (stacks_size == 0 ? 1024 : stacks_size * 2);
+  Stack *new_stacks = calloc(new_size, sizeof(Stack));
+  assert(new_stacks);
+  uint32_t i;
+  for (i = 0; i < stacks_size; i ++) {
+    Stack *s = &stacks[i];
+    if (s->funcs != NULL) {
+      *stack_slot(new_stacks, new_size, s->hash, s->funcs, s->depth) = *s;
+    }
+  }
+  free(stacks);
+  stacks = new_stacks;
+  stacks_size = new_size;
+}
+
+void profile_sample() {
+  prof_next_sample += prof_period;
+  nr_sample ++;
+
+  int funcs[MAX_DEPTH];
+  int depth = 0;
+  funcs[depth ++] = func_of(cpu.eip);
+
+  /* Read the frames from pmem directly, so that sampling does not touch
+   * devices or the guest performance counters. */
+  vaddr_t ebp = cpu.ebp;
+  while (depth < MAX_DEPTH && ebp != 0 && in_pmem(ebp, 8)) {
+    vaddr_t ret_addr = *(uint32_t *)guest_to_host(ebp + 4);
+    vaddr_t next_ebp = *(uint32_t *)guest_to_host(ebp);
+    funcs[depth ++] = func_of(ret_addr);
+    /* the stack grows down, so the frames of the callers are above */
+    if (next_ebp <= ebp) break;
+    ebp = next_ebp;
+  }
+
+  if ((nr_stacks + 1) * 2 > stacks_size) {
+    stacks_grow();
+  }
+  uint32_t hash = hash_funcs(funcs, depth);
+  Stack *s = stack_slot(stacks, stacks_size, hash, funcs, depth);
+  if (s->funcs == NULL) {
+    s->hash = hash;
+    s->depth = depth;
+    s->funcs = malloc(depth * sizeof(int));
+    assert(s->funcs);
+    memcpy(s->funcs, funcs, depth * sizeof(int));
+    nr_stacks ++;
+  }
+  s->count ++;
+}
+
+static const char *func_name(int f) {
+  return (f == UNKNOWN_FUNC ? "[unknown]" : symbol_at(f)->name);
+}
+
+static void write_folded() {
+  FILE *fp = fopen(prof_file, "w");
+  if (fp == NULL) {
+    Log("Can not open '%s'", prof_file);
+    return;
+  }
+  uint32_t i;
+  for (i = 0; i < stacks_size; i ++) {
+    Stack *s = &stacks[i];
+    if (s->funcs == NULL) continue;
+    int j;
+    for (j = s->depth - 1; j >= 0; j --) {
+      fprintf(fp, "%s%c", func_name(s->funcs[j]), (j == 0 ? ' ' : ';'));
+    }
+    fprintf(fp, "%" PRIu64 "\n", s->count);
+  }
+  fclose(fp);
+}
+
+static uint64_t *flat_self, *flat_total;
+
+static int cmp_self(const void *a, const void *b) {
+  uint64_t x = flat_self[*(const int *)a], y = flat_self[*(const int *)b];
+  return (x < y) - (x > y);
+}
+
+/* Functions are indexed from 1 in the flat report, 0 is [unknown]. */
+static void print_flat() {
+  int n = nr_symbols() + 1;
+  flat_self = calloc(n, sizeof(uint64_t));
+  flat_total = calloc(n, sizeof(uint64_t));
+  int *last_seen = calloc(n, sizeof(int));
+  int *order = malloc(n * sizeof(int));
+  assert(flat_self && flat_total && last_seen && order);
+
+  uint32_t i;
+  int j;
+  for (i = 0; i < stacks_size; i ++) {
+    Stack *s = &stacks[i];
+    if (s->funcs == NULL) continue;
+    flat_self[s->funcs[0] + 1] += s->count;
+    /* count a recursive function once per stack */
+    for (j = 0; j < s->depth; j ++) {
+      int f = s->funcs[j] + 1;
+      if (last_seen[f] != i + 1) {
+        last_seen[f] = i + 1;
+        flat_total[f] += s->count;
+      }
+    }
+  }
+
+  for (j = 0; j < n; j ++) order[j] = j;
+  qsort(order, n, sizeof(int), cmp_self);
+
+  printf("%" PRIu64 " samples, one every %" PRIu64 " instructions\n", nr_sample, prof_period);
+  printf("  self%%  total%%  function\n");
+  for (j = 0; j < n && j < TOP_N && flat_self[order[j]] != 0; j ++) {
+    int f = order[j];
+    printf("%6.2f  %6.2f  %s\n", 100.0 * flat_self[f] / nr_sample,
+        100.0 * flat_total[f] / nr_sample, func_name(f - 1));
+  }
+
+  free(flat_self);
+  free(flat_total);
+  free(last_seen);
+  free(order);
+}
+
+static void profile_report() {
+  if (nr_sample == 0) return;
+  write_folded();
+  print_flat();
+}
+
+void init_profile(const char *folded_file, uint64_t period) {
+  Assert(period != 0, "the sampling period can not be 0");
+  if (nr_symbols() == 0) {
+    Log("No guest symbols are loaded, all functions will be [unknown]");
+  }
+  prof_file = folded_file;
+  prof_period = period;
+  prof_next_sample = nr_guest_instr + period;
+  atexit(profile_report);
+}
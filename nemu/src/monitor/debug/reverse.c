@@ -0,0 +1,370 @@
+#include "nemu.h"
+#include "monitor/reverse.h"
+#include "monitor/watchpoint.h"
+#include "monitor/breakpoint.h"
+#include "cpu/intr.h"
+#include <stdlib.h>
+
+#define NR_PAGE (PMEM_SIZE >> CKPT_PAGE_SHIFT)
+#define NR_STATE 32
+#define MAX_CKPT 4096
+
+/* the old content of a guest page, or of a piece of device memory */
+typedef struct {
+  uint8_t *host;
+  uint32_t size;
+  uint8_t data[CKPT_PAGE_SIZE];
+} UndoPage;
+
+typedef struct {
+  uint64_t instr;
+  uint64_t input_pos;       /* position in the input log */
+  uint64_t intr_pos;        /* position in the interrupt log */
+  CPU_state regs;
+  uint64_t mem_read, mem_write;
+  uint8_t *state;           /* the registered device state */
+  UndoPage **undo;          /* old content of the pages written after the checkpoint */
+  int nr_undo, max_undo;
+} Checkpoint;
+
+bool ckpt_enabled = false;
+uint8_t ckpt_dirty[NR_PAGE / 8];
+uint64_t ckpt_next = UINT64_MAX;
+uint64_t ckpt_replay_end = 0;
+
+static uint64_t interval;
+static size_t budget;
+static size_t total_size;
+
+/* ordered by the instruction count, ckpts[0] is the oldest */
+static Checkpoint ckpts[MAX_CKPT];
+static int nr_ckpt = 0;
+
+static struct {
+  void *ptr;
+  size_t size;
+} state[NR_STATE];
+static int nr_state = 0;
+static size_t state_size = 0;
+
+/* The input log. input[0] is the entry at position `input_base'. */
+static uint32_t *input;
+static uint64_t input_base, input_pos, input_end;
+static size_t input_cap;
+
+/* The interrupt log, kept like the input log. The interrupts are taken
+ * between instructions at any time, so each one is logged with the
+ * instruction count it is taken after. */
+static struct {
+  uint64_t instr;
+  int line;
+} *intr_log;
+static uint64_t intr_base, intr_pos, intr_end;
+static size_t intr_cap;
+
+void ckpt_add_state(void *ptr, size_t size) {
+  assert(nr_state < NR_STATE);
+  state[nr_state].ptr = ptr;
+  state[nr_state].size = size;
+  nr_state ++;
+  state_size += size;
+}
+
+static void save_undo(uint8_t *host, uint32_t size) {
+  Checkpoint *c = &ckpts[nr_ckpt - 1];
+  if (c->nr_undo == c->max_undo) {
+    c->max_undo = (c->max_undo == 0 ? 64 : c->max_undo * 2);
+    c->undo = realloc(c->undo, c->max_undo * sizeof(c->undo[0]));
+    assert(c->undo);
+  }
+  UndoPage *u = malloc(sizeof(UndoPage));
+  assert(u);
+  u->host = host;
+  u->size = size;
+  memcpy(u->data, host, size);
+  c->undo[c->nr_undo ++] = u;
+  total_size += sizeof(UndoPage);
+}
+
+void ckpt_save_page(uint32_t page) {
+  if (page >= NR_PAGE) return;
+  ckpt_dirty[page >> 3] |= 1 << (page & 7);
+  save_undo(guest_to_host((page << CKPT_PAGE_SHIFT)), CKPT_PAGE_SIZE);
+}
+
+void ckpt_note_host_write(void *host, size_t len) {
+  if (!ckpt_enabled) return;
+  uint8_t *p = host;
+  while (len > 0) {
+    uint32_t size = (len < CKPT_PAGE_SIZE ? len : CKPT_PAGE_SIZE);
+    save_undo(p, size);
+    p += size;
+    len -= size;
+  }
+}
+
+void ckpt_log_input(uint32_t data) {
+  if (!ckpt_enabled) return;
+  if (input_pos - input_base == input_cap) {
+    input_cap = (input_cap == 0 ? 1024 : input_cap * 2);
+    input = realloc(input, input_cap * sizeof(input[0]));
+    assert(input);
+  }
+  input[input_pos - input_base] = data;
+  input_pos ++;
+  input_end = input_pos;
+}
+
+uint32_t ckpt_replay_input() {
+  Assert(input_pos < input_end, "the input log is exhausted at instruction %" PRIu64, nr_guest_instr);
+  return input[input_pos ++ - input_base];
+}
+
+void ckpt_log_intr(int line) {
+  if (!ckpt_enabled) return;
+  if (intr_pos - intr_base == intr_cap) {
+    intr_cap = (intr_cap == 0 ? 256 : intr_cap * 2);
+    intr_log = realloc(intr_log, intr_cap * sizeof(intr_log[0]));
+    assert(intr_log);
+  }
+  intr_log[intr_pos - intr_base].instr = nr_guest_instr;
+  intr_log[intr_pos - intr_base].line = line;
+  intr_pos ++;
+  intr_end = intr_pos;
+}
+
+void ckpt_replay_intr() {
+  while (intr_pos < intr_end && intr_log[intr_pos - intr_base].instr == nr_guest_instr) {
+    deliver_intr(intr_log[intr_pos ++ - intr_base].line);
+  }
+}
+
+static void free_undo(Checkpoint *c) {
+  int i;
+  for (i = 0; i < c->nr_undo; i ++) {
+    free(c->undo[i]);
+  }
+  total_size -= c->nr_undo * sizeof(UndoPage);
+  c->nr_undo = 0;
+}
+
+static void free_ckpt(Checkpoint *c) {
+  free_undo(c);
+  free(c->undo);
+  free(c->state);
+  c->undo = NULL;
+  c->max_undo = 0;
+  total_size -= sizeof(Checkpoint) + state_size;
+}
+
+/* Drop the oldest checkpoint and the inputs only it can replay. */
+static void evict_oldest() {
+  free_ckpt(&ckpts[0]);
+  nr_ckpt --;
+  memmove(ckpts, ckpts + 1, nr_ckpt * sizeof(ckpts[0]));
+
+  uint64_t n = ckpts[0].input_pos - input_base;
+  memmove(input, input + n, (input_end - ckpts[0].input_pos) * sizeof(input[0]));
+  input_base += n;
+
+  n = ckpts[0].intr_pos - intr_base;
+  memmove(intr_log, intr_log + n, (intr_end - ckpts[0].intr_pos) * sizeof(intr_log[0]));
+  intr_base += n;
+}
+
+void ckpt_take() {
+  if (nr_ckpt == MAX_CKPT) { evict_oldest(); }
+
+  Checkpoint *c = &ckpts[nr_ckpt ++];
+  c->instr = nr_guest_instr;
+  c->input_pos = input_pos;
+  c->intr_pos = intr_pos;
+  c->regs = cpu;
+  c->mem_read = nr_mem_read;
+  c->mem_write = nr_mem_write;
+  c->state = malloc(state_size);
+  assert(c->state);
+  uint8_t *p = c->state;
+  int i;
+  for (i = 0; i < nr_state; i ++) {
+    memcpy(p, state[i].ptr, state[i].size);
+    p += state[i].size;
+  }
+  c->undo = NULL;
+  c->nr_undo = c->max_undo = 0;
+  total_size += sizeof(Checkpoint) + state_size;
+
+  memset(ckpt_dirty, 0, sizeof(ckpt_dirty));
+  ckpt_next = nr_guest_instr + interval;
+
+  /* The undo log of the newest checkpoint is still growing,
+   * so the budget is enforced by the older ones. */
+  while (nr_ckpt > 1 && total_size + (input_end - input_base) * sizeof(input[0]) +
+      (intr_end - intr_base) * sizeof(intr_log[0]) > budget) {
+    evict_oldest();
+  }
+}
+
+/* Bring the machine back to checkpoint k. The newer checkpoints are dropped,
+ * they will be taken again by the replay. */
+static void restore(int k) {
+  if (nr_guest_instr > ckpt_replay_end) { ckpt_replay_end = nr_guest_instr; }
+
+  /* Undo from the newest log to the oldest, so a page written after
+   * several checkpoints ends up with its content at checkpoint k. */
+  int i, j;
+  for (i = nr_ckpt - 1; i >= k; i --) {
+    Checkpoint *c = &ckpts[i];
+    for (j = c->nr_undo - 1; j >= 0; j --) {
+      UndoPage *u = c->undo[j];
+      memcpy(u->host, u->data, u->size);
+    }
+    if (i > k) { free_ckpt(c); }
+  }
+  nr_ckpt = k + 1;
+
+  Checkpoint *c = &ckpts[k];
+  free_undo(c);
+  memset(ckpt_dirty, 0, sizeof(ckpt_dirty));
+
+  uint8_t *p = c->state;
+  for (i = 0; i < nr_state; i ++) {
+    memcpy(state[i].ptr, p, state[i].size);
+    p += state[i].size;
+  }
+  cpu = c->regs;
+  nr_mem_read = c->mem_read;
+  nr_mem_write = c->mem_write;
+  nr_guest_instr = c->instr;
+  input_pos = c->input_pos;
+  intr_pos = c->intr_pos;
+  /* The interrupts up to the end of the replay are in the log. The IDT
+   * decoded may be a newer one. */
+  nemu_ctx->intr_pending = 0;
+  nemu_ctx->idt_gen = 0;
+  ckpt_next = c->instr + interval;
+  nemu_state = NEMU_STOP;
+}
+
+/* the newest checkpoint not after `instr', or -1 if there is none */
+static int find_ckpt(uint64_t instr) {
+  int k;
+  for (k = nr_ckpt - 1; k >= 0; k --) {
+    if (ckpts[k].instr <= instr) break;
+  }
+  return k;
+}
+
+void exec_wrapper(bool);
+
+static inline void replay_step() {
+  exec_wrapper(false);
+  nr_guest_instr ++;
+  check_intr();
+  ckpt_check();
+}
+
+static void replay(uint64_t end) {
+  while (nr_guest_instr < end && nemu_state != NEMU_END) {
+    replay_step();
+  }
+}
+
+/* Replay to `end' and return the last instruction count at which a
+ * breakpoint or a watchpoint would have stopped the execution, or 0. */
+static uint64_t scan(uint64_t end, bool *is_bp) {
+  uint64_t last = 0;
+  uint64_t sig = watch_signature();
+  while (nr_guest_instr < end && nemu_state != NEMU_END) {
+    replay_step();
+    if (bp_match(cpu.eip)) {
+      last = nr_guest_instr;
+      *is_bp = true;
+    }
+    uint64_t s = watch_signature();
+    if (s != sig) {
+      last = nr_guest_instr;
+      *is_bp = false;
+      sig = s;
+    }
+  }
+  return last;
+}
+
+static void rewound() {
+  refresh_watchpoints();
+  nemu_state = NEMU_STOP;
+  nemu_note_stop();
+}
+
+void reverse_step(uint64_t n) {
+  if (!ckpt_enabled) {
+    printf("reverse execution is off, run NEMU with --checkpoint=N\n");
+    return;
+  }
+
+  uint64_t target = (nr_guest_instr > n ? nr_guest_instr - n : 0);
+  if (target < ckpts[0].instr) {
+    printf("the oldest checkpoint is at instruction %" PRIu64 "\n", ckpts[0].instr);
+    target = ckpts[0].instr;
+  }
+
+  restore(find_ckpt(target));
+  replay(target);
+  rewound();
+  printf("rewound to instruction %" PRIu64 ", eip = 0x%08x\n", nr_guest_instr, cpu.eip);
+}
+
+void reverse_continue() {
+  if (!ckpt_enabled) {
+    printf("reverse execution is off, run NEMU with --checkpoint=N\n");
+    return;
+  }
+
+  /* Scan the checkpoint intervals backward, each ending where the newer one starts. */
+  uint64_t end = nr_guest_instr;
+  int k = (end == 0 ? -1 : find_ckpt(end - 1));
+  if (k >= 0) { end --; }
+  for (; k >= 0; k --) {
+    uint64_t start = ckpts[k].instr;
+    restore(k);
+    bool is_bp = false;
+    uint64_t last = scan(end, &is_bp);
+    if (last != 0) {
+      restore(k);
+      replay(last);
+      rewound();
+      printf("%s at instruction %" PRIu64 ", eip = 0x%08x\n",
+          (is_bp ? "hit breakpoint" : "watchpoint changed"), nr_guest_instr, cpu.eip);
+      return;
+    }
+    end = start;
+  }
+
+  if (nr_guest_instr != ckpts[0].instr) { restore(0); }
+  rewound();
+  printf("no earlier stop, rewound to the oldest checkpoint at instruction %" PRIu64 "\n",
+      nr_guest_instr);
+}
+
+void show_checkpoints() {
+  if (!ckpt_enabled) {
+    printf("reverse execution is off\n");
+    return;
+  }
+  printf("NO\tInstr\tPages\n");
+  int i;
+  for (i = 0; i < nr_ckpt; i ++) {
+    printf("%d\t%" PRIu64 "\t%d\n", i, ckpts[i].instr, ckpts[i].nr_undo);
+  }
+  printf("%zu KB of checkpoints, %" PRIu64 " logged inputs, %" PRIu64 " logged interrupts, budget %zu KB\n",
+      total_size / 1024, input_end - input_base, intr_end - intr_base, budget / 1024);
+}
+
+void init_reverse(uint64_t interval_, size_t budget_) {
+  interval = interval_;
+  budget = budget_;
+  ckpt_enabled = true;
+  ckpt_take();
+  Log("Checkpoint every %" PRIu64 " instructions within %zu MB", interval, budget >> 20);
+}
@@ -0,0 +1,336 @@
+#include "nemu.h"
+#include "monitor/simpoint.h"
+#include "cpu/exec.h"
+#include <stdlib.h>
+
+/* SimPoint sampling in two runs of the same guest.
+ *
+ * The fast pass (--bbv) counts the instructions executed in each basic block
+ * during each interval, and writes these basic block vectors in the .bb
+ * format of SimPoint, one line per interval:
+ *
+ *   T:id:count :id:count ...
+ *
+ * A basic block here starts after a taken jump and ends at the next one, so a
+ * conditional jump not taken does not split it. tools/simpoint.py clusters the
+ * vectors and picks the interval closest to the center of each cluster,
+ * weighted by the share of intervals in the cluster.
+ *
+ * The detailed pass (--simpoints) runs the guest again up to each interval
+ * picked with nothing enabled, and with the opcode statistics during the
+ * interval. The statistics of the intervals are combined by the weights to
+ * estimate the whole run. The guest has to run the same way twice, so it
+ * should not depend on the timer or the input.
+ */
+
+#define TOP_N 20
+
+bool bbv_enabled = false;
+vaddr_t bbv_block_start;
+uint64_t bbv_block_len = 0;
+uint64_t sp_next = UINT64_MAX;
+bool sp_finished = false;
+static uint64_t sp_interval;
+
+/* fast pass */
+
+typedef struct {
+  vaddr_t eip;
+  uint32_t id;   /* 0 for an empty slot */
+} Block;
+
+static FILE *bbv_fp;
+static uint64_t nr_bbv_interval = 0;
+/* an open-addressing hash table of the blocks by their start */
+static Block *blocks = NULL;
+static uint32_t blocks_size = 0, nr_blocks = 0;
+/* the instructions of each block and the blocks seen in this interval */
+static uint64_t *block_count = NULL;
+static uint32_t *touched = NULL;
+static uint32_t nr_touched = 0;
+
+static inline uint32_t hash_eip(vaddr_t eip) {
+  uint32_t h = eip * 2654435761u;
+  return h ^ (h >> 16);
+}
+
+static Block *block_slot(Block *table, uint32_t size, vaddr_t eip) {
+  uint32_t i = hash_eip(eip) & (size - 1);
+  while (table[i].id != 0 && table[i].eip != eip) {
+    i = (i + 1) & (size - 1);
+  }
+  return &table[i];
+}
+
+static void blocks_grow() {
+  uint32_t new_size = (blocks_size == 0 ? 4096 : blocks_size * 2);
+  /* ids start from 1, and at most half of the slots are used */
+  uint32_t old_cap = (blocks_size == 0 ? 0 : blocks_size / 2 + 1);
+  uint32_t new_cap = new_size / 2 + 1;
+  Block *new_blocks = calloc(new_size, sizeof(Block));
+  assert(new_blocks);
+  uint32_t i;
+  for (i = 0; i < blocks_size; i ++) {
+    if (blocks[i].id != 0) {
+      *block_slot(new_blocks, new_size, blocks[i].eip) = blocks[i];
+    }
+  }
+  free(blocks);
+  blocks = new_blocks;
+  blocks_size = new_size;
+
+  block_count = realloc(block_count, new_cap * sizeof(uint64_t));
+  touched = realloc(touched, new_cap * sizeof(uint32_t));
+  assert(block_count && touched);
+  memset(block_count + old_cap, 0, (new_cap - old_cap) * sizeof(uint64_t));
+}
+
+static uint32_t block_id(vaddr_t eip) {
+  if ((nr_blocks + 1) * 2 > blocks_size) {
+    blocks_grow();
+  }
+  Block *b = block_slot(blocks, blocks_size, eip);
+  if (b->id == 0) {
+    b->eip = eip;
+    b->id = ++ nr_blocks;
+  }
+  return b->id;
+}
+
+void bbv_block_end() {
+  uint32_t id = block_id(bbv_block_start);
+  if (block_count[id] == 0) {
+    touched[nr_touched ++] = id;
+  }
+  block_count[id] += bbv_block_len;
+  bbv_block_start = cpu.eip;
+  bbv_block_len = 0;
+}
+
+static void bbv_write_interval() {
+  if (bbv_block_len > 0) {
+    bbv_block_end();
+  }
+  if (nr_touched == 0) return;
+
+  fputc('T', bbv_fp);
+  uint32_t i;
+  for (i = 0; i < nr_touched; i ++) {
+    fprintf(bbv_fp, ":%u:%" PRIu64 " ", touched[i], block_count[touched[i]]);
+    block_count[touched[i]] = 0;
+  }
+  fputc('\n', bbv_fp);
+  nr_touched = 0;
+  nr_bbv_interval ++;
+}
+
+static void bbv_finish() {
+  /* the last interval is usually shorter */
+  bbv_write_interval();
+  fclose(bbv_fp);
+  printf("bbv: %" PRIu64 " intervals of %" PRIu64 " instructions, %u basic blocks\n",
+      nr_bbv_interval, sp_interval, nr_blocks);
+}
+
+void init_bbv(const char *bb_file, uint64_t interval) {
+  Assert(interval != 0, "the interval can not be 0");
+  bbv_fp = fopen(bb_file, "w");
+  Assert(bbv_fp, "Can not open '%s'", bb_file);
+  sp_interval = interval;
+  sp_next = interval;
+  bbv_block_start = cpu.eip;
+  bbv_enabled = true;
+  blocks_grow();
+  atexit(bbv_finish);
+}
+
+/* detailed pass */
+
+typedef struct {
+  uint64_t interval;
+  int cluster;
+  double weight;
+  bool done;
+  uint64_t instr, mem_read, mem_write, modrm_mem, modrm_reg;
+} Window;
+
+static Window *windows = NULL;
+static int nr_window = 0, cur_window = 0;
+static bool in_window = false;
+static uint64_t win_instr, win_mem_read, win_mem_write;
+
+/* the opcode mix of the whole run, weighted by the windows */
+typedef struct {
+  char opcode[16];
+  const char *name;
+  double share;
+} MixItem;
+
+static MixItem mix[512 + 8 * 8];
+static int nr_mix = 0;
+
+static inline uint64_t window_cycle(const Window *w) {
+  /* the model of the performance counters, see src/device/perf.c */
+  return w->instr + w->mem_read + w->mem_write;
+}
+
+static void mix_add(const char *opcode, const char *name, uint64_t count) {
+  const Window *w = &windows[cur_window];
+  int i;
+  for (i = 0; i < nr_mix && strcmp(mix[i].opcode, opcode) != 0; i ++);
+  if (i == nr_mix) {
+    strcpy(mix[i].opcode, opcode);
+    mix[i].name = name;
+    mix[i].share = 0;
+    nr_mix ++;
+  }
+  mix[i].share += w->weight * count / w->instr;
+}
+
+static void window_begin() {
+  win_instr = nr_guest_instr;
+  win_mem_read = nr_mem_read;
+  win_mem_write = nr_mem_write;
+  opstat_reset();
+  opstat_enabled = true;
+  in_window = true;
+}
+
+static void window_end() {
+  Window *w = &windows[cur_window];
+  w->instr = nr_guest_instr - win_instr;
+  w->mem_read = nr_mem_read - win_mem_read;
+  w->mem_write = nr_mem_write - win_mem_write;
+  OpstatSummary sum;
+  opstat_summary(&sum);
+  w->modrm_mem = sum.modrm_mem;
+  w->modrm_reg = sum.modrm_reg;
+  w->done = true;
+  opstat_enabled = false;
+  in_window = false;
+  if (w->instr != 0) { opstat_foreach(mix_add); }
+}
+
+void simpoint_interval_end() {
+  if (bbv_enabled) {
+    bbv_write_interval();
+    sp_next += sp_interval;
+    return;
+  }
+
+  if (in_window) {
+    window_end();
+    cur_window ++;
+  }
+  if (cur_window == nr_window) {
+    /* The rest of the run is not needed. */
+    sp_next = UINT64_MAX;
+    sp_finished = true;
+    nemu_stop();
+    return;
+  }
+  uint64_t start = windows[cur_window].interval * sp_interval;
+  if (nr_guest_instr >= start) {
+    window_begin();
+    sp_next = start + sp_interval;
+  }
+  else {
+    sp_next = start;
+  }
+}
+
+static void simpoint_report() {
+  /* The guest may end in the last window, which still counts. */
+  if (in_window) { window_end(); }
+
+  double weight = 0, cpi = 0, read = 0, write = 0, modrm = 0;
+  int i, n = 0;
+  printf("simpoint: windows of %" PRIu64 " instructions\n", sp_interval);
+  printf("%10s %8s %8s %12s %12s %8s\n", "interval", "weight", "CPI", "reads/instr", "writes/instr", "mem op%");
+  for (i = 0; i < nr_window; i ++) {
+    Window *w = &windows[i];
+    if (!w->done || w->instr == 0) {
+      printf("%10" PRIu64 " %8.4f  not reached\n", w->interval, w->weight);
+      continue;
+    }
+    uint64_t nr_modrm = w->modrm_mem + w->modrm_reg;
+    double w_cpi = (double)window_cycle(w) / w->instr;
+    double w_read = (double)w->mem_read / w->instr;
+    double w_write = (double)w->mem_write / w->instr;
+    double w_modrm = (nr_modrm == 0 ? 0 : 100.0 * w->modrm_mem / nr_modrm);
+    printf("%10" PRIu64 " %8.4f %8.4f %12.4f %12.4f %8.2f\n",
+        w->interval, w->weight, w_cpi, w_read, w_write, w_modrm);
+    weight += w->weight;
+    cpi += w->weight * w_cpi;
+    read += w->weight * w_read;
+    write += w->weight * w_write;
+    modrm += w->weight * w_modrm;
+    n ++;
+  }
+  if (n == 0) return;
+
+  /* Scale the estimates if some windows are not reached. */
+  printf("%10s %8.4f %8.4f %12.4f %12.4f %8.2f\n", "weighted", weight,
+      cpi / weight, read / weight, write / weight, modrm / weight);
+
+  /* sort the opcode mix by share */
+  int j;
+  for (i = 1; i < nr_mix; i ++) {
+    for (j = i; j > 0 && mix[j - 1].share < mix[j].share; j --) {
+      MixItem t = mix[j];
+      mix[j] = mix[j - 1];
+      mix[j - 1] = t;
+    }
+  }
+  printf("weighted opcode mix:\n%-8s %-16s %8s\n", "Opcode", "Name", "%");
+  for (i = 0; i < nr_mix && i < TOP_N; i ++) {
+    printf("%-8s %-16s %7.2f%%\n", mix[i].opcode, mix[i].name, 100.0 * mix[i].share / weight);
+  }
+}
+
+static FILE *open_with_suffix(const char *prefix, const char *suffix) {
+  char path[strlen(prefix) + strlen(suffix) + 1];
+  sprintf(path, "%s%s", prefix, suffix);
+  FILE *fp = fopen(path, "r");
+  Assert(fp, "Can not open '%s'", path);
+  return fp;
+}
+
+static int window_cmp(const void *a, const void *b) {
+  uint64_t x = ((const Window *)a)->interval, y = ((const Window *)b)->interval;
+  return (x > y) - (x < y);
+}
+
+/* Read the intervals picked from PREFIX.simpoints and their weights from
+ * PREFIX.weights, both with a line of `<value> <cluster>' for each cluster. */
+void init_simpoint(const char *prefix, uint64_t interval) {
+  Assert(interval != 0, "the interval can not be 0");
+  sp_interval = interval;
+
+  FILE *fp = open_with_suffix(prefix, ".simpoints");
+  uint64_t iv;
+  int cluster;
+  while (fscanf(fp, "%" SCNu64 " %d", &iv, &cluster) == 2) {
+    windows = realloc(windows, (nr_window + 1) * sizeof(Window));
+    assert(windows);
+    windows[nr_window ++] = (Window) { .interval = iv, .cluster = cluster };
+  }
+  fclose(fp);
+  Assert(nr_window > 0, "No interval is found in '%s.simpoints'", prefix);
+
+  fp = open_with_suffix(prefix, ".weights");
+  double weight;
+  while (fscanf(fp, "%lf %d", &weight, &cluster) == 2) {
+    int i;
+    for (i = 0; i < nr_window; i ++) {
+      if (windows[i].cluster == cluster) { windows[i].weight = weight; }
+    }
+  }
+  fclose(fp);
+
+  qsort(windows, nr_window, sizeof(Window), window_cmp);
+  atexit(simpoint_report);
+
+  /* Start the first window now if it is the first interval. */
+  simpoint_interval_end();
+}
@@ -0,0 +1,132 @@
+#include "nemu.h"
+#include "monitor/symbol.h"
+#include <elf.h>
+#include <stdlib.h>
+
+/* Function and object symbols of the guest program, sorted by address,
+ * plus an index of them sorted by name. */
+static Symbol *symtab = NULL;
+static Symbol **symtab_by_name = NULL;
+static int nr_symtab = 0;
+static char *strtab = NULL;
+
+static int cmp_addr(const void *a, const void *b) {
+  const Symbol *x = a, *y = b;
+  return (x->addr > y->addr) - (x->addr < y->addr);
+}
+
+static int cmp_name(const void *a, const void *b) {
+  return strcmp((*(const Symbol **)a)->name, (*(const Symbol **)b)->name);
+}
+
+static void *read_at(FILE *fp, long offset, size_t size, const char *file) {
+  void *buf = malloc(size);
+  assert(buf);
+  int ret = fseek(fp, offset, SEEK_SET);
+  Assert(ret == 0 && fread(buf, size, 1, fp) == 1, "Can not read '%s'", file);
+  return buf;
+}
+
+void init_symbols(const char *file) {
+  FILE *fp = fopen(file, "rb");
+  Assert(fp, "Can not open '%s'", file);
+
+  Elf32_Ehdr *eh = read_at(fp, 0, sizeof(Elf32_Ehdr), file);
+  Assert(memcmp(eh->e_ident, ELFMAG, SELFMAG) == 0 && eh->e_ident[EI_CLASS] == ELFCLASS32 &&
+      eh->e_machine == EM_386, "'%s' is not an i386 ELF file", file);
+
+  Elf32_Shdr *sh = read_at(fp, eh->e_shoff, eh->e_shnum * sizeof(Elf32_Shdr), file);
+  int i;
+  for (i = 0; i < eh->e_shnum; i ++) {
+    if (sh[i].sh_type == SHT_SYMTAB) break;
+  }
+  if (i == eh->e_shnum) {
+    Log("No symbol table in '%s'", file);
+    goto out;
+  }
+
+  Elf32_Shdr *str_sh = &sh[sh[i].sh_link];
+  strtab = read_at(fp, str_sh->sh_offset, str_sh->sh_size, file);
+  Elf32_Sym *sym = read_at(fp, sh[i].sh_offset, sh[i].sh_size, file);
+  int nr_sym = sh[i].sh_size / sizeof(Elf32_Sym);
+
+  symtab = malloc(nr_sym * sizeof(Symbol));
+  assert(symtab);
+  int j;
+  for (j = 0; j < nr_sym; j ++) {
+    int type = ELF32_ST_TYPE(sym[j].st_info);
+    if ((type != STT_FUNC && type != STT_OBJECT) || sym[j].st_name >= str_sh->sh_size) continue;
+    symtab[nr_symtab].addr = sym[j].st_value;
+    symtab[nr_symtab].size = sym[j].st_size;
+    symtab[nr_symtab].name = strtab + sym[j].st_name;
+    nr_symtab ++;
+  }
+  free(sym);
+  qsort(symtab, nr_symtab, sizeof(Symbol), cmp_addr);
+
+  symtab_by_name = malloc(nr_symtab * sizeof(Symbol *));
+  assert(symtab_by_name);
+  for (j = 0; j < nr_symtab; j ++) {
+    symtab_by_name[j] = &symtab[j];
+  }
+  qsort(symtab_by_name, nr_symtab, sizeof(Symbol *), cmp_name);
+
+  Log("Loaded %d symbols from %s", nr_symtab, file);
+
+out:
+  free(sh);
+  free(eh);
+  fclose(fp);
+}
+
+bool symbol_lookup(const char *name, vaddr_t *addr) {
+  int lo = 0, hi = nr_symtab - 1;
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    int c = strcmp(name, symtab_by_name[mid]->name);
+    if (c == 0) {
+      *addr = symtab_by_name[mid]->addr;
+      return true;
+    }
+    if (c < 0) hi = mid - 1;
+    else lo = mid + 1;
+  }
+  return false;
+}
+
+/* Return the symbol containing `addr', or NULL. */
+const Symbol *symbol_find(vaddr_t addr) {
+  /* find the last symbol starting at or before addr */
+  int lo = 0, hi = nr_symtab - 1, found = -1;
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    if (symtab[mid].addr <= addr) {
+      found = mid;
+      lo = mid + 1;
+    }
+    else hi = mid - 1;
+  }
+  if (found == -1) return NULL;
+
+  /* Symbols at the same address may differ in size. A symbol without
+   * size, such as _start written in assembly, extends to the next one. */
+  vaddr_t start = symtab[found].addr;
+  const Symbol *unsized = NULL;
+  for (; found >= 0 && symtab[found].addr == start; found --) {
+    if (addr < start + symtab[found].size) return &symtab[found];
+    if (symtab[found].size == 0) unsized = &symtab[found];
+  }
+  return unsized;
+}
+
+int symbol_index(const Symbol *sym) {
+  return sym - symtab;
+}
+
+const Symbol *symbol_at(int index) {
+  return &symtab[index];
+}
+
+int nr_symbols() {
+  return nr_symtab;
+}
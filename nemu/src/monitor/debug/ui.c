@@ -1,8 +1,14 @@
 #include "monitor/monitor.h"
 #include "monitor/expr.h"
 #include "monitor/watchpoint.h"
+#include "monitor/memwatch.h"
+#include "monitor/breakpoint.h"
+#include "monitor/reverse.h"
+#include "monitor/gdbstub.h"
 #include "nemu.h"
 #include "utils.h"
+#include "device/port-io.h"
+#include "cpu/exec.h"
 #include <stdlib.h>
 #include <readline/readline.h>
 #include <readline/history.h>
@@ -59,10 +65,28 @@ static int cmd_si(char *args){
 	return 0;
 }
 
+static int cmd_rsi(char *args){
+  char *arg=strtok(NULL," ");
+  uint64_t n=1;
+  if (arg!=NULL){
+      n = str2uint64(arg);
+  }
+  reverse_step(n);
+  return 0;
+}
+
+static int cmd_rc(char *args){
+  reverse_continue();
+  return 0;
+}
+
 static void print_cmd_info_usage(){
     printf("info usage:\n");
     printf("  info r : print registers info \n");
     printf("  info w : print watchpointer info \n");
+    printf("  info b : print breakpoint info \n");
+    printf("  info p : print port I/O access counts \n");
+    printf("  info c : print checkpoints of reverse execution \n");
     printf("\n");
 }
 
@@ -87,6 +111,15 @@ static int cmd_info(char *args){
   }
   else if(strcmp(arg,"w")==0){   
     show_watchpoints(); 
+  }
+  else if(strcmp(arg,"b")==0){
+    show_breakpoints();
+  }
+  else if(strcmp(arg,"p")==0){
+    pio_show_stats();
+  }
+  else if(strcmp(arg,"c")==0){
+    show_checkpoints();
   }else{
     print_cmd_info_usage();
   }
@@ -98,11 +131,11 @@ static int cmd_p(char *args){
     printf("please input expression!\n");
     return 0;
   }
-  uint32_t result;
+  uint64_t result;
   bool success;
   result=expr(args,&success);
   if (success){
-    printf(">>> %u\n",result);
+    printf(">>> %" PRIu64 " (0x%" PRIx64 ")\n",result,result);
   }
   return 0;
 }
@@ -113,7 +146,16 @@ static int cmd_w(char* args){
     return 0;
   }
   char* err=(char*)NULL;
-  int no=add_wp(args,&err);
+  int no;
+  // `w *ADDR' is triggered by the stores to ADDR instead of being
+  // evaluated after every instruction
+  ExprCode code;
+  vaddr_t addr;
+  if(expr_compile(args,&code)&&expr_const_deref(&code,&addr)){
+    no=add_mw(args,addr,4,&err);
+  }else{
+    no=add_wp(args,&err);
+  }
   if(err!=NULL){
     printf("can't add watchpoint: %s\n",err);
     return 0;
@@ -124,7 +166,7 @@ static int cmd_w(char* args){
 
 static int cmd_d(char* args){
   int n = (int)str2uint32(args);
-  if(del_wp(n)){
+  if(del_wp(n)||del_mw(n)){
     printf("delete watchpoint success\n");
   }else{
     printf("can't delete watchpoint: %d\n",n);    
@@ -132,9 +174,90 @@ static int cmd_d(char* args){
   return 0;
 }
 
+static int cmd_b(char* args){
+  if(args==NULL){
+    printf("usage: b [ADDR EXPR] [if COND]\n");
+    return 0;
+  }
+  // split off the condition
+  char* cond=strstr(args," if ");
+  if(cond!=NULL){
+    *cond='\0';
+    cond+=4;
+  }
+  bool expr_pass=false;
+  vaddr_t addr=expr(args,&expr_pass);
+  if(expr_pass==false){
+    printf("address expression error\n");
+    return 0;
+  }
+  char* err=(char*)NULL;
+  int no=add_bp(addr,cond,&err);
+  if(err!=NULL){
+    printf("can't add breakpoint: %s\n",err);
+    return 0;
+  }
+  printf("add breakpoint: [ %d ] at 0x%08x\n",no,addr);
+  return 0;
+}
+
+static int cmd_bd(char* args){
+  if(args==NULL){
+    printf("usage: bd [N]\n");
+    return 0;
+  }
+  int n = (int)str2uint32(args);
+  if(del_bp(n)){
+    printf("delete breakpoint success\n");
+  }else{
+    printf("can't delete breakpoint: %d\n",n);
+  }
+  return 0;
+}
+
+static int cmd_ignore(char* args){
+  char *arg_n=strtok(NULL," ");
+  char *arg_count=strtok(NULL," ");
+  if(arg_n==NULL||arg_count==NULL){
+    printf("usage: ignore [N] [COUNT]\n");
+    return 0;
+  }
+  int n=(int)str2uint32(arg_n);
+  int count=(int)str2uint32(arg_count);
+  if(set_bp_ignore(n,count)){
+    printf("will ignore next %d hits of breakpoint %d\n",count,n);
+  }else{
+    printf("no breakpoint %d\n",n);
+  }
+  return 0;
+}
+
+static int cmd_opstat(char* args){
+  char *arg=strtok(NULL," ");
+  if(arg==NULL){
+    opstat_report(stdout,false);
+  }else if(strcmp(arg,"on")==0){
+    opstat_enabled=true;
+  }else if(strcmp(arg,"off")==0){
+    opstat_enabled=false;
+  }else if(strcmp(arg,"reset")==0){
+    opstat_reset();
+  }else if(strcmp(arg,"json")==0){
+    char *file=strtok(NULL," ");
+    FILE *fp=(file==NULL?stdout:fopen(file,"w"));
+    if(fp==NULL){
+      printf("can't open %s\n",file);
+      return 0;
+    }
+    opstat_report(fp,true);
+    if(fp!=stdout) fclose(fp);
+  }else{
+    printf("usage: opstat [on|off|reset|json [FILE]]\n");
+  }
+  return 0;
+}
+
 static int cmd_x(char* args){
-  vaddr_write(0,4,23333);
-  vaddr_write(4,4,-1);
   char *arg_n=strtok(NULL," ");
   if(arg_n==NULL){
     printf("usage: x [N] [ADDR EXPR]\n");
@@ -154,13 +277,13 @@ static int cmd_x(char* args){
     printf("address expression error\n");    
     return 0;
   }
-  if(addr+n*4>=128 * 1024 * 1024){
+  if(addr+n*4>=PMEM_SIZE){
     printf("address error %08x\n",addr);    
-    printf("address range [0x00000000,0x%08x)\n",128 * 1024 * 1024);    
+    printf("address range [0x00000000,0x%08x)\n",PMEM_SIZE);    
     return 0;
   }
   for(uint32_t i=0;i<n;i++){
-    uint32_t val=vaddr_read(addr+i*4,4);
+    uint32_t val=paddr_read(addr+i*4,4);
     printf("0x%08x:",addr+i*4);
     printf(" %02x",(uint8_t)val);
     printf(" %02x",(uint8_t)(val>>2));
@@ -182,10 +305,16 @@ static struct {
   { "c", "Continue the execution of the program", cmd_c },
   { "q", "Exit NEMU", cmd_q },
   {"si","Step execute N instruction,si [N] ",cmd_si},
-  {"info","print registers or watchpoint information",cmd_info},
+  {"rsi","Step back N instruction,rsi [N] ",cmd_rsi},
+  {"rc","Continue backward to the previous break point or watch point hit",cmd_rc},
+  {"info","print registers, watchpoint, breakpoint, port I/O or checkpoint information",cmd_info},
   {"w","set watch point",cmd_w},
   {"d","delete watch point",cmd_d},
+  {"b","set break point, b ADDR [if COND]",cmd_b},
+  {"bd","delete break point",cmd_bd},
+  {"ignore","ignore the next COUNT hits of a break point, ignore N COUNT",cmd_ignore},
   {"x","scan memory ",cmd_x},
+  {"opstat","opcode statistics, opstat [on|off|reset|json [FILE]]",cmd_opstat},
   {"p","expr",cmd_p},
 
   /* TODO: Add more commands */
@@ -218,8 +347,13 @@ static int cmd_help(char *args) {
 }
 
 void ui_mainloop(int is_batch_mode) {
+  if (gdbstub_attached()) {
+    gdbstub_mainloop();
+    return;
+  }
+
   if (is_batch_mode) {
-    cmd_c(NULL);
+    cpu_exec(max_instr);
     return;
   }
 
@@ -1,7 +1,7 @@
+#include "nemu.h"
 #include "monitor/watchpoint.h"
 #include "monitor/expr.h"
-
-#define NR_WP 32
+#include "monitor/memwatch.h"
 
 static WP wp_pool[NR_WP];
 static WP *head, *free_;
@@ -49,33 +49,55 @@ WP* new_wp(){
 
 void free_wp(WP* wp){
   if(wp==NULL) return;
-  // remove from head
-  WP* p=head;
-  if(p==wp){
+  // unlink from head
+  if(head==wp){
     head=head->next;
-    return;
-  }
-  while(p!=NULL){
-    if(p->next==wp){
-      WP* should_free=p->next;
-      p->next=should_free->next;
-      //add p->next to free_
-      if(free_==NULL){
-        free_=should_free;
-        free_->next=NULL;
-      }else{
-        should_free->next=free_;
-        free_=should_free;
-      }
+  }else{
+    WP* p=head;
+    while(p!=NULL&&p->next!=wp){
+      p=p->next;
     }
-    p=p->next;
+    if(p==NULL) return;
+    p->next=wp->next;
+  }
+  // add to free_
+  wp->next=free_;
+  free_=wp;
+}
+
+// remember the dependencies of wp after evaluating it
+static void wp_snapshot(WP* wp){
+  uint32_t mask=wp->code.reg_mask;
+  int i;
+  for(i=0;mask!=0;i++,mask>>=1){
+    if(mask&1) wp->reg_snap[i]=expr_reg_val(i);
+  }
+  wp->mem_gen=__atomic_load_n(&mw_store_gen,__ATOMIC_RELAXED);
+}
+
+// the value of wp can only change if a register it reads changed,
+// or it reads memory and there were stores to the watched pages
+// since the last evaluation, see mw_rebuild_page_map()
+static bool wp_deps_changed(WP* wp){
+  if(wp->code.has_deref&&wp->mem_gen!=__atomic_load_n(&mw_store_gen,__ATOMIC_RELAXED)) return true;
+  uint32_t mask=wp->code.reg_mask;
+  int i;
+  for(i=0;mask!=0;i++,mask>>=1){
+    if((mask&1)&&wp->reg_snap[i]!=expr_reg_val(i)) return true;
   }
+  return false;
 }
 
 int add_wp(char *expression, char **err)
 {
   bool expr_pass = false;
-  uint32_t val = expr(expression, &expr_pass);
+  ExprCode code;
+  if (!expr_compile(expression, &code))
+  {
+    *err = "expression check failed";
+    return 0;
+  }
+  uint64_t val = expr_run(&code, &expr_pass);
   if (expr_pass == false)
   {
     *err = "expression check failed";
@@ -88,8 +110,11 @@ int add_wp(char *expression, char **err)
     return 0;
   }
   strcpy(wp->expression, expression);
+  wp->code = code;
   wp->value = val;
   wp->hit=0;
+  wp_snapshot(wp);
+  mw_rebuild_page_map();
   return wp->NO;
 }
 
@@ -99,6 +124,7 @@ bool del_wp(int no){
   while(p!=NULL){
     if(p->NO==no){
       free_wp(p);
+      mw_rebuild_page_map();
       find=true;
       break;
     }
@@ -107,6 +133,20 @@ bool del_wp(int no){
   return find;
 }
 
+// pass the ranges read by the watchpoints to watch(),
+// return the number of them, or -1 if one is only known at run time
+int wp_watch_derefs(void (*watch)(vaddr_t,int)){
+  int n=0,i;
+  WP* p=head;
+  for(;p!=NULL;p=p->next){
+    if(p->code.deref_dynamic) return -1;
+    for(i=0;i<p->code.nr_deref;i++,n++){
+      watch(p->code.deref_addr[i],4);
+    }
+  }
+  return n;
+}
+
 void show_watchpoints(){
   WP* p=head;
   printf("NO\tWhat\tHit\n");
@@ -114,18 +154,24 @@ void show_watchpoints(){
     printf("%d\t%s\t%d\n",p->NO,p->expression,p->hit);
     p=p->next;
   }
+  show_memwatches();
 }
 
 bool check_watchpoints(){
   WP* p=head;
-  bool stop=false;
+  bool stop=check_memwatches();
   while(p!=NULL){
+    if(!wp_deps_changed(p)){
+      p=p->next;
+      continue;
+    }
     bool ok;
-    uint32_t new_value=expr(p->expression,&ok);
-    if(new_value!=p->value){
+    uint64_t new_value=expr_run(&p->code,&ok);
+    wp_snapshot(p);
+    if(ok&&new_value!=p->value){
       printf("hit watchpoint %d: %s\n",p->NO,p->expression);
-      printf("old value = 0x%08x \n",p->value);
-      printf("new value = 0x%08x \n",new_value);
+      printf("old value = 0x%08" PRIx64 " \n",p->value);
+      printf("new value = 0x%08" PRIx64 " \n",new_value);
       p->value=new_value;  
       p->hit++;
       stop=true;    
@@ -135,3 +181,30 @@ bool check_watchpoints(){
   return stop;
 }
 
+
+// fold the current values of all watchpoints into one number,
+// reverse-continue looks for the instructions changing it
+uint64_t watch_signature(){
+  uint64_t sig=memwatch_signature(0xcbf29ce484222325ull);
+  WP* p=head;
+  while(p!=NULL){
+    bool ok;
+    sig=(sig^expr_run(&p->code,&ok))*0x100000001b3ull;
+    p=p->next;
+  }
+  return sig;
+}
+
+// take the current values after the machine state is restored,
+// so the next check does not report the difference as a hit
+void refresh_watchpoints(){
+  WP* p=head;
+  while(p!=NULL){
+    bool ok;
+    uint64_t value=expr_run(&p->code,&ok);
+    if(ok) p->value=value;
+    wp_snapshot(p);
+    p=p->next;
+  }
+  refresh_memwatches();
+}
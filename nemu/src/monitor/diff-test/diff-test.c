@@ -1,18 +1,26 @@
 #include "nemu.h"
 #include "monitor/monitor.h"
-#include <unistd.h>
-#include <sys/prctl.h>
-#include <signal.h>
+#include "monitor/reverse.h"
+#include "monitor/difftest.h"
+#include <pthread.h>
+#include <dlfcn.h>
 
 #include "protocol.h"
 #include <stdlib.h>
 
-bool gdb_connect_qemu(void);
-bool gdb_memcpy_to_qemu(uint32_t, void *, int);
 bool gdb_getregs(union gdb_regs *);
 bool gdb_setregs(union gdb_regs *);
-bool gdb_si(void);
-void gdb_exit(void);
+void gdb_send_si(void);
+void gdb_recv_si(void);
+void gdb_send_getregs(void);
+void gdb_recv_getregs(union gdb_regs *);
+bool gdb_noack_qemu(void);
+bool gdb_memcpy_from_qemu(void *, uint32_t, int);
+
+extern DiffBackend qemu_backend;
+
+/* The reference NEMU is checked against */
+static DiffBackend *ref = &qemu_backend;
 
 static bool is_skip_qemu;
 static bool is_skip_nemu;
@@ -20,138 +28,461 @@ static bool is_skip_nemu;
 void diff_test_skip_qemu() { is_skip_qemu = true; }
 void diff_test_skip_nemu() { is_skip_nemu = true; }
 
-#define regcpy_from_nemu(regs) \
-  do { \
-    regs.eax = cpu.eax; \
-    regs.ecx = cpu.ecx; \
-    regs.edx = cpu.edx; \
-    regs.ebx = cpu.ebx; \
-    regs.esp = cpu.esp; \
-    regs.ebp = cpu.ebp; \
-    regs.esi = cpu.esi; \
-    regs.edi = cpu.edi; \
-    regs.eip = cpu.eip; \
-  } while (0)
-
-static uint8_t mbr[] = {
-  // start16:
-  0xfa,                           // cli
-  0x31, 0xc0,                     // xorw   %ax,%ax
-  0x8e, 0xd8,                     // movw   %ax,%ds
-  0x8e, 0xc0,                     // movw   %ax,%es
-  0x8e, 0xd0,                     // movw   %ax,%ss
-  0x0f, 0x01, 0x16, 0x44, 0x7c,   // lgdt   gdtdesc
-  0x0f, 0x20, 0xc0,               // movl   %cr0,%eax
-  0x66, 0x83, 0xc8, 0x01,         // orl    $CR0_PE,%eax
-  0x0f, 0x22, 0xc0,               // movl   %eax,%cr0
-  0xea, 0x1d, 0x7c, 0x08, 0x00,   // ljmp   $GDT_ENTRY(1),$start32
-
-  // start32:
-  0x66, 0xb8, 0x10, 0x00,         // movw   $0x10,%ax
-  0x8e, 0xd8,                     // movw   %ax, %ds
-  0x8e, 0xc0,                     // movw   %ax, %es
-  0x8e, 0xd0,                     // movw   %ax, %ss
-  0xeb, 0xfe,                     // jmp    7c27
-  0x8d, 0x76, 0x00,               // lea    0x0(%esi),%esi
-
-  // GDT
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0xff, 0xff, 0x00, 0x00, 0x00, 0x9a, 0xcf, 0x00,
-  0xff, 0xff, 0x00, 0x00, 0x00, 0x92, 0xcf, 0x00,
-
-  // GDT descriptor
-  0x17, 0x00, 0x2c, 0x7c, 0x00, 0x00
-};
-
-void init_difftest(void) {
-  int ppid_before_fork = getpid();
-  int pid = fork();
-  if (pid == -1) {
-    perror("fork");
-    panic("fork error");
-  }
-  else if (pid == 0) {
-    // child
-
-    // install a parent death signal in the chlid
-    int r = prctl(PR_SET_PDEATHSIG, SIGTERM);
-    if (r == -1) {
-      perror("prctl error");
-      panic("prctl");
+/* The stores made by the current instruction of NEMU */
+static DiffStore nemu_store[DIFF_MAX_STORE];
+static int nr_nemu_store = 0;
+
+void difftest_log_store(vaddr_t addr, int len, uint32_t data) {
+  /* Ignore the stores made by the debugger. */
+  if (nemu_state != NEMU_RUNNING) return;
+  if (nr_nemu_store < DIFF_MAX_STORE) {
+    DiffStore *s = &nemu_store[nr_nemu_store];
+    s->addr = addr;
+    s->len = len;
+    s->data = (len == 4 ? data : data & ((1u << (len * 8)) - 1));
+  }
+  nr_nemu_store ++;
+}
+
+/* The registers compared with the reference: eax - edi and eip,
+ * in the order of `DiffRegs' and `union gdb_regs'. */
+#define NR_DIFF_REG 9
+
+typedef struct {
+  uint64_t pos;       /* the instruction count after the instruction */
+  bool skip_qemu;
+  uint32_t regs[NR_DIFF_REG];
+} DiffRecord;
+
+static inline void record_nemu(DiffRecord *r) {
+  r->pos = nr_guest_instr + 1;
+  memcpy(r->regs, &cpu.eax, sizeof(r->regs));
+}
+
+static inline void nemu_regs(DiffRegs *r) {
+  memcpy(&r->eax, &cpu.eax, sizeof(uint32_t) * NR_DIFF_REG);
+  r->eflags = cpu.eflags.val;
+}
+
+/* The first divergence found */
+static bool diverged = false;
+static bool reported = false;
+static DiffRecord diff_nemu;
+static uint32_t diff_ref[NR_DIFF_REG];
+static bool diff_fail = false;      /* the reference can not execute it */
+static uint32_t diff_eip;
+static DiffStore diff_store[DIFF_MAX_STORE];
+static int nr_diff_store = -1;      /* the stores of the reference if they differ */
+static bool diff_mem = false;       /* the memory differs in the page below */
+static uint32_t diff_page;
+
+static void compare(DiffRecord *r, uint32_t *ref_regs) {
+  if (!diverged && memcmp(ref_regs, r->regs, sizeof(r->regs)) != 0) {
+    diff_nemu = *r;
+    memcpy(diff_ref, ref_regs, sizeof(diff_ref));
+    __atomic_store_n(&diverged, true, __ATOMIC_RELEASE);
+  }
+}
+
+static bool same_stores(DiffStore *s, int n) {
+  int nemu_n = (nr_nemu_store < DIFF_MAX_STORE ? nr_nemu_store : DIFF_MAX_STORE);
+  return n == nemu_n && memcmp(s, nemu_store, sizeof(*s) * n) == 0;
+}
+
+/* QEMU does not report its stores. Instead, the pages NEMU has stored to
+ * are noted, and at the end of a batch their checksums are compared with
+ * the memory of QEMU. In single steps, the memory is checked every
+ * DIFF_MEM_INTERVAL instructions. */
+#define DIFF_PAGE_SHIFT 12
+#define DIFF_PAGE_SIZE (1 << DIFF_PAGE_SHIFT)
+#define DIFF_MAX_PAGE 256
+#define DIFF_MEM_INTERVAL 1024
+
+typedef struct {
+  int nr;
+  struct {
+    uint32_t addr;
+    uint64_t sum;
+  } page[DIFF_MAX_PAGE];
+} DiffPages;
+
+static uint8_t page_noted[(PMEM_SIZE >> DIFF_PAGE_SHIFT) / 8];
+
+static uint64_t page_sum(const uint8_t *p) {
+  uint64_t sum = 0xcbf29ce484222325ull;
+  int i;
+  for (i = 0; i < DIFF_PAGE_SIZE; i ++) {
+    sum = (sum ^ p[i]) * 0x100000001b3ull;
+  }
+  return sum;
+}
+
+/* Note the pages of the stores of the current instruction. A page is left
+ * out if there are too many of them. */
+static void note_pages(DiffPages *p) {
+  int n = (nr_nemu_store < DIFF_MAX_STORE ? nr_nemu_store : DIFF_MAX_STORE);
+  int i, j;
+  for (i = 0; i < n; i ++) {
+    for (j = 0; j < 2; j ++) {
+      uint32_t addr = nemu_store[i].addr + (j == 0 ? 0 : nemu_store[i].len - 1);
+      uint32_t page = addr >> DIFF_PAGE_SHIFT;
+      if (addr >= PMEM_SIZE || p->nr == DIFF_MAX_PAGE) continue;
+      if ((page_noted[page >> 3] >> (page & 7)) & 1) continue;
+      page_noted[page >> 3] |= 1 << (page & 7);
+      p->page[p->nr ++].addr = page << DIFF_PAGE_SHIFT;
     }
+  }
+}
 
-    if (getppid() != ppid_before_fork) {
-      panic("parent has died!");
+/* Take the checksums of the pages noted, at the end of a batch. The pages
+ * in [lo, hi) are left out, since NEMU is about to copy them to the
+ * reference. If an instruction NEMU does not check is half done, nothing
+ * is checked, since the reference has not executed it yet. */
+static void seal_pages(DiffPages *p, uint32_t lo, uint32_t hi) {
+  int i, n = 0;
+  for (i = 0; i < p->nr; i ++) {
+    uint32_t addr = p->page[i].addr, page = addr >> DIFF_PAGE_SHIFT;
+    page_noted[page >> 3] &= ~(1 << (page & 7));
+    if (is_skip_nemu || (addr < hi && lo < addr + DIFF_PAGE_SIZE)) continue;
+    p->page[n].addr = addr;
+    p->page[n ++].sum = page_sum(guest_to_host(addr));
+  }
+  p->nr = n;
+}
+
+/* Compare the pages with the memory of QEMU, which has executed up to the
+ * instruction of `r'. */
+static void check_pages(DiffPages *p, DiffRecord *r) {
+  static uint8_t buf[DIFF_PAGE_SIZE];
+  int i;
+  for (i = 0; i < p->nr && !diverged; i ++) {
+    if (!gdb_memcpy_from_qemu(buf, p->page[i].addr, DIFF_PAGE_SIZE) ||
+        page_sum(buf) != p->page[i].sum) {
+      diff_nemu = *r;
+      diff_page = p->page[i].addr;
+      diff_mem = true;
+      __atomic_store_n(&diverged, true, __ATOMIC_RELEASE);
     }
+  }
+  p->nr = 0;
+}
+
+static DiffPages single_pages;
+static int single_fill = 0;
 
-    close(STDIN_FILENO);
-    execlp("qemu-system-i386", "qemu-system-i386", "-S", "-s", "-nographic", NULL);
-    perror("exec");
-    panic("exec error");
+/* In single steps QEMU keeps up with NEMU, so the pages are checked at once,
+ * after instruction `pos'. */
+static void check_single_pages(uint32_t lo, uint32_t hi, uint64_t pos) {
+  DiffRecord r;
+  record_nemu(&r);
+  r.pos = pos;
+  seal_pages(&single_pages, lo, hi);
+  check_pages(&single_pages, &r);
+  single_fill = 0;
+}
+
+/* Let the reference execute the current instruction of NEMU, then compare
+ * the registers and, if the reference reports them, the memory stores. */
+static void check_step(uint32_t eip, bool skip) {
+  DiffRecord r;
+  DiffRegs regs;
+  int i;
+  record_nemu(&r);
+
+  if (skip) {
+    // to skip the checking of an instruction, just copy the state to the reference
+    for (i = 0; i < nr_nemu_store && i < DIFF_MAX_STORE; i ++) {
+      ref->memcpy(nemu_store[i].addr, &nemu_store[i].data, nemu_store[i].len);
+    }
+    nemu_regs(&regs);
+    ref->setregs(&regs);
+    return;
   }
-  else {
-    // father
 
-    gdb_connect_qemu();
-    Log("Connect to QEMU successfully");
+  DiffStore s[DIFF_MAX_STORE];
+  int n = ref->step(s, DIFF_MAX_STORE);
+  if (n == DIFF_FAIL) {
+    diff_nemu = r;
+    diff_eip = eip;
+    diff_fail = diverged = true;
+    return;
+  }
 
-    atexit(gdb_exit);
+  ref->getregs(&regs);
+  compare(&r, &regs.eax);
+  if (!diverged && n != DIFF_NO_STORE && !same_stores(s, n)) {
+    diff_nemu = r;
+    memcpy(diff_ref, &regs.eax, sizeof(diff_ref));
+    memcpy(diff_store, s, sizeof(*s) * n);
+    nr_diff_store = n;
+    diverged = true;
+  }
+}
 
-    // put the MBR code to QEMU to enable protected mode
-    bool ok = gdb_memcpy_to_qemu(0x7c00, mbr, sizeof(mbr));
-    assert(ok == 1);
+static int batch_size = 1;
 
-    union gdb_regs r;
-    gdb_getregs(&r);
+/* Let QEMU execute the instructions in `r' and compare its registers after
+ * each of them. The requests are pipelined in windows of DIFF_WINDOW
+ * instructions, so a round trip is paid per window rather than per
+ * instruction. An instruction QEMU should skip breaks the window, since it
+ * needs the up-to-date registers of QEMU. */
+#define DIFF_WINDOW 64
 
-    // set cs:eip to 0000:7c00
-    r.eip = 0x7c00;
-    r.cs = 0x0000;
-    ok = gdb_setregs(&r);
-    assert(ok == 1);
+static void check_records(DiffRecord *r, int n) {
+  union gdb_regs last;
+  bool have_last = false;
+  int i = 0, j;
+  while (i < n && !diverged) {
+    if (r[i].skip_qemu) {
+      if (!have_last) { gdb_getregs(&last); }
+      memcpy(last.array, r[i].regs, sizeof(r[i].regs));
+      gdb_setregs(&last);
+      have_last = true;
+      i ++;
+      continue;
+    }
 
-    // execute enough instructions to enter protected mode
-    int i;
-    for (i = 0; i < 20; i ++) {
-      gdb_si();
+    have_last = true;
+    int end = i;
+    while (end < n && end - i < DIFF_WINDOW && !r[end].skip_qemu) { end ++; }
+    for (j = i; j < end; j ++) {
+      gdb_send_si();
+      gdb_send_getregs();
     }
+    for (j = i; j < end; j ++) {
+      gdb_recv_si();
+      gdb_recv_getregs(&last);
+      compare(&r[j], last.array);
+    }
+    i = end;
   }
 }
 
-void init_qemu_reg() {
-  union gdb_regs r;
-  gdb_getregs(&r);
-  regcpy_from_nemu(r);
-  bool ok = gdb_setregs(&r);
-  assert(ok == 1);
+static void print_stores(const char *who, DiffStore *s, int n) {
+  printf("%s stores:", who);
+  int i;
+  for (i = 0; i < n; i ++) {
+    printf(" [0x%08x]%d=0x%x", s[i].addr, s[i].len, s[i].data);
+  }
+  printf("%s\n", (n == 0 ? " none" : ""));
 }
 
-void difftest_step(uint32_t eip) {
-  union gdb_regs r;
-  bool diff = false;
+static void report_divergence() {
+  static const char *names[NR_DIFF_REG] = { "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi", "eip" };
+  reported = true;
+  if (diff_mem) {
+    printf("diff-test: the memory of the page at 0x%08x differs from %s after instruction %" PRIu64 "\n",
+        diff_page, ref->name, diff_nemu.pos);
+    return;
+  }
+  if (diff_fail) {
+    printf("diff-test: %s can not execute instruction %" PRIu64 " at eip = 0x%08x\n",
+        ref->name, diff_nemu.pos, diff_eip);
+    return;
+  }
+
+  printf("diff-test: %s disagrees after instruction %" PRIu64 "\n", ref->name, diff_nemu.pos);
+  printf("     NEMU       %s\n", ref->name);
+  int i;
+  for (i = 0; i < NR_DIFF_REG; i ++) {
+    printf("%s  0x%08x 0x%08x%s\n", names[i], diff_nemu.regs[i], diff_ref[i],
+        (diff_nemu.regs[i] != diff_ref[i] ? "  <==" : ""));
+  }
+  if (nr_diff_store >= 0) {
+    print_stores("NEMU", nemu_store, (nr_nemu_store < DIFF_MAX_STORE ? nr_nemu_store : DIFF_MAX_STORE));
+    print_stores(ref->name, diff_store, nr_diff_store);
+  }
+}
+
+/* Batched diff-test. NEMU puts a record of every instruction into a batch,
+ * and a full batch is checked by the QEMU thread, while NEMU goes on with
+ * the next one. */
+#define DIFF_QUEUE 4
+
+static DiffRecord *batch[DIFF_QUEUE];
+static int batch_len[DIFF_QUEUE];
+static DiffPages batch_pages[DIFF_QUEUE];
+static int fill = 0;
+static uint64_t head = 0, tail = 0;   /* batches consumed and produced */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+static void *qemu_thread(void *arg) {
+  while (1) {
+    pthread_mutex_lock(&lock);
+    while (head == tail) { pthread_cond_wait(&cond, &lock); }
+    int idx = head % DIFF_QUEUE;
+    pthread_mutex_unlock(&lock);
+
+    if (!diverged) { check_records(batch[idx], batch_len[idx]); }
+    if (!diverged) { check_pages(&batch_pages[idx], &batch[idx][batch_len[idx] - 1]); }
+
+    pthread_mutex_lock(&lock);
+    head ++;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&lock);
+  }
+  return NULL;
+}
+
+/* Called with the lock held. See seal_pages() for [lo, hi). */
+static void publish(uint32_t lo, uint32_t hi) {
+  seal_pages(&batch_pages[tail % DIFF_QUEUE], lo, hi);
+  batch_len[tail % DIFF_QUEUE] = fill;
+  tail ++;
+  fill = 0;
+  pthread_cond_broadcast(&cond);
+}
+
+/* Wait until QEMU has executed every instruction NEMU has executed. */
+static void flush(uint32_t lo, uint32_t hi) {
+  if (batch_size == 1) {
+    if (ref == &qemu_backend) { check_single_pages(lo, hi, nr_guest_instr); }
+    return;
+  }
+  pthread_mutex_lock(&lock);
+  if (fill > 0) { publish(lo, hi); }
+  while (head != tail) { pthread_cond_wait(&cond, &lock); }
+  pthread_mutex_unlock(&lock);
+}
+
+/* Only the batches are waited for at exit. */
+void difftest_flush(void) {
+  if (batch_size > 1) { flush(0, 0); }
+}
+
+/* Called when the execution stops. If QEMU disagreed, go back to the first
+ * divergent instruction with the checkpoints, so it can be examined. */
+void difftest_sync(void) {
+  flush(0, 0);
+  if (!diverged || reported) return;
+
+  report_divergence();
+  if (ckpt_enabled) { reverse_step(nr_guest_instr - diff_nemu.pos); }
+  nemu_state = NEMU_END;
+}
+
+/* Copy the memory of NEMU to the reference, e.g. after a DMA transfer. */
+void difftest_memcpy_to_ref(uint32_t addr, void *buf, int len) {
+  /* The reference must have caught up with NEMU before its memory is changed. */
+  flush(addr, addr + len);
+  ref->memcpy(addr, buf, len);
+}
+
+/* Copy the registers of NEMU to the reference. */
+void difftest_sync_regs(void) {
+  DiffRegs r;
+  nemu_regs(&r);
+  ref->setregs(&r);
+}
+
+/* NEMU has taken an interrupt between two instructions. Copy the frame
+ * pushed and the registers to the reference, and forget the stores of the
+ * frame, which are not made by the next instruction. */
+void difftest_sync_intr(vaddr_t frame, int len) {
+  nr_nemu_store = 0;
+  if (ckpt_replaying()) return;
+  difftest_memcpy_to_ref(frame, guest_to_host(frame), len);
+  difftest_sync_regs();
+}
+
+/* Also used by the fuzzing harness, see src/fuzz.c */
+DiffBackend *difftest_load_ref(const char *so) {
+  static DiffBackend lib;
+  void *handle = dlopen(so, RTLD_NOW | RTLD_LOCAL);
+  if (handle == NULL) {
+    Log("Can not load the reference: %s", dlerror());
+    return NULL;
+  }
+
+  lib.name = "REF";
+  lib.init = dlsym(handle, "difftest_init");
+  lib.memcpy = dlsym(handle, "difftest_memcpy");
+  lib.getregs = dlsym(handle, "difftest_getregs");
+  lib.setregs = dlsym(handle, "difftest_setregs");
+  lib.step = dlsym(handle, "difftest_step");
+  if (!(lib.init && lib.memcpy && lib.getregs && lib.setregs && lib.step)) {
+    Log("'%s' does not export the diff-test interface", so);
+    return NULL;
+  }
+  return &lib;
+}
+
+/* Start the reference given by `so', or QEMU if it is NULL, and check
+ * `n' instructions at a time. */
+void init_difftest(const char *so, int n) {
+  if (so != NULL) {
+    ref = difftest_load_ref(so);
+    Assert(ref != NULL, "Can not use '%s' as the reference", so);
+  }
+  ref->init(PMEM_SIZE);
+  Log("Diff-test against %s", (so != NULL ? so : ref->name));
+
+  atexit(difftest_flush);
+
+  if (n > 1 && ref != &qemu_backend) {
+    Log("Batching is only for QEMU, checking every instruction");
+  }
+  else if (n > 1) {
+    bool ok = gdb_noack_qemu();
+    Assert(ok, "QEMU does not support QStartNoAckMode");
+    int i;
+    for (i = 0; i < DIFF_QUEUE; i ++) {
+      batch[i] = malloc(sizeof(DiffRecord) * n);
+      assert(batch[i] != NULL);
+    }
+    batch_size = n;
+
+    pthread_t t;
+    int ret = pthread_create(&t, NULL, qemu_thread, NULL);
+    Assert(ret == 0, "Can not create the QEMU thread");
+    Log("Diff-test in batches of %d instructions", n);
+  }
+}
+
+static void step(uint32_t eip) {
+  /* The reference has executed the replayed instructions before. */
+  if (ckpt_replaying()) {
+    is_skip_nemu = is_skip_qemu = false;
+    return;
+  }
 
   if (is_skip_nemu) {
     is_skip_nemu = false;
     return;
   }
 
-  if (is_skip_qemu) {
-    // to skip the checking of an instruction, just copy the reg state to qemu
-    gdb_getregs(&r);
-    regcpy_from_nemu(r);
-    gdb_setregs(&r);
+  if (batch_size == 1) {
+    check_step(eip, is_skip_qemu);
     is_skip_qemu = false;
+    if (ref == &qemu_backend) {
+      note_pages(&single_pages);
+      if (++ single_fill == DIFF_MEM_INTERVAL) { check_single_pages(0, 0, nr_guest_instr + 1); }
+    }
+    if (diverged) {
+      report_divergence();
+      nemu_state = NEMU_END;
+    }
     return;
   }
 
-  gdb_si();
-  gdb_getregs(&r);
-
-  // TODO: Check the registers state with QEMU.
-  // Set `diff` as `true` if they are not the same.
-  TODO();
+  DiffRecord *r = &batch[tail % DIFF_QUEUE][fill];
+  record_nemu(r);
+  r->skip_qemu = is_skip_qemu;
+  is_skip_qemu = false;
+  note_pages(&batch_pages[tail % DIFF_QUEUE]);
 
-  if (diff) {
-    nemu_state = NEMU_END;
+  if (++ fill == batch_size) {
+    pthread_mutex_lock(&lock);
+    publish(0, 0);
+    while (tail - head == DIFF_QUEUE) { pthread_cond_wait(&cond, &lock); }
+    pthread_mutex_unlock(&lock);
   }
+
+  if (__atomic_load_n(&diverged, __ATOMIC_ACQUIRE)) { nemu_state = NEMU_END; }
+}
+
+void difftest_step(uint32_t eip) {
+  step(eip);
+  nr_nemu_store = 0;
 }
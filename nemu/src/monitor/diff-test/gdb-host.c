@@ -47,8 +47,44 @@ bool gdb_memcpy_to_qemu(uint32_t dest, void *src, int len) {
   return ok;
 }
 
-bool gdb_getregs(union gdb_regs *r) {
+static bool gdb_memcpy_from_qemu_small(void *dest, uint32_t src, int len) {
+  char buf[64];
+  sprintf(buf, "m0x%x,%x", src, len);
+  gdb_send(conn, (const uint8_t *)buf, strlen(buf));
+
+  size_t size;
+  uint8_t *reply = gdb_recv(conn, &size);
+  bool ok = (size == len * 2);
+  int i;
+  for (i = 0; ok && i < len; i ++) {
+    ((uint8_t *)dest)[i] = gdb_decode_hex(reply[i * 2], reply[i * 2 + 1]);
+  }
+  free(reply);
+
+  return ok;
+}
+
+bool gdb_memcpy_from_qemu(void *dest, uint32_t src, int len) {
+  const int mtu = 1024;
+  bool ok = true;
+  while (len > mtu) {
+    ok &= gdb_memcpy_from_qemu_small(dest, src, mtu);
+    dest += mtu;
+    src += mtu;
+    len -= mtu;
+  }
+  ok &= gdb_memcpy_from_qemu_small(dest, src, len);
+  return ok;
+}
+
+/* The requests below are split into a send and a receive half, so that
+ * the batched diff-test can have many of them in flight. */
+
+void gdb_send_getregs(void) {
   gdb_send(conn, (const uint8_t *)"g", 1);
+}
+
+void gdb_recv_getregs(union gdb_regs *r) {
   size_t size;
   uint8_t *reply = gdb_recv(conn, &size);
 
@@ -64,11 +100,15 @@ bool gdb_getregs(union gdb_regs *r) {
   }
 
   free(reply);
+}
 
+bool gdb_getregs(union gdb_regs *r) {
+  gdb_send_getregs();
+  gdb_recv_getregs(r);
   return true;
 }
 
-bool gdb_setregs(union gdb_regs *r) {
+void gdb_send_setregs(union gdb_regs *r) {
   int len = sizeof(union gdb_regs);
   char *buf = malloc(len * 2 + 128);
   assert(buf != NULL);
@@ -83,7 +123,9 @@ bool gdb_setregs(union gdb_regs *r) {
 
   gdb_send(conn, (const uint8_t *)buf, strlen(buf));
   free(buf);
+}
 
+bool gdb_recv_ok(void) {
   size_t size;
   uint8_t *reply = gdb_recv(conn, &size);
   bool ok = !strcmp((const char*)reply, "OK");
@@ -92,15 +134,33 @@ bool gdb_setregs(union gdb_regs *r) {
   return ok;
 }
 
-bool gdb_si(void) {
+bool gdb_setregs(union gdb_regs *r) {
+  gdb_send_setregs(r);
+  return gdb_recv_ok();
+}
+
+void gdb_send_si(void) {
   char buf[] = "vCont;s:1";
   gdb_send(conn, (const uint8_t *)buf, strlen(buf));
+}
+
+void gdb_recv_si(void) {
   size_t size;
   uint8_t *reply = gdb_recv(conn, &size);
   free(reply);
+}
+
+bool gdb_si(void) {
+  gdb_send_si();
+  gdb_recv_si();
   return true;
 }
 
+/* Requests can only be pipelined without acknowledgments. */
+bool gdb_noack_qemu(void) {
+  return gdb_start_noack(conn)[0] != '\0';
+}
+
 void gdb_exit(void) {
   gdb_end(conn);
 }
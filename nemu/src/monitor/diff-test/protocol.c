@@ -32,8 +32,10 @@
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 
+#include <fcntl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
 
 
 #include "protocol.h"
@@ -73,7 +75,7 @@ uint64_t gdb_decode_hex_str(uint8_t *bytes) {
 
 
 static struct gdb_conn* gdb_begin(int fd) {
-  struct gdb_conn *conn = calloc(1, sizeof(struct gdb_conn *));
+  struct gdb_conn *conn = calloc(1, sizeof(struct gdb_conn));
   if (conn == NULL)
     err(1, "calloc");
 
@@ -137,6 +139,55 @@ struct gdb_conn* gdb_begin_inet(const char *addr, uint16_t port) {
   return gdb_begin(fd);
 }
 
+// wait for a debugger to connect to a listening socket
+static struct gdb_conn* gdb_accept(int lfd, const struct sockaddr *sa, socklen_t len) {
+  if (bind(lfd, sa, len) != 0)
+    err(1, "bind");
+  if (listen(lfd, 1) != 0)
+    err(1, "listen");
+
+  int fd = accept(lfd, NULL, NULL);
+  if (fd < 0)
+    err(1, "accept");
+  close(lfd);
+
+  return gdb_begin(fd);
+}
+
+struct gdb_conn* gdb_accept_inet(uint16_t port) {
+  struct sockaddr_in sa = {
+    .sin_family = AF_INET,
+    .sin_port = htons(port),
+    .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+  };
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    err(1, "socket");
+
+  int tmp = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &tmp, sizeof(tmp));
+  struct gdb_conn *conn = gdb_accept(fd, (const struct sockaddr *)&sa, sizeof(sa));
+
+  // replies are small, do not let them wait for more data
+  tmp = 1;
+  setsockopt(fileno(conn->out), IPPROTO_TCP, TCP_NODELAY, &tmp, sizeof(tmp));
+  return conn;
+}
+
+struct gdb_conn* gdb_accept_unix(const char *path) {
+  struct sockaddr_un sa = { .sun_family = AF_UNIX };
+  if (strlen(path) >= sizeof(sa.sun_path))
+    errx(1, "Socket path too long: %s", path);
+  strcpy(sa.sun_path, path);
+  unlink(path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    err(1, "socket");
+  return gdb_accept(fd, (const struct sockaddr *)&sa, sizeof(sa));
+}
+
 
 void gdb_end(struct gdb_conn *conn) {
   fclose(conn->in);
@@ -312,3 +363,29 @@ const char* gdb_start_noack(struct gdb_conn *conn) {
     conn->ack = false;
   return ok ? "OK" : "";
 }
+
+// the server side of QStartNoAckMode, called after replying OK to it
+void gdb_set_noack(struct gdb_conn *conn) {
+  conn->ack = false;
+}
+
+// check for a ^C from the debugger without blocking. The input buffered
+// is looked at first, and any other byte is pushed back for gdb_recv().
+int gdb_poll_interrupt(struct gdb_conn *conn) {
+  int fd = fileno(conn->in);
+  int flags = fcntl(fd, F_GETFL);
+  fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+  int c = fgetc(conn->in);
+  fcntl(fd, F_SETFL, flags);
+
+  if (c == EOF) {
+    if (feof(conn->in))
+      errx(0, "recv: Connection closed");
+    clearerr(conn->in);
+    return 0;
+  }
+  if (c == 0x03)
+    return 1;
+  ungetc(c, conn->in);
+  return 0;
+}
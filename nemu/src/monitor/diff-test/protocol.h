@@ -39,6 +39,9 @@ uint8_t hex_encode(uint8_t digit);
 
 struct gdb_conn *gdb_begin_inet(const char *addr, uint16_t port);
 
+struct gdb_conn *gdb_accept_inet(uint16_t port);
+struct gdb_conn *gdb_accept_unix(const char *path);
+
 void gdb_end(struct gdb_conn *conn);
 
 void gdb_send(struct gdb_conn *conn, const uint8_t *command, size_t size);
@@ -46,3 +49,7 @@ void gdb_send(struct gdb_conn *conn, const uint8_t *command, size_t size);
 uint8_t *gdb_recv(struct gdb_conn *conn, size_t *size);
 
 const char * gdb_start_noack(struct gdb_conn *conn);
+
+void gdb_set_noack(struct gdb_conn *conn);
+
+int gdb_poll_interrupt(struct gdb_conn *conn);
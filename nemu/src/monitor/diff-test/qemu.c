@@ -0,0 +1,134 @@
+#include "common.h"
+#include "monitor/difftest.h"
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <signal.h>
+#include <stdlib.h>
+
+#include "protocol.h"
+
+bool gdb_connect_qemu(void);
+bool gdb_memcpy_to_qemu(uint32_t, void *, int);
+bool gdb_getregs(union gdb_regs *);
+bool gdb_setregs(union gdb_regs *);
+bool gdb_si(void);
+void gdb_exit(void);
+
+static uint8_t mbr[] = {
+  // start16:
+  0xfa,                           // cli
+  0x31, 0xc0,                     // xorw   %ax,%ax
+  0x8e, 0xd8,                     // movw   %ax,%ds
+  0x8e, 0xc0,                     // movw   %ax,%es
+  0x8e, 0xd0,                     // movw   %ax,%ss
+  0x0f, 0x01, 0x16, 0x44, 0x7c,   // lgdt   gdtdesc
+  0x0f, 0x20, 0xc0,               // movl   %cr0,%eax
+  0x66, 0x83, 0xc8, 0x01,         // orl    $CR0_PE,%eax
+  0x0f, 0x22, 0xc0,               // movl   %eax,%cr0
+  0xea, 0x1d, 0x7c, 0x08, 0x00,   // ljmp   $GDT_ENTRY(1),$start32
+
+  // start32:
+  0x66, 0xb8, 0x10, 0x00,         // movw   $0x10,%ax
+  0x8e, 0xd8,                     // movw   %ax, %ds
+  0x8e, 0xc0,                     // movw   %ax, %es
+  0x8e, 0xd0,                     // movw   %ax, %ss
+  0xeb, 0xfe,                     // jmp    7c27
+  0x8d, 0x76, 0x00,               // lea    0x0(%esi),%esi
+
+  // GDT
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0xff, 0xff, 0x00, 0x00, 0x00, 0x9a, 0xcf, 0x00,
+  0xff, 0xff, 0x00, 0x00, 0x00, 0x92, 0xcf, 0x00,
+
+  // GDT descriptor
+  0x17, 0x00, 0x2c, 0x7c, 0x00, 0x00
+};
+
+static void qemu_init(size_t mem_size) {
+  int ppid_before_fork = getpid();
+  int pid = fork();
+  if (pid == -1) {
+    perror("fork");
+    panic("fork error");
+  }
+  else if (pid == 0) {
+    // child
+
+    // install a parent death signal in the chlid
+    int r = prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if (r == -1) {
+      perror("prctl error");
+      panic("prctl");
+    }
+
+    if (getppid() != ppid_before_fork) {
+      panic("parent has died!");
+    }
+
+    close(STDIN_FILENO);
+    execlp("qemu-system-i386", "qemu-system-i386", "-S", "-s", "-nographic", NULL);
+    perror("exec");
+    panic("exec error");
+  }
+  else {
+    // father
+
+    gdb_connect_qemu();
+    Log("Connect to QEMU successfully");
+
+    atexit(gdb_exit);
+
+    // put the MBR code to QEMU to enable protected mode
+    bool ok = gdb_memcpy_to_qemu(0x7c00, mbr, sizeof(mbr));
+    assert(ok == 1);
+
+    union gdb_regs r;
+    gdb_getregs(&r);
+
+    // set cs:eip to 0000:7c00
+    r.eip = 0x7c00;
+    r.cs = 0x0000;
+    ok = gdb_setregs(&r);
+    assert(ok == 1);
+
+    // execute enough instructions to enter protected mode
+    int i;
+    for (i = 0; i < 20; i ++) {
+      gdb_si();
+    }
+  }
+}
+
+static void qemu_memcpy(uint32_t addr, const void *buf, size_t n) {
+  bool ok = gdb_memcpy_to_qemu(addr, (void *)buf, n);
+  assert(ok == 1);
+}
+
+static void qemu_getregs(DiffRegs *r) {
+  union gdb_regs q;
+  gdb_getregs(&q);
+  memcpy(r, q.array, sizeof(*r));
+}
+
+static void qemu_setregs(const DiffRegs *r) {
+  /* Keep the segment registers of QEMU. */
+  union gdb_regs q;
+  gdb_getregs(&q);
+  memcpy(q.array, r, sizeof(*r));
+  bool ok = gdb_setregs(&q);
+  assert(ok == 1);
+}
+
+static int qemu_step(DiffStore *stores, int max) {
+  gdb_si();
+  return DIFF_NO_STORE;
+}
+
+DiffBackend qemu_backend = {
+  .name = "QEMU",
+  .init = qemu_init,
+  .memcpy = qemu_memcpy,
+  .getregs = qemu_getregs,
+  .setregs = qemu_setregs,
+  .step = qemu_step,
+};
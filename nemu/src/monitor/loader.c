@@ -0,0 +1,107 @@
+#include "nemu.h"
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* Load an i386 ELF executable to the guest memory by its PT_LOAD segments.
+ *
+ * The pages of a segment which are entirely backed by the file are mapped
+ * privately from the file in place, so a large image costs nothing until the
+ * guest touches it. This needs the offset in the file and the address in the
+ * guest memory to be congruent modulo the page size, which is the usual case
+ * for a linked executable. The rest of the file data is read. The part of
+ * the segment beyond the file (bss) is zeroed, since the context may have run
+ * before: its whole pages are replaced by fresh anonymous ones.
+ */
+
+static bool read_full(int fd, void *buf, size_t size, off_t offset) {
+  while (size > 0) {
+    ssize_t n = pread(fd, buf, size, offset);
+    if (n <= 0) return false;
+    buf += n;
+    size -= n;
+    offset += n;
+  }
+  return true;
+}
+
+static void zero_fill(uint8_t *dst, size_t size) {
+  uintptr_t page_size = sysconf(_SC_PAGESIZE);
+  uintptr_t lo = ((uintptr_t)dst + page_size - 1) & ~(page_size - 1);
+  uintptr_t hi = ((uintptr_t)dst + size) & ~(page_size - 1);
+  if (lo < hi && mmap((void *)lo, hi - lo, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != MAP_FAILED) {
+    memset(dst, 0, lo - (uintptr_t)dst);
+    memset((void *)hi, 0, (uintptr_t)dst + size - hi);
+    return;
+  }
+  memset(dst, 0, size);
+}
+
+static bool load_segment(int fd, const Elf32_Phdr *ph) {
+  uintptr_t page_size = sysconf(_SC_PAGESIZE);
+  uint8_t *dst = guest_to_host(ph->p_paddr);
+  size_t size = ph->p_filesz;
+  off_t offset = ph->p_offset;
+
+  if (((uintptr_t)dst - offset) % page_size == 0) {
+    uintptr_t lo = ((uintptr_t)dst + page_size - 1) & ~(page_size - 1);
+    uintptr_t hi = ((uintptr_t)dst + size) & ~(page_size - 1);
+    if (lo < hi) {
+      off_t map_offset = offset + (lo - (uintptr_t)dst);
+      void *p = mmap((void *)lo, hi - lo, PROT_READ | PROT_WRITE,
+          MAP_PRIVATE | MAP_FIXED, fd, map_offset);
+      if (p != MAP_FAILED) {
+        /* read the partial pages at both ends */
+        return read_full(fd, dst, lo - (uintptr_t)dst, offset) &&
+          read_full(fd, (void *)hi, (uintptr_t)dst + size - hi, map_offset + (hi - lo));
+      }
+    }
+  }
+
+  return read_full(fd, dst, size, offset);
+}
+
+/* Return 0 on success with the entry point in `entry', 1 if `file' is not an
+ * ELF file, or -1 if it is an ELF file which can not be loaded. */
+int load_elf(const char *file, vaddr_t *entry) {
+  int fd = open(file, O_RDONLY);
+  if (fd < 0) return -1;
+
+  int ret = -1;
+  Elf32_Ehdr eh;
+  if (!read_full(fd, &eh, sizeof(eh), 0) || memcmp(eh.e_ident, ELFMAG, SELFMAG) != 0) {
+    ret = 1;
+    goto out;
+  }
+  if (eh.e_ident[EI_CLASS] != ELFCLASS32 || eh.e_machine != EM_386 ||
+      eh.e_type != ET_EXEC || eh.e_phentsize != sizeof(Elf32_Phdr)) {
+    goto out;
+  }
+
+  int i;
+  for (i = 0; i < eh.e_phnum; i ++) {
+    Elf32_Phdr ph;
+    if (!read_full(fd, &ph, sizeof(ph), eh.e_phoff + i * sizeof(ph))) goto out;
+    if (ph.p_type != PT_LOAD || ph.p_memsz == 0) continue;
+    if (ph.p_filesz > ph.p_memsz || ph.p_paddr >= PMEM_SIZE ||
+        ph.p_memsz > PMEM_SIZE - ph.p_paddr) {
+      goto out;
+    }
+    if (!load_segment(fd, &ph)) goto out;
+    zero_fill(guest_to_host(ph.p_paddr + ph.p_filesz), ph.p_memsz - ph.p_filesz);
+
+#ifdef DIFF_TEST
+    void difftest_memcpy_to_ref(uint32_t, void *, int);
+    difftest_memcpy_to_ref(ph.p_paddr, guest_to_host(ph.p_paddr), ph.p_memsz);
+#endif
+  }
+
+  *entry = eh.e_entry;
+  ret = 0;
+
+out:
+  close(fd);
+  return ret;
+}
@@ -1,21 +1,88 @@
 #include "nemu.h"
+#include "monitor/symbol.h"
+#include "monitor/profile.h"
+#include "monitor/reverse.h"
+#include "monitor/simpoint.h"
+#include "monitor/gdbstub.h"
+#include "cpu/exec.h"
 #include <unistd.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <time.h>
 
-#define ENTRY_START 0x100000
-
-void init_difftest();
-void init_regex();
+void init_difftest(const char *, int);
 void init_wp_pool();
 void init_device();
+void init_mpe(int);
+void init_coverage(const char *);
+void init_serial_input(const char *);
+void init_disk(const char *);
+void init_audio_dump(const char *);
+int load_elf(const char *, vaddr_t *);
 
 void reg_test();
-void init_qemu_reg();
-bool gdb_memcpy_to_qemu(uint32_t, void *, int);
+void difftest_sync_regs();
+void difftest_memcpy_to_ref(uint32_t, void *, int);
 
 FILE *log_fp = NULL;
 static char *log_file = NULL;
 static char *img_file = NULL;
+static char *serial_in_file = NULL;
+static char *disk_file = NULL;
+static char *audio_dump_file = NULL;
+static char *elf_file = NULL;
+static char *profile_file = NULL;
+static uint64_t profile_period = 10000;
+static char *opstat_file = NULL;
+static char *coverage_file = NULL;
+static char *bbv_file = NULL;
+static char *simpoint_prefix = NULL;
+static uint64_t bbv_interval = 1000000;
+static uint64_t checkpoint_interval = 0;
+static size_t checkpoint_budget = 256;
+static char *gdb_addr = NULL;
+static int difftest_batch = 1;
+static char *difftest_ref = NULL;
+static int nr_cpu = 1;
+uint64_t max_instr = -1;
 static int is_batch_mode = false;
+static vaddr_t img_entry = ENTRY_START;
+static int verbose = false;
+
+/* The time spent in each step of the startup, reported with -v */
+#define NR_STARTUP_STEP 16
+static struct {
+  const char *name;
+  uint64_t us;
+} startup_step[NR_STARTUP_STEP];
+static int nr_startup_step = 0;
+static uint64_t startup_time;
+
+static uint64_t now_us() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000ull + t.tv_nsec / 1000;
+}
+
+static void startup_done(const char *name) {
+  uint64_t now = now_us();
+  assert(nr_startup_step < NR_STARTUP_STEP);
+  startup_step[nr_startup_step].name = name;
+  startup_step[nr_startup_step].us = now - startup_time;
+  nr_startup_step ++;
+  startup_time = now;
+}
+
+static void startup_report() {
+  uint64_t total = 0;
+  int i;
+  fprintf(stderr, "nemu: startup\n");
+  for (i = 0; i < nr_startup_step; i ++) {
+    fprintf(stderr, "  %-12s %8.3f ms\n", startup_step[i].name, startup_step[i].us / 1000.0);
+    total += startup_step[i].us;
+  }
+  fprintf(stderr, "  %-12s %8.3f ms\n", "total", total / 1000.0);
+}
 
 static inline void init_log() {
 #ifdef DEBUG
@@ -57,7 +124,14 @@ static inline void load_img() {
     size = load_default_img();
   }
   else {
-    int ret;
+    /* An ELF file is loaded by its segments, and provides the symbols. */
+    int ret = load_elf(img_file, &img_entry);
+    Assert(ret != -1, "Can not load the ELF file '%s'", img_file);
+    if (ret == 0) {
+      Log("The image is %s, entry at 0x%08x", img_file, img_entry);
+      if (elf_file == NULL) { elf_file = img_file; }
+      return;
+    }
 
     FILE *fp = fopen(img_file, "rb");
     Assert(fp, "Can not open '%s'", img_file);
@@ -75,71 +149,243 @@ static inline void load_img() {
   }
 
 #ifdef DIFF_TEST
-  gdb_memcpy_to_qemu(ENTRY_START, guest_to_host(ENTRY_START), size);
+  difftest_memcpy_to_ref(ENTRY_START, guest_to_host(ENTRY_START), size);
 #endif
 }
 
+static void write_opstat() {
+  int len = strlen(opstat_file);
+  bool json = (len >= 5 && strcmp(opstat_file + len - 5, ".json") == 0);
+  FILE *fp = (strcmp(opstat_file, "-") == 0 ? stdout : fopen(opstat_file, "w"));
+  if (fp == NULL) {
+    Log("Can not open '%s'", opstat_file);
+    return;
+  }
+  opstat_report(fp, json);
+  if (fp != stdout) { fclose(fp); }
+}
+
 static inline void restart() {
   /* Set the initial instruction pointer. */
-  cpu.eip = ENTRY_START;
+  cpu.eip = img_entry;
   // set eflags
   cpu.eflags.val=0x00000002;
+  cpu.cs = 8;
 
 #ifdef DIFF_TEST
-  init_qemu_reg();
+  difftest_sync_regs();
 #endif
 }
 
+static void usage(FILE *fp, const char *prog) {
+  fprintf(fp, "Usage: %s [OPTION...] [img_file]\n\n", prog);
+  fprintf(fp, "\t-b,--batch              run with batch mode\n");
+  fprintf(fp, "\t-l,--log=FILE           output log to FILE\n");
+  fprintf(fp, "\t-i,--serial-in=FILE     feed the serial port with FILE ('-' for stdin)\n");
+  fprintf(fp, "\t-d,--disk=FILE          use FILE as the image of the disk device\n");
+  fprintf(fp, "\t-a,--audio-dump=FILE    write the audio output to the WAV file FILE instead of playing it\n");
+  fprintf(fp, "\t-e,--elf=FILE           load the guest symbols from the ELF file FILE (default: img_file if it is ELF)\n");
+  fprintf(fp, "\t-p,--profile=FILE       profile the guest and write the folded stacks to FILE\n");
+  fprintf(fp, "\t-P,--profile-period=N   take a profiling sample every N instructions (default 10000)\n");
+  fprintf(fp, "\t-o,--opstat=FILE        count the executed opcodes and write the statistics to FILE at exit\n");
+  fprintf(fp, "\t                        in JSON if FILE ends with .json, '-' for stdout\n");
+  fprintf(fp, "\t-F,--coverage=FILE      write the AFL bitmap of the decoder coverage to FILE at exit,\n");
+  fprintf(fp, "\t                        or to the shared memory of afl-fuzz if __AFL_SHM_ID is set\n");
+  fprintf(fp, "\t-V,--bbv=FILE           write the basic block vector of every interval to FILE for tools/simpoint.py\n");
+  fprintf(fp, "\t-N,--bbv-interval=N     cut the run into intervals of N instructions (default 1000000)\n");
+  fprintf(fp, "\t-S,--simpoints=PREFIX   only collect the statistics in the intervals in PREFIX.simpoints,\n");
+  fprintf(fp, "\t                        and combine them by the weights in PREFIX.weights\n");
+  fprintf(fp, "\t-c,--checkpoint=N       take a checkpoint every N instructions for reverse execution\n");
+  fprintf(fp, "\t-C,--checkpoint-budget=MB  keep at most MB megabytes of checkpoints (default 256)\n");
+  fprintf(fp, "\t-g,--gdb=PORT|PATH     wait for gdb on localhost:PORT or the Unix socket PATH\n");
+  fprintf(fp, "\t-B,--difftest-batch=N  let QEMU check N instructions at a time on another thread\n");
+  fprintf(fp, "\t-R,--difftest-ref=SO   check against the reference in the shared library SO instead of QEMU\n");
+  fprintf(fp, "\t-n,--nr-cpu=N          run the guest on N processors (at most 8)\n");
+  fprintf(fp, "\t-I,--max-instr=N       stop after N instructions in batch mode\n");
+  fprintf(fp, "\t-v,--verbose           report the time spent in each step of the startup, and the run time in batch mode\n");
+  fprintf(fp, "\t-h,--help              print this help and exit\n");
+  fprintf(fp, "\n");
+}
+
 static inline void parse_args(int argc, char *argv[]) {
+  const struct option table[] = {
+    {"batch"    , no_argument      , NULL, 'b'},
+    {"log"      , required_argument, NULL, 'l'},
+    {"serial-in", required_argument, NULL, 'i'},
+    {"disk"     , required_argument, NULL, 'd'},
+    {"audio-dump", required_argument, NULL, 'a'},
+    {"elf"      , required_argument, NULL, 'e'},
+    {"profile"  , required_argument, NULL, 'p'},
+    {"profile-period", required_argument, NULL, 'P'},
+    {"opstat"   , required_argument, NULL, 'o'},
+    {"coverage" , required_argument, NULL, 'F'},
+    {"bbv"      , required_argument, NULL, 'V'},
+    {"bbv-interval", required_argument, NULL, 'N'},
+    {"simpoints", required_argument, NULL, 'S'},
+    {"checkpoint", required_argument, NULL, 'c'},
+    {"checkpoint-budget", required_argument, NULL, 'C'},
+    {"gdb"      , required_argument, NULL, 'g'},
+    {"difftest-batch", required_argument, NULL, 'B'},
+    {"difftest-ref", required_argument, NULL, 'R'},
+    {"nr-cpu"   , required_argument, NULL, 'n'},
+    {"max-instr", required_argument, NULL, 'I'},
+    {"verbose"  , no_argument      , NULL, 'v'},
+    {"help"     , no_argument      , NULL, 'h'},
+    {0          , 0                , NULL,  0 },
+  };
   int o;
-  while ( (o = getopt(argc, argv, "-bl:")) != -1) {
+  while ( (o = getopt_long(argc, argv, "-bl:i:d:a:e:p:P:o:F:V:N:S:c:C:g:B:R:n:I:vh", table, NULL)) != -1) {
     switch (o) {
       case 'b': is_batch_mode = true; break;
       case 'l': log_file = optarg; break;
+      case 'i': serial_in_file = optarg; break;
+      case 'd': disk_file = optarg; break;
+      case 'a': audio_dump_file = optarg; break;
+      case 'e': elf_file = optarg; break;
+      case 'p': profile_file = optarg; break;
+      case 'P': profile_period = strtoull(optarg, NULL, 0); break;
+      case 'o': opstat_file = optarg; break;
+      case 'F': coverage_file = optarg; break;
+      case 'V': bbv_file = optarg; break;
+      case 'N': bbv_interval = strtoull(optarg, NULL, 0); break;
+      case 'S': simpoint_prefix = optarg; break;
+      case 'c': checkpoint_interval = strtoull(optarg, NULL, 0); break;
+      case 'C': checkpoint_budget = strtoull(optarg, NULL, 0); break;
+      case 'g': gdb_addr = optarg; break;
+      case 'B': difftest_batch = atoi(optarg); break;
+      case 'R': difftest_ref = optarg; break;
+      case 'n': nr_cpu = atoi(optarg); break;
+      case 'I': max_instr = strtoull(optarg, NULL, 0); break;
+      case 'v': verbose = true; break;
       case 1:
                 if (img_file != NULL) Log("too much argument '%s', ignored", optarg);
                 else img_file = optarg;
                 break;
+      case 'h':
+                usage(stdout, argv[0]);
+                exit(0);
       default:
-                panic("Usage: %s [-b] [-l log_file] [img_file]", argv[0]);
+                /* getopt_long() has told what is wrong with the option */
+                usage(stderr, argv[0]);
+                exit(1);
     }
   }
 }
 
+/* The exit status of NEMU in batch mode: the exit code of the guest at
+ * `nemu_trap' (1 if its low byte is 0 for a bad trap), 124 like timeout(1)
+ * if the guest is stopped by --max-instr, or 125 if it is stopped before
+ * the end for another reason, e.g. a breakpoint or a watchpoint. A
+ * detailed SimPoint run stopped after its last interval succeeds. The
+ * number of instructions is reported for tools/regress.py. */
+int batch_exit_status() {
+  bool ended = (nemu_state == NEMU_END);
+  bool limit = (!ended && !sp_finished && nr_guest_instr >= max_instr);
+  fprintf(stderr, "nemu: %" PRIu64 " instructions%s\n", nr_guest_instr,
+      (ended ? "" : sp_finished ? ", stopped after the last simpoint" :
+       limit ? ", stopped at the limit" : ", stopped before the end"));
+  if (verbose) { fprintf(stderr, "nemu: run %.3f ms\n", (now_us() - startup_time) / 1000.0); }
+  if (!ended) { return (sp_finished ? 0 : limit ? 124 : 125); }
+
+  uint32_t ret = nemu_ctx->halt_ret;
+  return (ret == 0 ? 0 : (ret & 0xff) != 0 ? (ret & 0xff) : 1);
+}
+
 int init_monitor(int argc, char *argv[]) {
   /* Perform some global initialization. */
+  startup_time = now_us();
 
   /* Parse arguments. */
   parse_args(argc, argv);
 
   /* Open the log file. */
   init_log();
+  startup_done("arguments");
 
   /* Test the implementation of the `CPU_state' structure. */
   reg_test();
+  startup_done("reg test");
 
 #ifdef DIFF_TEST
-  /* Fork a child process to perform differential testing. */
-  init_difftest();
+  /* Start the reference to perform differential testing. */
+  init_difftest(difftest_ref, difftest_batch);
+  startup_done("diff-test");
 #endif
 
   /* Load the image to memory. */
   load_img();
+  startup_done("image");
+
+  /* Load the guest symbols for the debugger and the profiler. */
+  if (elf_file != NULL) { init_symbols(elf_file); }
+
+  if (profile_file != NULL) { init_profile(profile_file, profile_period); }
+
+  if (opstat_file != NULL) {
+    opstat_enabled = true;
+    atexit(write_opstat);
+  }
+  startup_done("symbols");
+
+  /* Record the coverage for a fuzzer. */
+  init_coverage(coverage_file);
 
   /* Initialize this virtual computer system. */
   restart();
 
-  /* Compile the regular expressions. */
-  init_regex();
-
   /* Initialize the watchpoint pool. */
   init_wp_pool();
 
   /* Initialize devices. */
   init_device();
 
+  /* The other processors are started by the guest. */
+  init_mpe(nr_cpu);
+
+  /* Both passes of SimPoint count the instructions from the start. */
+  if (bbv_file != NULL || simpoint_prefix != NULL) {
+    Assert(bbv_file == NULL || simpoint_prefix == NULL, "--bbv and --simpoints are two different runs");
+    Assert(opstat_file == NULL || simpoint_prefix == NULL, "--simpoints collects the opcode statistics itself");
+    Assert(nr_cpu == 1, "SimPoint sampling only supports one processor");
+    if (bbv_file != NULL) { init_bbv(bbv_file, bbv_interval); }
+    else { init_simpoint(simpoint_prefix, bbv_interval); }
+  }
+
+#ifdef HAS_IOE
+  /* Connect the input of the serial port. */
+  if (serial_in_file != NULL) { init_serial_input(serial_in_file); }
+
+  /* Attach the disk image. */
+  if (disk_file != NULL) { init_disk(disk_file); }
+
+  /* Record the audio output instead of playing it. */
+  if (audio_dump_file != NULL) { init_audio_dump(audio_dump_file); }
+#else
+  Assert(serial_in_file == NULL && disk_file == NULL && audio_dump_file == NULL,
+      "--serial-in, --disk and --audio-dump need the devices, define HAS_IOE in include/common.h");
+#endif
+  startup_done("devices");
+
+#ifdef DIFF_TEST
+  /* A divergence found by the batched diff-test is located by going back. */
+  if (difftest_batch > 1 && checkpoint_interval == 0) { checkpoint_interval = 1000000; }
+  Assert(nr_cpu == 1, "Differential testing only supports one processor");
+#endif
+
+  /* Take the first checkpoint after the devices are set up. */
+  Assert(nr_cpu == 1 || checkpoint_interval == 0, "Reverse execution only supports one processor");
+  if (checkpoint_interval != 0) {
+    init_reverse(checkpoint_interval, checkpoint_budget << 20);
+    startup_done("checkpoint");
+  }
+
   /* Display welcome message. */
   welcome();
 
+  if (verbose) { startup_report(); }
+
+  /* Let gdb take the place of the monitor. */
+  if (gdb_addr != NULL) { init_gdbstub(gdb_addr); }
+
   return is_batch_mode;
 }
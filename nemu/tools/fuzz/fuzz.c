@@ -0,0 +1,367 @@
+/* A persistent fuzzer of the decoder and the executor of NEMU.
+ *
+ * Each worker process runs random cases on one NEMU context with
+ * nemu_fuzz_one() (see include/libnemu.h), so a case costs a few restored
+ * pages instead of a new process. The workers run on all the processors.
+ * They are forked from the context set up by the parent, so a worker killed
+ * by a case starts again at the cost of a fork.
+ *
+ * A case is a few random bytes of code with random registers. A case where
+ * NEMU and the reference disagree is saved as `diverge-XXXX.case', named by
+ * the bytes of the instruction, and a case killing a worker or running for
+ * too long is saved as `crash-N.case' or `hang-N.case'; the worker is then
+ * started again. The instructions NEMU does not implement are counted. A
+ * saved case is the 40 bytes of NEMURegs followed by the code, and can be run
+ * again with -R.
+ */
+
+#define _GNU_SOURCE
+#include "libnemu.h"
+#include <inttypes.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_CODE 16
+#define MAX_WORKER 64
+#define CODE_START 0x100000
+#define DATA_START 0x200000
+#define STACK_TOP 0x300000
+/* a worker not finishing a case in this many seconds is hung */
+#define HANG_TIME 5
+
+typedef struct {
+  NEMURegs regs;
+  int len;
+  uint8_t code[MAX_CODE];
+} Case;
+
+#define NR_STATUS (NEMU_FUZZ_REF_FAIL + 1)
+
+/* shared by a worker and the parent */
+typedef struct {
+  volatile Case cur;        /* the case being run */
+  volatile uint64_t nr_case, nr_instr;
+  volatile uint64_t nr_status[NR_STATUS];
+  volatile uint64_t unimpl[512];  /* by opcode, 0x1xx for 0f xx */
+  volatile int stop;
+  pid_t pid;
+  uint64_t last_nr_case;
+  time_t last_change;
+} Worker;
+
+static const char *ref_so = REF_SO;
+static const char *out_dir = "fuzz-out";
+static int nr_worker = 0;
+static int duration = 10;
+static int max_instr = 8;
+static unsigned seed = 1;
+static Worker *workers;
+/* set up once and inherited by the workers, so restarting one is cheap */
+static NEMUContext *ctx;
+static int nr_crash = 0, nr_hang = 0;
+
+static uint32_t rand32(unsigned *s) {
+  /* xorshift32 */
+  uint32_t x = *s;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *s = x;
+}
+
+static uint32_t rand_val(unsigned *s) {
+  static const uint32_t special[] = { 0, 1, 2, 0x7f, 0x80, 0xff, 0x7fffffff, 0x80000000, 0xffffffff };
+  switch (rand32(s) % 4) {
+    case 0: return special[rand32(s) % (sizeof(special) / sizeof(special[0]))];
+    case 1: return rand32(s) % 64;
+    case 2: return DATA_START + rand32(s) % 0x10000;
+    default: return rand32(s);
+  }
+}
+
+static void gen_case(Case *c, unsigned *s) {
+  uint32_t *r = &c->regs.eax;
+  int i;
+  for (i = 0; i < 8; i ++) { r[i] = rand_val(s); }
+  /* A string instruction with rep is one step of the reference. */
+  c->regs.ecx %= 256;
+  c->regs.esp = STACK_TOP - 4 * (rand32(s) % 16);
+  c->regs.eip = CODE_START;
+  /* CF, ZF, SF and OF, without IF */
+  c->regs.eflags = rand32(s) & 0x8c1;
+  c->len = 1 + rand32(s) % MAX_CODE;
+  for (i = 0; i < c->len; i ++) { c->code[i] = rand32(s); }
+}
+
+static void save_case(const char *name, const Case *c) {
+  char path[256];
+  snprintf(path, sizeof(path), "%s/%s", out_dir, name);
+  int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+  if (fd < 0) return;  /* already found */
+  if (write(fd, &c->regs, sizeof(c->regs)) != sizeof(c->regs) ||
+      write(fd, c->code, c->len) != c->len) {
+    fprintf(stderr, "Can not write %s\n", path);
+  }
+  close(fd);
+}
+
+static NEMUContext *new_context() {
+  NEMUContext *ctx = nemu_create();
+  if (ctx == NULL || nemu_fuzz_init(ctx, ref_so) != 0) {
+    fprintf(stderr, "Can not set up NEMU with the reference %s\n", ref_so);
+    exit(1);
+  }
+  return ctx;
+}
+
+static void worker_main(Worker *w, unsigned s) {
+  Case c;
+  while (!w->stop) {
+    gen_case(&c, &s);
+    memcpy((void *)&w->cur, &c, sizeof(c));
+    __sync_synchronize();
+
+    NEMUFuzzResult res;
+    int status = nemu_fuzz_one(ctx, c.code, c.len, &c.regs, max_instr, &res);
+    uint32_t off = res.eip - CODE_START;
+    int opcode = (off < c.len ? c.code[off] : 0);
+    if (opcode == 0x0f && off + 1 < c.len) { opcode = 0x100 | c.code[off + 1]; }
+
+    if (status == NEMU_FUZZ_DIVERGED) {
+      char name[32];
+      snprintf(name, sizeof(name), "diverge-%03x.case", opcode);
+      save_case(name, &c);
+    }
+    else if (status == NEMU_FUZZ_UNIMPL) { w->unimpl[opcode] ++; }
+    w->nr_status[status] ++;
+    w->nr_instr += res.nr_instr;
+    w->nr_case ++;
+  }
+  exit(0);
+}
+
+static void start_worker(int i) {
+  Worker *w = &workers[i];
+  w->stop = 0;
+  w->last_change = time(NULL);
+  w->last_nr_case = w->nr_case;
+  /* a new seed for every start, so a crash is not repeated */
+  unsigned s = seed * 2654435761u + i * 40503u + (unsigned)w->nr_case + 1;
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    char log[256];
+    snprintf(log, sizeof(log), "%s/worker-%d.log", out_dir, i);
+    int fd = open(log, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd >= 0) {
+      dup2(fd, 1);
+      dup2(fd, 2);
+      close(fd);
+    }
+    worker_main(w, s);
+  }
+  w->pid = pid;
+}
+
+/* Save the case of a worker which has died or hung, and restart it. */
+static void worker_lost(int i, bool hung) {
+  Worker *w = &workers[i];
+  Case c;
+  memcpy(&c, (void *)&w->cur, sizeof(c));
+  char name[32];
+  snprintf(name, sizeof(name), "%s-%d.case", (hung ? "hang" : "crash"), (hung ? nr_hang ++ : nr_crash ++));
+  save_case(name, &c);
+  start_worker(i);
+}
+
+static void print_stats(double elapsed, bool final) {
+  uint64_t nr_case = 0, nr_instr = 0, st[NR_STATUS] = { 0 };
+  int i, j;
+  for (i = 0; i < nr_worker; i ++) {
+    nr_case += workers[i].nr_case;
+    nr_instr += workers[i].nr_instr;
+    for (j = 0; j < NR_STATUS; j ++) { st[j] += workers[i].nr_status[j]; }
+  }
+  printf("%6.1fs %12" PRIu64 " cases %10.0f cases/s %6.2f instr/case | same %" PRIu64
+      " diverged %" PRIu64 " unimplemented %" PRIu64 " ref-failed %" PRIu64 " crashes %d hangs %d\n",
+      elapsed, nr_case, nr_case / elapsed, (nr_case ? (double)nr_instr / nr_case : 0),
+      st[NEMU_FUZZ_SAME], st[NEMU_FUZZ_DIVERGED], st[NEMU_FUZZ_UNIMPL], st[NEMU_FUZZ_REF_FAIL],
+      nr_crash, nr_hang);
+  fflush(stdout);
+  if (!final) return;
+
+  /* the unimplemented opcodes found most often */
+  uint64_t count[512] = { 0 };
+  for (i = 0; i < nr_worker; i ++) {
+    for (j = 0; j < 512; j ++) { count[j] += workers[i].unimpl[j]; }
+  }
+  printf("unimplemented opcodes:");
+  for (i = 0; i < 16; i ++) {
+    int best = 0;
+    for (j = 1; j < 512; j ++) { if (count[j] > count[best]) best = j; }
+    if (count[best] == 0) break;
+    printf((best < 0x100 ? " %02x" : " 0f %02x"), best & 0xff);
+    count[best] = 0;
+  }
+  printf("\n");
+}
+
+static double now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static int fuzz() {
+  mkdir(out_dir, 0755);
+  workers = mmap(NULL, sizeof(Worker) * nr_worker, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (workers == MAP_FAILED) {
+    perror("mmap");
+    return 1;
+  }
+  memset(workers, 0, sizeof(Worker) * nr_worker);
+  ctx = new_context();
+
+  /* SIGCHLD is taken by sigtimedwait() below, so that a dead worker is
+   * restarted at once instead of at the next poll. */
+  sigset_t chld;
+  sigemptyset(&chld);
+  sigaddset(&chld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &chld, NULL);
+
+  int i;
+  for (i = 0; i < nr_worker; i ++) { start_worker(i); }
+
+  /* A dead worker is restarted at once, the statistics are shown every second. */
+  double start = now(), next_report = start + 1;
+  while (now() - start < duration) {
+    struct timespec poll = { .tv_sec = 0, .tv_nsec = 10000000 };
+    sigtimedwait(&chld, NULL, &poll);
+    time_t t = time(NULL);
+    for (i = 0; i < nr_worker; i ++) {
+      Worker *w = &workers[i];
+      int st;
+      if (waitpid(w->pid, &st, WNOHANG) == w->pid) {
+        worker_lost(i, false);
+      }
+      else if (w->nr_case != w->last_nr_case) {
+        w->last_nr_case = w->nr_case;
+        w->last_change = t;
+      }
+      else if (t - w->last_change >= HANG_TIME) {
+        kill(w->pid, SIGKILL);
+        waitpid(w->pid, &st, 0);
+        worker_lost(i, true);
+      }
+    }
+    if (now() >= next_report) {
+      print_stats(now() - start, false);
+      next_report += 1;
+    }
+  }
+
+  for (i = 0; i < nr_worker; i ++) { workers[i].stop = 1; }
+  for (i = 0; i < nr_worker; i ++) {
+    /* a hung worker does not see `stop' */
+    int st;
+    time_t t = time(NULL);
+    while (waitpid(workers[i].pid, &st, WNOHANG) == 0) {
+      if (time(NULL) - t >= HANG_TIME) {
+        kill(workers[i].pid, SIGKILL);
+      }
+      usleep(10000);
+    }
+  }
+  print_stats(now() - start, true);
+  printf("findings are in %s/\n", out_dir);
+  return 0;
+}
+
+static int replay(const char *file) {
+  Case c;
+  FILE *fp = fopen(file, "rb");
+  if (fp == NULL || fread(&c.regs, sizeof(c.regs), 1, fp) != 1) {
+    fprintf(stderr, "Can not read %s\n", file);
+    return 1;
+  }
+  c.len = fread(c.code, 1, MAX_CODE, fp);
+  fclose(fp);
+
+  ctx = new_context();
+  NEMUFuzzResult res;
+  static const char *status[] = { "same", "diverged", "unimplemented", "failed in the reference" };
+  int ret = nemu_fuzz_one(ctx, c.code, c.len, &c.regs, max_instr, &res);
+  if (ret < 0) {
+    fprintf(stderr, "The code does not fit in the memory\n");
+    return 1;
+  }
+
+  int i;
+  printf("code:");
+  for (i = 0; i < c.len; i ++) { printf(" %02x", c.code[i]); }
+  printf("\n%s after %d instructions, the last at eip = 0x%08x\n", status[ret], res.nr_instr, res.eip);
+  static const char *names[] = { "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi", "eip", "eflags" };
+  const uint32_t *start = &c.regs.eax, *n = &res.nemu.eax, *r = &res.ref.eax;
+  printf("          start       NEMU        reference\n");
+  for (i = 0; i < 10; i ++) {
+    printf("%-6s  0x%08x  0x%08x  0x%08x%s\n", names[i], start[i], n[i], r[i],
+        (i < 9 && n[i] != r[i] ? "  <==" : ""));
+  }
+  nemu_destroy(ctx);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  const struct option table[] = {
+    {"jobs"     , required_argument, NULL, 'j'},
+    {"time"     , required_argument, NULL, 't'},
+    {"max-instr", required_argument, NULL, 'n'},
+    {"seed"     , required_argument, NULL, 's'},
+    {"out"      , required_argument, NULL, 'o'},
+    {"ref"      , required_argument, NULL, 'r'},
+    {"replay"   , required_argument, NULL, 'R'},
+    {"help"     , no_argument      , NULL, 'h'},
+    {0          , 0                , NULL,  0 },
+  };
+  const char *replay_file = NULL;
+  int o;
+  while ( (o = getopt_long(argc, argv, "j:t:n:s:o:r:R:h", table, NULL)) != -1) {
+    switch (o) {
+      case 'j': nr_worker = atoi(optarg); break;
+      case 't': duration = atoi(optarg); break;
+      case 'n': max_instr = atoi(optarg); break;
+      case 's': seed = strtoul(optarg, NULL, 0); break;
+      case 'o': out_dir = optarg; break;
+      case 'r': ref_so = optarg; break;
+      case 'R': replay_file = optarg; break;
+      default:
+        printf("Usage: %s [OPTION...]\n\n", argv[0]);
+        printf("\t-j,--jobs=N          run N workers (default: the number of processors)\n");
+        printf("\t-t,--time=SEC        fuzz for SEC seconds (default 10)\n");
+        printf("\t-n,--max-instr=N     execute at most N instructions of a case (default 8)\n");
+        printf("\t-s,--seed=N          the seed of the cases (default 1)\n");
+        printf("\t-o,--out=DIR         save the findings to DIR (default fuzz-out)\n");
+        printf("\t-r,--ref=SO          the reference (default %s)\n", REF_SO);
+        printf("\t-R,--replay=FILE     run the saved case FILE and show the registers\n");
+        printf("\n");
+        return 0;
+    }
+  }
+
+  if (replay_file != NULL) { return replay(replay_file); }
+
+  if (nr_worker <= 0) { nr_worker = sysconf(_SC_NPROCESSORS_ONLN); }
+  if (nr_worker > MAX_WORKER) { nr_worker = MAX_WORKER; }
+  return fuzz();
+}
@@ -0,0 +1,187 @@
+#!/usr/bin/env python3
+"""Run guest images on NEMU in parallel and report the results.
+
+Every image is run in batch mode with an instruction limit and a time limit.
+A test passes when the guest hits a good trap. The exit code, the number of
+instructions and the host wall time of each test go to one JSON and/or JUnit
+report, with the throughput in MIPS. With --baseline, a test whose throughput
+drops by more than --tolerance from a previous JSON report is flagged as a
+performance regression, and the geometric mean of the speedups is reported.
+
+Without images on the command line, all the x86-nemu images built under
+$AM_HOME/tests and $AM_HOME/apps are run, e.g. after
+
+  make -C $AM_HOME/tests/cputest ARCH=x86-nemu
+
+The exit status is 0 if every test passes without a regression.
+"""
+
+import argparse, glob, json, math, os, re, subprocess, sys, time
+from concurrent.futures import ThreadPoolExecutor
+from xml.sax.saxutils import escape, quoteattr
+
+NEMU_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+# the exit status of NEMU when the guest is stopped by --max-instr
+EXIT_LIMIT = 124
+
+
+def find_images():
+  am_home = os.environ.get('AM_HOME')
+  if am_home is None:
+    sys.exit('AM_HOME is not set, give the images on the command line')
+  images = []
+  for d in ('tests', 'apps'):
+    images += glob.glob(os.path.join(am_home, d, '*', 'build', '*-x86-nemu.bin'))
+  return sorted(images)
+
+
+def test_name(image):
+  return os.path.basename(image)[:-len('-x86-nemu.bin')] \
+      if image.endswith('-x86-nemu.bin') else os.path.basename(image)
+
+
+def run(args, image):
+  cmd = [args.nemu, '-b', '--max-instr=%d' % args.max_instr] + args.nemu_args + [image]
+  start = time.monotonic()
+  try:
+    p = subprocess.run(cmd, stdin=subprocess.DEVNULL, stdout=subprocess.PIPE,
+        stderr=subprocess.PIPE, timeout=args.timeout)
+    wall = time.monotonic() - start
+    code, out = p.returncode, (p.stdout + p.stderr).decode(errors='replace')
+  except subprocess.TimeoutExpired as e:
+    wall = time.monotonic() - start
+    code, out = None, ((e.stdout or b'') + (e.stderr or b'')).decode(errors='replace')
+  # drop the colors and other control characters, which XML does not allow
+  out = re.sub(r'\x1b\[[0-9;]*m|[\x00-\x08\x0b-\x1f]', '', out)
+
+  m = re.search(r'nemu: (\d+) instructions', out)
+  instr = int(m.group(1)) if m else None
+
+  if code is None:
+    status = 'timeout'
+  elif code == 0 and 'HIT GOOD TRAP' in out:
+    status = 'pass'
+  elif code == EXIT_LIMIT and 'stopped at the limit' in out:
+    status = 'limit'
+  else:
+    status = 'fail'
+
+  result = {
+    'name': test_name(image),
+    'image': image,
+    'status': status,
+    'exit_code': code,
+    'instructions': instr,
+    'wall_time': round(wall, 4),
+    'mips': round(instr / wall / 1e6, 3) if instr and wall > 0 else None,
+  }
+  if status != 'pass':
+    result['output'] = out[-4096:]
+  return result
+
+
+def check_baseline(results, baseline_file, tolerance):
+  with open(baseline_file) as f:
+    baseline = {t['name']: t for t in json.load(f)['tests']}
+  for r in results:
+    b = baseline.get(r['name'])
+    if b is None or not b.get('mips') or r['mips'] is None:
+      continue
+    r['baseline_mips'] = b['mips']
+    r['regression'] = r['mips'] < b['mips'] * (1 - tolerance)
+
+
+def write_json(results, summary, path):
+  with open(path, 'w') as f:
+    json.dump({'summary': summary, 'tests': results}, f, indent=2)
+    f.write('\n')
+
+
+def write_junit(results, summary, path):
+  with open(path, 'w') as f:
+    f.write('<?xml version="1.0" encoding="UTF-8"?>\n')
+    failures = sum(r['status'] != 'pass' or bool(r.get('regression')) for r in results)
+    f.write('<testsuite name="nemu" tests="%d" failures="%d" time="%.3f">\n' %
+        (summary['tests'], failures, summary['wall_time']))
+    for r in results:
+      f.write('  <testcase classname="nemu" name=%s time="%.3f">\n' % (quoteattr(r['name']), r['wall_time']))
+      f.write('    <properties>\n')
+      for k in ('instructions', 'mips', 'baseline_mips'):
+        if r.get(k) is not None:
+          f.write('      <property name="%s" value="%s"/>\n' % (k, r[k]))
+      f.write('    </properties>\n')
+      if r['status'] != 'pass':
+        f.write('    <failure message=%s>%s</failure>\n' %
+            (quoteattr(r['status']), escape(r['output'])))
+      elif r.get('regression'):
+        f.write('    <failure message="performance regression">%.3f MIPS, baseline %.3f MIPS</failure>\n' %
+            (r['mips'], r['baseline_mips']))
+      f.write('  </testcase>\n')
+    f.write('</testsuite>\n')
+
+
+def main():
+  ap = argparse.ArgumentParser(description='Run guest images on NEMU in parallel.')
+  ap.add_argument('images', nargs='*', help='the images to run (default: all the built x86-nemu images)')
+  ap.add_argument('--nemu', default=os.path.join(NEMU_DIR, 'build', 'nemu'), help='the NEMU binary')
+  ap.add_argument('--nemu-args', default='', help='more arguments to NEMU, e.g. "--nr-cpu=2"')
+  ap.add_argument('-j', '--jobs', type=int, default=os.cpu_count(), help='the number of tests run at a time')
+  ap.add_argument('--max-instr', type=int, default=10 ** 10, help='the instruction limit of each test')
+  ap.add_argument('--timeout', type=float, default=300, help='the time limit of each test in seconds')
+  ap.add_argument('--json', help='write the report in JSON to this file')
+  ap.add_argument('--junit', help='write the report in JUnit XML to this file')
+  ap.add_argument('--baseline', help='a previous JSON report to compare the throughput with')
+  ap.add_argument('--tolerance', type=float, default=0.1, help='the allowed drop of throughput (default 0.1)')
+  args = ap.parse_args()
+  args.nemu_args = args.nemu_args.split()
+
+  images = args.images or find_images()
+  if not images:
+    sys.exit('no image to run')
+
+  start = time.monotonic()
+  with ThreadPoolExecutor(max_workers=args.jobs) as pool:
+    results = list(pool.map(lambda image: run(args, image), images))
+  wall = time.monotonic() - start
+
+  if args.baseline:
+    check_baseline(results, args.baseline, args.tolerance)
+
+  for r in results:
+    mark = r['status'].upper()
+    if r['status'] == 'pass' and r.get('regression'):
+      mark = 'SLOW'
+    perf = '%8.3f MIPS' % r['mips'] if r['mips'] is not None else ' ' * 13
+    if r.get('baseline_mips') is not None:
+      perf += ' (baseline %.3f)' % r['baseline_mips']
+    print('[%16s] %-7s %14s instr %8.3fs %s' %
+        (r['name'], mark, r['instructions'] if r['instructions'] is not None else '-', r['wall_time'], perf))
+
+  summary = {
+    'nemu': args.nemu,
+    'jobs': args.jobs,
+    'tests': len(results),
+    'passed': sum(r['status'] == 'pass' for r in results),
+    'failed': sum(r['status'] != 'pass' for r in results),
+    'regressions': sum(bool(r.get('regression')) for r in results),
+    'wall_time': round(wall, 4),
+  }
+  print('%d passed, %d failed, %d performance regressions in %.3fs' %
+      (summary['passed'], summary['failed'], summary['regressions'], wall))
+
+  ratios = [r['mips'] / r['baseline_mips'] for r in results if r.get('baseline_mips')]
+  if ratios:
+    summary['speedup'] = round(math.exp(sum(map(math.log, ratios)) / len(ratios)), 4)
+    print('throughput %.3fx of the baseline (geometric mean of %d tests)' % (summary['speedup'], len(ratios)))
+
+  if args.json:
+    write_json(results, summary, args.json)
+  if args.junit:
+    write_junit(results, summary, args.junit)
+
+  return 0 if summary['failed'] == 0 and summary['regressions'] == 0 else 1
+
+
+if __name__ == '__main__':
+  sys.exit(main())
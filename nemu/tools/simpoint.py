@@ -0,0 +1,158 @@
+#!/usr/bin/env python3
+"""Pick the representative intervals of a run from its basic block vectors.
+
+This is the offline step of SimPoint sampling. The input is the .bb file
+written by `nemu --bbv=FILE`, with one basic block vector per interval. Each
+vector is normalized, and projected to a few random dimensions. The vectors
+are clustered by k-means for every k up to --max-k, and the smallest k whose
+BIC score is close enough to the best one is taken. The interval closest to
+the center of each cluster represents it, weighted by the share of intervals
+in the cluster. The result is written in the format of SimPoint:
+
+  PREFIX.simpoints   <interval> <cluster>
+  PREFIX.weights     <weight> <cluster>
+
+and is used by `nemu --simpoints=PREFIX` with the same --bbv-interval.
+"""
+
+import argparse, math, random, sys
+
+
+def read_bbv(path):
+  vectors = []
+  with open(path) as f:
+    for line in f:
+      if not line.startswith('T'):
+        continue
+      v = {}
+      for item in line[1:].split():
+        _, bid, count = item.split(':')
+        v[int(bid)] = v.get(int(bid), 0) + int(count)
+      total = sum(v.values())
+      vectors.append({b: c / total for b, c in v.items()} if total else {})
+  return vectors
+
+
+def project(vectors, dim, rng):
+  """Project the sparse vectors to `dim' dimensions with a random matrix."""
+  column = {}
+  points = []
+  for v in vectors:
+    p = [0.0] * dim
+    for b, x in v.items():
+      if b not in column:
+        column[b] = [rng.uniform(-1, 1) for _ in range(dim)]
+      c = column[b]
+      for i in range(dim):
+        p[i] += x * c[i]
+    points.append(p)
+  return points
+
+
+def dist2(a, b):
+  return sum((x - y) * (x - y) for x, y in zip(a, b))
+
+
+def kmeans(points, k, rng, max_iter):
+  # k-means++ seeding
+  centers = [rng.choice(points)]
+  while len(centers) < k:
+    d = [min(dist2(p, c) for c in centers) for p in points]
+    total = sum(d)
+    if total == 0:
+      break
+    r = rng.uniform(0, total)
+    for p, x in zip(points, d):
+      r -= x
+      if r <= 0:
+        break
+    centers.append(p)
+
+  label = [0] * len(points)
+  for _ in range(max_iter):
+    new_label = [min(range(len(centers)), key=lambda c: dist2(p, centers[c])) for p in points]
+    changed = new_label != label
+    label = new_label
+    for c in range(len(centers)):
+      members = [p for p, l in zip(points, label) if l == c]
+      if members:
+        centers[c] = [sum(x) / len(members) for x in zip(*members)]
+    if not changed:
+      break
+  return centers, label
+
+
+def bic(points, centers, label):
+  """The BIC score of a clustering, as in X-means and SimPoint."""
+  r, m, k = len(points), len(points[0]), len(centers)
+  if r <= k:
+    return -math.inf
+  sse = sum(dist2(p, centers[l]) for p, l in zip(points, label))
+  var = max(sse / (r - k), 1e-12)
+  ll = 0.0
+  for c in range(k):
+    rn = label.count(c)
+    if rn == 0:
+      continue
+    ll += (-rn / 2 * math.log(2 * math.pi) - rn * m / 2 * math.log(var)
+        - (rn - k) / 2 + rn * math.log(rn) - rn * math.log(r))
+  params = (k - 1) + m * k + 1
+  return ll - params / 2 * math.log(r)
+
+
+def main():
+  ap = argparse.ArgumentParser(description='Pick the representative intervals from basic block vectors.')
+  ap.add_argument('bbv', help='the .bb file written by nemu --bbv')
+  ap.add_argument('prefix', help='write PREFIX.simpoints and PREFIX.weights')
+  ap.add_argument('--max-k', type=int, default=10, help='the largest number of clusters tried (default 10)')
+  ap.add_argument('-k', type=int, help='use this number of clusters instead of choosing by BIC')
+  ap.add_argument('--dim', type=int, default=15, help='the dimensions of the random projection (default 15)')
+  ap.add_argument('--bic-threshold', type=float, default=0.9,
+      help='take the smallest k scoring this fraction of the BIC range (default 0.9)')
+  ap.add_argument('--seed', type=int, default=1, help='the seed of the projection and the clustering')
+  ap.add_argument('--restarts', type=int, default=5, help='the k-means runs for each k (default 5)')
+  ap.add_argument('--max-iter', type=int, default=100, help='the iterations of each k-means run (default 100)')
+  args = ap.parse_args()
+
+  vectors = read_bbv(args.bbv)
+  if not vectors:
+    sys.exit('no interval in %s' % args.bbv)
+  rng = random.Random(args.seed)
+  points = project(vectors, args.dim, rng)
+
+  def best_run(k):
+    runs = [kmeans(points, k, rng, args.max_iter) for _ in range(args.restarts)]
+    return min(runs, key=lambda run: sum(dist2(p, run[0][l]) for p, l in zip(points, run[1])))
+
+  if args.k is not None:
+    centers, label = best_run(min(args.k, len(points)))
+  else:
+    runs = [best_run(k) for k in range(1, min(args.max_k, len(points)) + 1)]
+    scores = [bic(points, c, l) for c, l in runs]
+    finite = [s for s in scores if s != -math.inf]
+    lo, hi = min(finite), max(finite)
+    for (centers, label), s in zip(runs, scores):
+      if s >= lo + args.bic_threshold * (hi - lo):
+        break
+
+  picked = []
+  for c in range(len(centers)):
+    members = [i for i, l in enumerate(label) if l == c]
+    if members:
+      best = min(members, key=lambda i: dist2(points[i], centers[c]))
+      picked.append((best, len(members) / len(points)))
+  picked.sort()
+
+  with open(args.prefix + '.simpoints', 'w') as sp, open(args.prefix + '.weights', 'w') as wt:
+    for cluster, (interval, weight) in enumerate(picked):
+      sp.write('%d %d\n' % (interval, cluster))
+      wt.write('%.6f %d\n' % (weight, cluster))
+
+  print('%d intervals in %d clusters' % (len(points), len(picked)))
+  for cluster, (interval, weight) in enumerate(picked):
+    print('  cluster %d: interval %d, weight %.4f' % (cluster, interval, weight))
+  return 0
+
+
+if __name__ == '__main__':
+  sys.exit(main())
@@ -0,0 +1,688 @@
+/* A reference x86 interpreter for the differential testing of NEMU.
+ *
+ * It is written independently of NEMU and shares nothing with it but the
+ * interface in monitor/difftest.h. It runs flat 32-bit user code: the integer
+ * instructions, without segmentation, paging, interrupts or I/O. NEMU does
+ * not let the reference execute the instructions it can not check, such as
+ * `in', `out' and `nemu_trap', and copies its registers over instead.
+ */
+
+#include "monitor/difftest.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum { EAX, ECX, EDX, EBX, ESP, EBP, ESI, EDI };
+
+#define CF 0x001
+#define PF 0x004
+#define AF 0x010
+#define ZF 0x040
+#define SF 0x080
+#define DF 0x400
+#define OF 0x800
+
+static uint32_t reg[8], eip, eflags;
+static uint8_t *mem;
+static size_t mem_size;
+
+/* the state of the instruction being executed */
+static DiffStore *stores;
+static int nr_store, max_store;
+static bool fail;
+static uint32_t eip0;
+
+static void failed(const char *what) {
+  if (!fail) {
+    fprintf(stderr, "x86-ref: %s at eip = 0x%08x\n", what, eip0);
+  }
+  fail = true;
+}
+
+/* memory */
+
+static uint32_t mem_read(uint32_t addr, int len) {
+  if (addr >= mem_size || len > mem_size - addr) {
+    failed("bad memory read");
+    return 0;
+  }
+  uint32_t val = 0;
+  memcpy(&val, mem + addr, len);
+  return val;
+}
+
+static void mem_write(uint32_t addr, int len, uint32_t val) {
+  if (addr >= mem_size || len > mem_size - addr) {
+    failed("bad memory write");
+    return;
+  }
+  memcpy(mem + addr, &val, len);
+  if (nr_store < max_store) {
+    stores[nr_store].addr = addr;
+    stores[nr_store].len = len;
+    stores[nr_store].data = val & (len == 4 ? ~0u : (1u << (len * 8)) - 1);
+  }
+  nr_store ++;
+}
+
+static uint32_t fetch(int len) {
+  uint32_t val = mem_read(eip, len);
+  eip += len;
+  return val;
+}
+
+static int32_t fetch_s8() { return (int8_t)fetch(1); }
+
+/* registers */
+
+static uint32_t mask(int w) { return (w == 4 ? ~0u : (1u << (w * 8)) - 1); }
+static uint32_t sign(int w) { return 1u << (w * 8 - 1); }
+
+static uint32_t sext(uint32_t v, int w) {
+  return (w == 1 ? (uint32_t)(int8_t)v : w == 2 ? (uint32_t)(int16_t)v : v);
+}
+
+static uint32_t reg_read(int r, int w) {
+  if (w == 1) return (r < 4 ? reg[r] : reg[r - 4] >> 8) & 0xff;
+  return reg[r] & mask(w);
+}
+
+static void reg_write(int r, int w, uint32_t v) {
+  if (w == 4) reg[r] = v;
+  else if (w == 2) reg[r] = (reg[r] & 0xffff0000) | (v & 0xffff);
+  else if (r < 4) reg[r] = (reg[r] & ~0xffu) | (v & 0xff);
+  else reg[r - 4] = (reg[r - 4] & ~0xff00u) | ((v & 0xff) << 8);
+}
+
+static void push(uint32_t v, int w) {
+  reg[ESP] -= w;
+  mem_write(reg[ESP], w, v);
+}
+
+static uint32_t pop(int w) {
+  uint32_t v = mem_read(reg[ESP], w);
+  reg[ESP] += w;
+  return v;
+}
+
+/* ModR/M operands */
+
+typedef struct {
+  bool is_reg;
+  int reg;          /* register number if is_reg */
+  uint32_t addr;    /* memory address otherwise */
+} Operand;
+
+static int modrm_reg;
+
+static Operand decode_modrm() {
+  uint8_t m = fetch(1);
+  int mod = m >> 6, rm = m & 7;
+  modrm_reg = (m >> 3) & 7;
+
+  Operand op = { .is_reg = (mod == 3), .reg = rm };
+  if (op.is_reg) return op;
+
+  uint32_t addr = 0;
+  if (rm == 4) {
+    uint8_t sib = fetch(1);
+    int base = sib & 7, index = (sib >> 3) & 7, scale = sib >> 6;
+    if (base == 5 && mod == 0) addr = fetch(4);
+    else addr = reg[base];
+    if (index != 4) addr += reg[index] << scale;
+  }
+  else if (rm == 5 && mod == 0) {
+    addr = fetch(4);
+  }
+  else {
+    addr = reg[rm];
+  }
+  if (mod == 1) addr += fetch_s8();
+  else if (mod == 2) addr += fetch(4);
+  op.addr = addr;
+  return op;
+}
+
+static uint32_t opd_read(Operand *op, int w) {
+  return (op->is_reg ? reg_read(op->reg, w) : mem_read(op->addr, w));
+}
+
+static void opd_write(Operand *op, int w, uint32_t v) {
+  if (op->is_reg) reg_write(op->reg, w, v);
+  else mem_write(op->addr, w, v & mask(w));
+}
+
+/* flags */
+
+static void set_flag(uint32_t f, bool v) {
+  eflags = (v ? eflags | f : eflags & ~f);
+}
+
+static bool flag(uint32_t f) { return (eflags & f) != 0; }
+
+static void set_szp(uint32_t res, int w) {
+  res &= mask(w);
+  set_flag(ZF, res == 0);
+  set_flag(SF, (res & sign(w)) != 0);
+  set_flag(PF, !__builtin_parity(res & 0xff));
+}
+
+static bool cond(int cc) {
+  bool r;
+  switch (cc >> 1) {
+    case 0: r = flag(OF); break;
+    case 1: r = flag(CF); break;
+    case 2: r = flag(ZF); break;
+    case 3: r = flag(CF) || flag(ZF); break;
+    case 4: r = flag(SF); break;
+    case 5: r = flag(PF); break;
+    case 6: r = flag(SF) != flag(OF); break;
+    default: r = flag(ZF) || flag(SF) != flag(OF); break;
+  }
+  return (cc & 1 ? !r : r);
+}
+
+enum { ADD, OR, ADC, SBB, AND, SUB, XOR, CMP };
+
+/* Compute an ALU operation and its flags, the result is not written for CMP. */
+static uint32_t alu(int op, uint32_t a, uint32_t b, int w) {
+  uint32_t m = mask(w), res;
+  uint64_t carry_in = 0;
+  a &= m; b &= m;
+  switch (op) {
+    case ADC: carry_in = flag(CF); /* fall through */
+    case ADD:
+      res = (a + b + carry_in) & m;
+      set_flag(CF, (uint64_t)a + b + carry_in > m);
+      set_flag(OF, (~(a ^ b) & (a ^ res) & sign(w)) != 0);
+      set_flag(AF, ((a ^ b ^ res) & 0x10) != 0);
+      break;
+    case SBB: carry_in = flag(CF); /* fall through */
+    case SUB: case CMP:
+      res = (a - b - carry_in) & m;
+      set_flag(CF, (uint64_t)b + carry_in > a);
+      set_flag(OF, ((a ^ b) & (a ^ res) & sign(w)) != 0);
+      set_flag(AF, ((a ^ b ^ res) & 0x10) != 0);
+      break;
+    default:
+      res = (op == OR ? a | b : op == AND ? a & b : a ^ b);
+      set_flag(CF, false);
+      set_flag(OF, false);
+      set_flag(AF, false);
+      break;
+  }
+  set_szp(res, w);
+  return res;
+}
+
+enum { ROL, ROR, RCL, RCR, SHL, SHR, SAL, SAR };
+
+static uint32_t shift(int op, uint32_t v, int count, int w) {
+  int bits = w * 8;
+  uint32_t m = mask(w);
+  count &= 31;
+  if (count == 0) return v & m;
+  v &= m;
+
+  uint32_t res = v;
+  int i;
+  switch (op) {
+    case ROL: case ROR: case RCL: case RCR:
+      for (i = 0; i < count; i ++) {
+        bool c;
+        switch (op) {
+          case ROL: c = (res & sign(w)) != 0; res = ((res << 1) | c) & m; break;
+          case ROR: c = res & 1; res = (res >> 1) | (c ? sign(w) : 0); break;
+          case RCL: c = (res & sign(w)) != 0; res = ((res << 1) | flag(CF)) & m; break;
+          default: c = res & 1; res = (res >> 1) | (flag(CF) ? sign(w) : 0); break;
+        }
+        set_flag(CF, c);
+      }
+      if (op == ROL || op == RCL) set_flag(OF, ((res & sign(w)) != 0) != flag(CF));
+      else set_flag(OF, ((res ^ (res << 1)) & sign(w)) != 0);
+      return res;
+    case SHL: case SAL:
+      set_flag(CF, count <= bits && ((v >> (bits - count)) & 1));
+      res = (count < 32 ? v << count : 0) & m;
+      set_flag(OF, ((res & sign(w)) != 0) != flag(CF));
+      break;
+    case SHR:
+      set_flag(CF, (v >> (count - 1)) & 1);
+      res = (count < 32 ? v >> count : 0);
+      set_flag(OF, (v & sign(w)) != 0);
+      break;
+    default: {
+      int32_t s = (int32_t)sext(v, w);
+      set_flag(CF, (s >> (count - 1)) & 1);
+      res = (uint32_t)(s >> count) & m;
+      set_flag(OF, false);
+      break;
+    }
+  }
+  set_szp(res, w);
+  return res;
+}
+
+/* group 3: test, not, neg, mul, imul, div, idiv */
+static void group3(Operand *op, int w) {
+  uint32_t v = opd_read(op, w);
+  uint32_t m = mask(w);
+  switch (modrm_reg) {
+    case 0: case 1:
+      alu(AND, v, fetch(w), w);
+      return;
+    case 2: opd_write(op, w, ~v); return;
+    case 3: {
+      uint32_t res = alu(SUB, 0, v, w);
+      set_flag(CF, (v & m) != 0);
+      opd_write(op, w, res);
+      return;
+    }
+    case 4: case 5: {
+      uint32_t a = reg_read(EAX, w);
+      int64_t p;
+      bool over;
+      if (modrm_reg == 4) p = (int64_t)((uint64_t)a * (v & m));
+      else p = (int64_t)(int32_t)sext(a, w) * (int32_t)sext(v, w);
+      uint32_t lo = p & m, hi = ((uint64_t)p >> (w * 8)) & m;
+      if (w == 1) reg_write(EAX, 2, p & 0xffff);
+      else { reg_write(EAX, w, lo); reg_write(EDX, w, hi); }
+      if (modrm_reg == 4) over = (hi != 0);
+      else over = (p != (int32_t)sext(lo, w));
+      set_flag(CF, over);
+      set_flag(OF, over);
+      return;
+    }
+    default: {
+      if ((v & m) == 0) { failed("division by zero"); return; }
+      uint64_t n = (w == 1 ? reg_read(EAX, 2) : ((uint64_t)reg_read(EDX, w) << (w * 8)) | reg_read(EAX, w));
+      uint64_t q, r;
+      if (modrm_reg == 6) {
+        q = n / v; r = n % v;
+        if (q > m) { failed("division overflow"); return; }
+      }
+      else {
+        int64_t sn = (w == 4 ? (int64_t)n : (int64_t)(int32_t)sext(n, 2 * w));
+        int64_t sv = (int32_t)sext(v, w);
+        int64_t sq = sn / sv;
+        if (sq > (int64_t)(int32_t)(sign(w) - 1) || sq < -(int64_t)sign(w)) { failed("division overflow"); return; }
+        q = (uint64_t)sq; r = (uint64_t)(sn % sv);
+      }
+      if (w == 1) { reg_write(EAX, 1, q); reg_write(ESP, 1, r);  /* ah */ }
+      else { reg_write(EAX, w, q); reg_write(EDX, w, r); }
+      return;
+    }
+  }
+}
+
+static uint32_t imul(uint32_t a, uint32_t b, int w) {
+  int64_t p = (int64_t)(int32_t)sext(a, w) * (int32_t)sext(b, w);
+  uint32_t res = p & mask(w);
+  bool over = p != (int64_t)(int32_t)sext(res, w);
+  set_flag(CF, over);
+  set_flag(OF, over);
+  return res;
+}
+
+static void string_op(uint8_t opcode, int w, int rep) {
+  int step = (flag(DF) ? -w : w);
+  while (!rep || reg[ECX] != 0) {
+    switch (opcode) {
+      case 0xa4: case 0xa5: mem_write(reg[EDI], w, mem_read(reg[ESI], w)); reg[ESI] += step; break;
+      case 0xaa: case 0xab: mem_write(reg[EDI], w, reg_read(EAX, w)); break;
+      case 0xac: case 0xad: reg_write(EAX, w, mem_read(reg[ESI], w)); reg[ESI] += step; break;
+    }
+    if (opcode != 0xac && opcode != 0xad) reg[EDI] += step;
+    if (!rep || fail) break;
+    reg[ECX] --;
+  }
+}
+
+static void exec_0f(int w) {
+  uint8_t opcode = fetch(1);
+  Operand op;
+
+  if (opcode >= 0x80 && opcode <= 0x8f) {
+    uint32_t disp = fetch(4);
+    if (cond(opcode & 0xf)) eip += disp;
+    return;
+  }
+  if (opcode >= 0x90 && opcode <= 0x9f) {
+    op = decode_modrm();
+    opd_write(&op, 1, cond(opcode & 0xf));
+    return;
+  }
+  if (opcode >= 0x40 && opcode <= 0x4f) {
+    op = decode_modrm();
+    uint32_t v = opd_read(&op, w);
+    if (cond(opcode & 0xf)) reg_write(modrm_reg, w, v);
+    return;
+  }
+
+  switch (opcode) {
+    case 0xb6: case 0xb7:
+      op = decode_modrm();
+      reg_write(modrm_reg, w, opd_read(&op, (opcode == 0xb6 ? 1 : 2)));
+      break;
+    case 0xbe: case 0xbf: {
+      int sw = (opcode == 0xbe ? 1 : 2);
+      op = decode_modrm();
+      reg_write(modrm_reg, w, sext(opd_read(&op, sw), sw));
+      break;
+    }
+    case 0xaf:
+      op = decode_modrm();
+      reg_write(modrm_reg, w, imul(reg_read(modrm_reg, w), opd_read(&op, w), w));
+      break;
+    case 0xa4: case 0xa5: case 0xac: case 0xad: {
+      op = decode_modrm();
+      int count = ((opcode & 1) ? reg[ECX] : fetch(1)) & 31;
+      if (count == 0) break;
+      uint64_t d = opd_read(&op, w), s = reg_read(modrm_reg, w);
+      int bits = w * 8;
+      uint64_t res;
+      if (opcode <= 0xa5) {
+        res = ((d << count) | (s >> (bits - count))) & mask(w);
+        set_flag(CF, (d >> (bits - count)) & 1);
+      }
+      else {
+        res = ((d >> count) | (s << (bits - count))) & mask(w);
+        set_flag(CF, (d >> (count - 1)) & 1);
+      }
+      set_flag(OF, ((res ^ d) & sign(w)) != 0);
+      set_szp(res, w);
+      opd_write(&op, w, res);
+      break;
+    }
+    case 0xa3: case 0xab: case 0xb3: case 0xbb: {
+      op = decode_modrm();
+      uint32_t bit = reg_read(modrm_reg, w);
+      if (!op.is_reg) { op.addr += ((int32_t)bit >> 5) * 4; w = 4; }
+      uint32_t v = opd_read(&op, w);
+      bit &= w * 8 - 1;
+      set_flag(CF, (v >> bit) & 1);
+      if (opcode == 0xab) opd_write(&op, w, v | (1u << bit));
+      else if (opcode == 0xb3) opd_write(&op, w, v & ~(1u << bit));
+      else if (opcode == 0xbb) opd_write(&op, w, v ^ (1u << bit));
+      break;
+    }
+    case 0xbc: case 0xbd: {
+      op = decode_modrm();
+      uint32_t v = opd_read(&op, w);
+      set_flag(ZF, v == 0);
+      if (v != 0) reg_write(modrm_reg, w, (opcode == 0xbc ? __builtin_ctz(v) : 31 - __builtin_clz(v)));
+      break;
+    }
+    default:
+      failed("unsupported opcode 0f");
+      break;
+  }
+}
+
+static void exec_one() {
+  int w = 4, rep = 0;
+  uint8_t opcode;
+
+  /* prefixes */
+  while (1) {
+    opcode = fetch(1);
+    if (opcode == 0x66) w = 2;
+    else if (opcode == 0xf3 || opcode == 0xf2) rep = opcode;
+    else if (opcode == 0xf0 || opcode == 0x2e || opcode == 0x3e || opcode == 0x26 ||
+        opcode == 0x36 || opcode == 0x64 || opcode == 0x65) continue;
+    else break;
+  }
+
+  Operand op;
+  uint32_t v;
+
+  /* the ALU instructions 00 - 3d */
+  if (opcode < 0x40 && (opcode & 7) < 6) {
+    int aop = opcode >> 3;
+    int ow = (opcode & 1 ? w : 1);
+    uint32_t res;
+    switch (opcode & 7) {
+      case 0: case 1:
+        op = decode_modrm();
+        res = alu(aop, opd_read(&op, ow), reg_read(modrm_reg, ow), ow);
+        if (aop != CMP) opd_write(&op, ow, res);
+        break;
+      case 2: case 3:
+        op = decode_modrm();
+        res = alu(aop, reg_read(modrm_reg, ow), opd_read(&op, ow), ow);
+        if (aop != CMP) reg_write(modrm_reg, ow, res);
+        break;
+      default:
+        v = fetch(ow == 4 ? 4 : ow);
+        res = alu(aop, reg_read(EAX, ow), v, ow);
+        if (aop != CMP) reg_write(EAX, ow, res);
+        break;
+    }
+    return;
+  }
+
+  if (opcode >= 0x40 && opcode <= 0x4f) {
+    bool cf = flag(CF);
+    int r = opcode & 7;
+    reg_write(r, w, alu(opcode < 0x48 ? ADD : SUB, reg_read(r, w), 1, w));
+    set_flag(CF, cf);
+    return;
+  }
+  if (opcode >= 0x50 && opcode <= 0x57) { push(reg_read(opcode & 7, w), w); return; }
+  if (opcode >= 0x58 && opcode <= 0x5f) { reg_write(opcode & 7, w, pop(w)); return; }
+  if (opcode >= 0x70 && opcode <= 0x7f) {
+    int32_t disp = fetch_s8();
+    if (cond(opcode & 0xf)) eip += disp;
+    return;
+  }
+  if (opcode >= 0x91 && opcode <= 0x97) {
+    v = reg_read(EAX, w);
+    reg_write(EAX, w, reg_read(opcode & 7, w));
+    reg_write(opcode & 7, w, v);
+    return;
+  }
+  if (opcode >= 0xb0 && opcode <= 0xb7) { reg_write(opcode & 7, 1, fetch(1)); return; }
+  if (opcode >= 0xb8 && opcode <= 0xbf) { reg_write(opcode & 7, w, fetch(w)); return; }
+
+  switch (opcode) {
+    case 0x0f: exec_0f(w); break;
+    case 0x60: {
+      uint32_t esp = reg[ESP];
+      int i;
+      for (i = 0; i < 8; i ++) push(i == ESP ? esp : reg_read(i, w), w);
+      break;
+    }
+    case 0x61: {
+      int i;
+      for (i = 7; i >= 0; i --) {
+        v = pop(w);
+        if (i != ESP) reg_write(i, w, v);
+      }
+      break;
+    }
+    case 0x68: push(fetch(w), w); break;
+    case 0x6a: push(fetch_s8(), w); break;
+    case 0x69: case 0x6b:
+      op = decode_modrm();
+      v = opd_read(&op, w);
+      reg_write(modrm_reg, w, imul(v, (opcode == 0x69 ? fetch(w) : (uint32_t)fetch_s8()), w));
+      break;
+    case 0x80: case 0x81: case 0x83: {
+      int ow = (opcode == 0x80 ? 1 : w);
+      op = decode_modrm();
+      uint32_t imm = (opcode == 0x81 ? fetch(ow) : opcode == 0x83 ? (uint32_t)fetch_s8() : fetch(1));
+      uint32_t res = alu(modrm_reg, opd_read(&op, ow), imm, ow);
+      if (modrm_reg != CMP) opd_write(&op, ow, res);
+      break;
+    }
+    case 0x84: case 0x85: {
+      int ow = (opcode == 0x84 ? 1 : w);
+      op = decode_modrm();
+      alu(AND, opd_read(&op, ow), reg_read(modrm_reg, ow), ow);
+      break;
+    }
+    case 0x86: case 0x87: {
+      int ow = (opcode == 0x86 ? 1 : w);
+      op = decode_modrm();
+      v = opd_read(&op, ow);
+      opd_write(&op, ow, reg_read(modrm_reg, ow));
+      reg_write(modrm_reg, ow, v);
+      break;
+    }
+    case 0x88: case 0x89: {
+      int ow = (opcode == 0x88 ? 1 : w);
+      op = decode_modrm();
+      opd_write(&op, ow, reg_read(modrm_reg, ow));
+      break;
+    }
+    case 0x8a: case 0x8b: {
+      int ow = (opcode == 0x8a ? 1 : w);
+      op = decode_modrm();
+      reg_write(modrm_reg, ow, opd_read(&op, ow));
+      break;
+    }
+    case 0x8d:
+      op = decode_modrm();
+      if (op.is_reg) { failed("lea with a register operand"); break; }
+      reg_write(modrm_reg, w, op.addr);
+      break;
+    case 0x8f:
+      v = pop(w);
+      op = decode_modrm();
+      opd_write(&op, w, v);
+      break;
+    case 0x90: break;
+    case 0x98:
+      if (w == 4) reg[EAX] = sext(reg[EAX], 2);
+      else reg_write(EAX, 2, sext(reg[EAX], 1));
+      break;
+    case 0x99:
+      if (w == 4) reg[EDX] = ((int32_t)reg[EAX] < 0 ? ~0u : 0);
+      else reg_write(EDX, 2, (reg[EAX] & 0x8000 ? 0xffff : 0));
+      break;
+    case 0xa0: case 0xa1: {
+      int ow = (opcode == 0xa0 ? 1 : w);
+      reg_write(EAX, ow, mem_read(fetch(4), ow));
+      break;
+    }
+    case 0xa2: case 0xa3: {
+      int ow = (opcode == 0xa2 ? 1 : w);
+      mem_write(fetch(4), ow, reg_read(EAX, ow));
+      break;
+    }
+    case 0xa4: case 0xaa: case 0xac: string_op(opcode, 1, rep); break;
+    case 0xa5: case 0xab: case 0xad: string_op(opcode, w, rep); break;
+    case 0xa8: alu(AND, reg_read(EAX, 1), fetch(1), 1); break;
+    case 0xa9: alu(AND, reg_read(EAX, w), fetch(w), w); break;
+    case 0xc0: case 0xc1: case 0xd0: case 0xd1: case 0xd2: case 0xd3: {
+      int ow = (opcode & 1 ? w : 1);
+      op = decode_modrm();
+      v = opd_read(&op, ow);
+      int count = (opcode <= 0xc1 ? fetch(1) : opcode <= 0xd1 ? 1 : reg[ECX] & 0xff);
+      opd_write(&op, ow, shift(modrm_reg, v, count, ow));
+      break;
+    }
+    case 0xc2: {
+      uint32_t n = fetch(2);
+      eip = pop(4);
+      reg[ESP] += n;
+      break;
+    }
+    case 0xc3: eip = pop(4); break;
+    case 0xc6: case 0xc7: {
+      int ow = (opcode == 0xc6 ? 1 : w);
+      op = decode_modrm();
+      opd_write(&op, ow, fetch(ow));
+      break;
+    }
+    case 0xc9:
+      reg[ESP] = reg[EBP];
+      reg_write(EBP, w, pop(w));
+      break;
+    case 0xe8: {
+      uint32_t disp = fetch(4);
+      push(eip, 4);
+      eip += disp;
+      break;
+    }
+    case 0xe9: eip += fetch(4); break;
+    case 0xeb: eip += fetch_s8(); break;
+    case 0xf5: set_flag(CF, !flag(CF)); break;
+    case 0xf6: op = decode_modrm(); group3(&op, 1); break;
+    case 0xf7: op = decode_modrm(); group3(&op, w); break;
+    case 0xf8: set_flag(CF, false); break;
+    case 0xf9: set_flag(CF, true); break;
+    case 0xfc: set_flag(DF, false); break;
+    case 0xfd: set_flag(DF, true); break;
+    case 0xfe: case 0xff: {
+      int ow = (opcode == 0xfe ? 1 : w);
+      op = decode_modrm();
+      if (modrm_reg < 2) {
+        bool cf = flag(CF);
+        opd_write(&op, ow, alu(modrm_reg == 0 ? ADD : SUB, opd_read(&op, ow), 1, ow));
+        set_flag(CF, cf);
+        break;
+      }
+      if (opcode == 0xfe) { failed("unsupported opcode fe"); break; }
+      v = opd_read(&op, w);
+      switch (modrm_reg) {
+        case 2: push(eip, 4); eip = v; break;
+        case 4: eip = v; break;
+        case 6: push(v, w); break;
+        default: failed("unsupported opcode ff"); break;
+      }
+      break;
+    }
+    default: failed("unsupported opcode"); break;
+  }
+}
+
+/* the interface */
+
+void difftest_init(size_t size) {
+  free(mem);
+  mem = calloc(size, 1);
+  if (mem == NULL) {
+    fprintf(stderr, "x86-ref: can not allocate %zu bytes of memory\n", size);
+    exit(1);
+  }
+  mem_size = size;
+  memset(reg, 0, sizeof(reg));
+  eip = 0;
+  eflags = 0x2;
+}
+
+void difftest_memcpy(uint32_t addr, const void *buf, size_t n) {
+  if (addr < mem_size && n <= mem_size - addr) {
+    memcpy(mem + addr, buf, n);
+  }
+}
+
+void difftest_getregs(DiffRegs *r) {
+  memcpy(&r->eax, reg, sizeof(reg));
+  r->eip = eip;
+  r->eflags = eflags;
+}
+
+void difftest_setregs(const DiffRegs *r) {
+  memcpy(reg, &r->eax, sizeof(reg));
+  eip = r->eip;
+  eflags = r->eflags | 0x2;
+}
+
+int difftest_step(DiffStore *s, int max) {
+  stores = s;
+  max_store = max;
+  nr_store = 0;
+  fail = false;
+  eip0 = eip;
+
+  exec_one();
+
+  if (fail) {
+    eip = eip0;
+    return DIFF_FAIL;
+  }
+  return (nr_store < max ? nr_store : max);
+}
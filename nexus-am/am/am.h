@@ -49,6 +49,17 @@ enum {
   _EVENTS(_EVENT_NAME)
 };
 
+#define _PERFS(_) \
+  _(INSTRET) _(CYCLE) _(MEM_READ) _(MEM_WRITE) \
+  _(TLB_HIT) _(TLB_MISS) _(CACHE_HIT) _(CACHE_MISS)
+
+#define _PERF_NAME(p) _PERF_##p,
+
+enum {
+  _PERFS(_PERF_NAME)
+  _NR_PERF
+};
+
 typedef struct _RegSet _RegSet;
 
 typedef struct _Event {
@@ -88,6 +99,17 @@ void _draw_rect(const uint32_t *pixels, int x, int y, int w, int h);
 void _draw_sync();
 extern _Screen _screen;
 
+#define _DISK_SECTOR_SIZE 512
+uint32_t _disk_nr_sector();
+int _disk_read(void *buf, uint32_t sector, uint32_t nr_sector);
+int _disk_write(const void *buf, uint32_t sector, uint32_t nr_sector);
+
+void _audio_init(int freq, int channels, int samples);
+int _audio_play(const void *buf, int len);
+int _audio_queued();
+
+uint64_t _perf_read(int counter);
+
 // =======================================================================
 // [2] Asynchronous Extension (ASYE)
 // =======================================================================
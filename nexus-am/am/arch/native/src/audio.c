@@ -0,0 +1,41 @@
+#include <am.h>
+#include <SDL2/SDL.h>
+
+// Samples are queued to the SDL audio device directly. The queue is
+// bounded to about the same size as the stream buffer of NEMU, so that
+// programs see the same latency on both.
+
+#define AUDIO_QUEUE_MAX 0x10000
+#define AUDIO_DEV 1  // the device opened by SDL_OpenAudio()
+
+void _audio_init(int freq, int channels, int samples) {
+  SDL_AudioSpec s = {};
+  s.freq = freq;
+  s.format = AUDIO_S16SYS;
+  s.channels = channels;
+  s.samples = samples;
+  s.callback = NULL;
+  SDL_InitSubSystem(SDL_INIT_AUDIO);
+  SDL_OpenAudio(&s, NULL);
+  SDL_PauseAudio(0);
+}
+
+int _audio_play(const void *buf, int len) {
+  int left = len;
+  while (left > 0) {
+    int free = AUDIO_QUEUE_MAX - (int)SDL_GetQueuedAudioSize(AUDIO_DEV);
+    if (free <= 0) {
+      SDL_Delay(1);
+      continue;
+    }
+    int n = (left < free ? left : free);
+    SDL_QueueAudio(AUDIO_DEV, buf, n);
+    buf += n;
+    left -= n;
+  }
+  return len;
+}
+
+int _audio_queued() {
+  return SDL_GetQueuedAudioSize(AUDIO_DEV);
+}
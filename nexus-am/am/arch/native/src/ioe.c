@@ -1,6 +1,8 @@
 #include <am.h>
 #include <sys/time.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
 
 static struct timeval boot_time;
 
@@ -13,10 +15,40 @@ unsigned long _uptime() {
 }
 
 void gui_init();
+void perf_init();
+
+// The disk is the host file named by the environment variable AM_DISK.
+static int disk_fd = -1;
+
+static void disk_init() {
+  const char *file = getenv("AM_DISK");
+  if (file != NULL) {
+    disk_fd = open(file, O_RDWR);
+  }
+}
 
 void _ioe_init() {
   gui_init();
+  disk_init();
+  perf_init();
   gettimeofday(&boot_time, NULL);
 }
 
+uint32_t _disk_nr_sector() {
+  if (disk_fd < 0) return 0;
+  return lseek(disk_fd, 0, SEEK_END) / _DISK_SECTOR_SIZE;
+}
+
+int _disk_read(void *buf, uint32_t sector, uint32_t nr_sector) {
+  size_t len = (size_t)nr_sector * _DISK_SECTOR_SIZE;
+  off_t offset = (off_t)sector * _DISK_SECTOR_SIZE;
+  return (pread(disk_fd, buf, len, offset) == (ssize_t)len ? 0 : -1);
+}
+
+int _disk_write(const void *buf, uint32_t sector, uint32_t nr_sector) {
+  size_t len = (size_t)nr_sector * _DISK_SECTOR_SIZE;
+  off_t offset = (off_t)sector * _DISK_SECTOR_SIZE;
+  return (pwrite(disk_fd, buf, len, offset) == (ssize_t)len ? 0 : -1);
+}
+
 
@@ -0,0 +1,47 @@
+#include <am.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+// Instructions are counted by the host PMU with perf_event_open(2), and
+// cycles by the time stamp counter. Both read as 0 where they are not
+// available, e.g. when perf events are not permitted.
+
+static int instret_fd = -1;
+static uint64_t boot_tsc;
+
+static inline uint64_t rdtsc() {
+#if defined(__i386__) || defined(__x86_64__)
+  uint32_t lo, hi;
+  asm volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+  return ((uint64_t)hi << 32) | lo;
+#else
+  return 0;
+#endif
+}
+
+void perf_init() {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  instret_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  boot_tsc = rdtsc();
+}
+
+uint64_t _perf_read(int counter) {
+  uint64_t val = 0;
+  switch (counter) {
+    case _PERF_INSTRET:
+      if (instret_fd >= 0 && read(instret_fd, &val, sizeof(val)) != sizeof(val)) {
+        val = 0;
+      }
+      return val;
+    case _PERF_CYCLE: return rdtsc() - boot_tsc;
+    default: return 0;
+  }
+}
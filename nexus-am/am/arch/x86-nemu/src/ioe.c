@@ -4,12 +4,15 @@
 #define RTC_PORT 0x48   // Note that this is not standard
 static unsigned long boot_time;
 
+static void disk_init();
+
 void _ioe_init() {
   boot_time = inl(RTC_PORT);
+  disk_init();
 }
 
 unsigned long _uptime() {
-  return 0;
+  return inl(RTC_PORT) - boot_time;
 }
 
 uint32_t* const fb = (uint32_t *)0x40000;
@@ -34,3 +37,115 @@ void _draw_sync() {
 int _read_key() {
   return _KEY_NONE;
 }
+
+#define DISK_PORT 0x300 // Note that this is not standard
+#define DISK_NR_SECTOR (DISK_PORT + 0)
+#define DISK_RING_BASE (DISK_PORT + 4)
+#define DISK_RING_SIZE (DISK_PORT + 8)
+#define DISK_RING_TAIL (DISK_PORT + 12)
+#define DISK_RING_HEAD (DISK_PORT + 16)
+
+#define NR_DISK_DESC 8
+
+enum { DISK_CMD_READ, DISK_CMD_WRITE };
+
+typedef struct {
+  uint32_t sector;
+  uint32_t nr_sector;
+  uint32_t buf;
+  uint16_t cmd;
+  uint16_t status;
+} DiskDesc;
+
+static volatile DiskDesc disk_ring[NR_DISK_DESC];
+static uint32_t disk_tail;
+static int disk_present;
+
+static void disk_init() {
+  disk_present = (_disk_nr_sector() != 0);
+  if (!disk_present) return;
+  outl(DISK_RING_BASE, (uint32_t)disk_ring);
+  outl(DISK_RING_SIZE, NR_DISK_DESC);
+  disk_tail = 0;
+}
+
+uint32_t _disk_nr_sector() {
+  return inl(DISK_NR_SECTOR);
+}
+
+// The device transfers the whole request with DMA before the write
+// to RING_TAIL returns, so the request is complete once RING_HEAD
+// catches up.
+static int disk_request(int cmd, const void *buf, uint32_t sector, uint32_t nr_sector) {
+  if (!disk_present) return -1;
+  volatile DiskDesc *d = &disk_ring[disk_tail % NR_DISK_DESC];
+  d->sector = sector;
+  d->nr_sector = nr_sector;
+  d->buf = (uint32_t)buf;
+  d->cmd = cmd;
+  disk_tail ++;
+  outl(DISK_RING_TAIL, disk_tail);
+  while (inl(DISK_RING_HEAD) != disk_tail);
+  return (d->status == 0 ? 0 : -1);
+}
+
+int _disk_read(void *buf, uint32_t sector, uint32_t nr_sector) {
+  return disk_request(DISK_CMD_READ, buf, sector, nr_sector);
+}
+
+int _disk_write(const void *buf, uint32_t sector, uint32_t nr_sector) {
+  return disk_request(DISK_CMD_WRITE, buf, sector, nr_sector);
+}
+
+#define AUDIO_PORT 0x200 // Note that this is not standard
+#define AUDIO_FREQ (AUDIO_PORT + 0)
+#define AUDIO_CHANNELS (AUDIO_PORT + 4)
+#define AUDIO_SAMPLES (AUDIO_PORT + 8)
+#define AUDIO_INIT (AUDIO_PORT + 12)
+#define AUDIO_SBUF_SIZE (AUDIO_PORT + 16)
+#define AUDIO_COUNT (AUDIO_PORT + 20)
+#define AUDIO_COMMIT (AUDIO_PORT + 24)
+
+uint8_t* const audio_sbuf = (uint8_t *)0xc0000;
+static int audio_sbuf_size;
+
+void _audio_init(int freq, int channels, int samples) {
+  outl(AUDIO_FREQ, freq);
+  outl(AUDIO_CHANNELS, channels);
+  outl(AUDIO_SAMPLES, samples);
+  outl(AUDIO_INIT, 1);
+  audio_sbuf_size = inl(AUDIO_SBUF_SIZE);
+}
+
+// Copy as many samples as the device can take into the stream buffer
+// and commit them with a single port write. Wait while the buffer is
+// full, NEMU keeps draining it even without an audio device.
+int _audio_play(const void *buf, int len) {
+  int left = len;
+  while (left > 0) {
+    int free = audio_sbuf_size - inl(AUDIO_COUNT);
+    if (free <= 0) continue;
+    int n = (left < free ? left : free);
+    memcpy(audio_sbuf, buf, n);
+    outl(AUDIO_COMMIT, n);
+    buf += n;
+    left -= n;
+  }
+  return len;
+}
+
+int _audio_queued() {
+  return inl(AUDIO_COUNT);
+}
+
+#define PERF_PORT 0x50 // Note that this is not standard
+#define PERF_SELECT (PERF_PORT + 0)
+#define PERF_LO (PERF_PORT + 4)
+#define PERF_HI (PERF_PORT + 8)
+
+uint64_t _perf_read(int counter) {
+  outl(PERF_SELECT, counter);
+  uint32_t lo = inl(PERF_LO);  // latches the counter
+  uint32_t hi = inl(PERF_HI);
+  return ((uint64_t)hi << 32) | lo;
+}
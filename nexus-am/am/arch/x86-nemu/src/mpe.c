@@ -0,0 +1,61 @@
+#include <am.h>
+#include <x86.h>
+
+#define MPE_PORT 0x100 // Note that this is not the standard
+#define NR_CPU_PORT (MPE_PORT + 0)
+#define CPU_ID_PORT (MPE_PORT + 4)
+#define START_PORT (MPE_PORT + 8)
+#define STOP_PORT (MPE_PORT + 16)
+
+#define STACK_SHIFT 14
+#define STR_(x) #x
+#define STR(x) STR_(x)
+
+int _NR_CPU = 1;
+
+static void (*mp_entry)();
+uint8_t ap_stack[MAX_CPU][1 << STACK_SHIFT] __attribute__((aligned(16)));
+
+// NEMU starts the other processors here with %eax = _cpu(),
+// so each takes its own stack before running C code
+void ap_start();
+asm(
+  ".globl ap_start\n"
+  "ap_start:\n"
+  "  incl %eax\n"
+  "  shll $" STR(STACK_SHIFT) ", %eax\n"
+  "  leal ap_stack(%eax), %esp\n"
+  "  call ap_main\n"
+);
+
+void ap_main() {
+  mp_entry();
+  outl(STOP_PORT, 0);
+
+  // should not reach here
+  while (1);
+}
+
+void _mpe_init(void (*entry)()) {
+  mp_entry = entry;
+  _NR_CPU = inl(NR_CPU_PORT);
+  outl(START_PORT, (uint32_t)ap_start);
+  entry();
+  _halt(0);
+}
+
+int _cpu() {
+  return inl(CPU_ID_PORT);
+}
+
+intptr_t _atomic_xchg(volatile intptr_t *addr, intptr_t newval) {
+  intptr_t result;
+  asm volatile("xchgl %0, %1" : "+m"(*addr), "=a"(result) : "1"(newval) : "memory");
+  return result;
+}
+
+void _barrier() {
+  // xchg with memory is a full barrier
+  intptr_t dummy = 0;
+  _atomic_xchg(&dummy, 0);
+}
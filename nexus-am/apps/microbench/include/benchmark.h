@@ -92,6 +92,7 @@ extern Setting *setting;
 typedef struct Result {
   int pass;
   unsigned long tsc, msec;
+  uint64_t instr;
 } Result;
 
 void prepare(Result *res);
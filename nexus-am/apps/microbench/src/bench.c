@@ -25,11 +25,13 @@ Benchmark benchmarks[] = {
 
 // Running a benchmark
 static void bench_prepare(Result *res) {
+  res->instr = _perf_read(_PERF_INSTRET);
   res->msec = _uptime();
 }
 
 static void bench_done(Result *res) {
   res->msec = _uptime() - res->msec;
+  res->instr = _perf_read(_PERF_INSTRET) - res->instr;
 }
 
 static const char *bench_check(Benchmark *bench) {
@@ -70,6 +72,7 @@ int main() {
       printk("Ignored %s\n", msg);
     } else {
       unsigned long msec = ULONG_MAX;
+      uint64_t instr = 0;
       int succ = 1;
       for (int i = 0; i < REPEAT; i ++) {
         Result res;
@@ -77,6 +80,7 @@ int main() {
         printk(res.pass ? "*" : "X");
         succ &= res.pass;
         if (res.msec < msec) msec = res.msec;
+        instr = res.instr;
       }
 
       if (succ) printk(" Passed.");
@@ -89,6 +93,10 @@ int main() {
       printk("\n");
       if (SETTING != 0) {
         printk("  min time: %d ms [%d]\n", (unsigned int)msec, (unsigned int)cur);
+        // the instruction count does not depend on the speed of the host
+        if (instr != 0) {
+          printk("  instructions: %d K\n", (unsigned int)(instr / 1000));
+        }
       }
 
       bench_score += cur;
@@ -1,8 +1,13 @@
 #include <am.h>
 #include <klib.h>
 
+static volatile int nr_syscall = 0;
+
 _RegSet* handler(_Event ev, _RegSet *regs) {
   switch (ev.event) {
+    case _EVENT_SYSCALL:
+      nr_syscall ++;
+      break;
     case _EVENT_IRQ_TIME:
       printf(".");
       break;
@@ -27,9 +32,34 @@ _RegSet* handler(_Event ev, _RegSet *regs) {
   return regs;
 }
 
+/* The cost of a system call round trip: the trap, the handler and the
+ * return, in time, in cycles and in instructions. The time is in ms, so
+ * enough round trips are made for it to be more than a few ticks; the
+ * cycles of the perf counters are exact even for a short run. */
+#define NR_SYSCALL 100000
+
+static void syscall_bench() {
+#ifdef __ISA_X86__
+  unsigned long msec = _uptime();
+  uint64_t instr = _perf_read(_PERF_INSTRET);
+  uint64_t cycle = _perf_read(_PERF_CYCLE);
+  for (int i = 0; i < NR_SYSCALL; i ++) {
+    asm volatile ("int $0x80" : : : "eax", "ecx", "edx", "memory");
+  }
+  cycle = _perf_read(_PERF_CYCLE) - cycle;
+  instr = _perf_read(_PERF_INSTRET) - instr;
+  msec = _uptime() - msec;
+  assert(nr_syscall == NR_SYSCALL);
+  printf("syscall: %d round trips in %d ms, %d ns, %d cycles and %d instructions each\n",
+      NR_SYSCALL, (int)msec, (int)(msec * (1000000 / NR_SYSCALL)),
+      (int)(cycle / NR_SYSCALL), (int)(instr / NR_SYSCALL));
+#endif
+}
+
 int main(){
   _ioe_init();
   _asye_init(handler);
+  syscall_bench();
   assert(!_istatus(1));
   _make(_heap, main, 0);
   while (1) _trap();